@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <grib2.h>
 #include <grib2_conv.h>
+#include <readahead.h>
 #include <bits.h>
 #include <math.h>
 #include <stdlib.h>
@@ -30,6 +31,8 @@ static int write_func(const void * buf, unsigned int len, void * ptr)
 
 int main(int argc, char ** argv)
 {
+	readahead_t * ra;
+
 	if (argc != 3) {
 		fprintf(stderr, "usage: %s GRIB2_file_name GRIB1_file_name\n", argv[0]);
 		return -1;
@@ -37,7 +40,15 @@ int main(int argc, char ** argv)
 
 	ifp = fopen(argv[1], "rb");
 	ofp = fopen(argv[2], "wb");
-	grib2_to_grib1_conv(read_func, NULL, write_func, NULL);
+
+	/* the messages are read on a background thread while converting */
+	ra = readahead_open(read_func, NULL, 2, READAHEAD_BUFFERS);
+	if (ra != NULL) {
+		grib2_to_grib1_conv(readahead_read, ra, write_func, NULL);
+		readahead_close(ra);
+	} else {
+		grib2_to_grib1_conv(read_func, NULL, write_func, NULL);
+	}
 	fclose(ifp);
 	fclose(ofp);
 
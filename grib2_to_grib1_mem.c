@@ -19,24 +19,6 @@ typedef struct {
 static data_buffer_t buf_src = { NULL, 0, 0 };
 static data_buffer_t buf_dst = { NULL, 0, 0 };
 
-static int read_func(void * buf, unsigned int len, void * ptr)
-{
-	UNUSED(ptr);
-
-	if (buf == NULL || buf_src.data == NULL || len == 0) return 0;
-	if (buf_src.ofs >= buf_src.len) return 0;
-	
-	if (buf_src.ofs + len > buf_src.len) {
-		len = buf_src.len - buf_src.ofs + 1;
-		memcpy(buf, buf_src.data + buf_src.ofs, len);
-		buf_src.ofs = buf_src.len;
-	} else {
-		memcpy(buf, buf_src.data + buf_src.ofs, len);
-		buf_src.ofs += len;
-	}	
-	return len;
-}
-
 static int write_func(const void * buf, unsigned int len, void * ptr)
 {
 	UNUSED(ptr);
@@ -89,7 +71,7 @@ int main(int argc, char ** argv)
 	}
 	fclose(ifp);
 	
-	grib2_to_grib1_conv(read_func, NULL, write_func, NULL);
+	grib2_to_grib1_conv_memory(buf_src.data, buf_src.len, write_func, NULL);
 
 	ofp = fopen(argv[2], "wb");
 	if (ofp == NULL) {
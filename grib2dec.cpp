@@ -1,6 +1,8 @@
 #include <cstdio>
 #include <cstring>
 #include <grib2_unpack.h>
+#include <readahead.h>
+#include <batch_reader.h>
 
 static int read_func(void * buf, unsigned int len, void * ptr)
 {
@@ -10,56 +12,101 @@ static int read_func(void * buf, unsigned int len, void * ptr)
 	return fread(buf, 1, len, file);
 }
 
-int main(int, char ** argv)
+/* Prints the winds of all grids of a message. */
+static int print_message(GRIBMessage & grib)
 {
-	GRIBMessage grib;
-	memset(&grib, 0, sizeof(grib));
-
-	FILE * file = fopen(argv[1], "r");
-	for (;;) {
-		int rc = grib2_unpack(&grib, read_func, file);
-		if (rc < 0) break;
-
-		for (int i = 0; i < grib.num_grids; ++i) {
-			GRIB2Grid & grid = grib.grids[i];
+	for (int i = 0; i < grib.num_grids; ++i) {
+		GRIB2Grid & grid = grib.grids[i];
 
 /*
-			printf("GRID %d\n", i);
-			printf("\tearth_shape: %d\n", grid.md.earth_shape);
-			printf("\tnx/ny: %d / %d\n", grid.md.nx, grid.md.ny);
-			printf("\tslat: %f\n", grid.md.slat);
-			printf("\tslon: %f\n", grid.md.slon);
-			printf("\telat: %f\n", grid.md.lats.elat);
-			printf("\telon: %f\n", grid.md.lons.elon);
+		printf("GRID %d\n", i);
+		printf("\tearth_shape: %d\n", grid.md.earth_shape);
+		printf("\tnx/ny: %d / %d\n", grid.md.nx, grid.md.ny);
+		printf("\tslat: %f\n", grid.md.slat);
+		printf("\tslon: %f\n", grid.md.slon);
+		printf("\telat: %f\n", grid.md.lats.elat);
+		printf("\telon: %f\n", grid.md.lons.elon);
 */
 
-			if (grid.gridpoints == NULL) {
-				printf("\nNO GRIDPOINTS\n");
-				return -1;
-			}
+		if (grib2_grid_values(&grib, i) == NULL) {
+			printf("\nNO GRIDPOINTS\n");
+			return -1;
+		}
 
-			if (grid.md.pds_templ_num == 0 && grid.md.param_cat == 2) {
-				if (grid.md.param_num == 2) { // UGRDA
-					for (int y = 0; y < grid.md.ny; ++y) {
-						for (int x = 0; x < grid.md.nx; ++x) {
-							double lat = (grid.md.lats.elat - grid.md.slat) / (grid.md.ny - 1) * y + grid.md.slat;
-							double lon = (grid.md.lons.elon - grid.md.slon) / (grid.md.nx - 1) * x + grid.md.slon;
-							printf("UGRD:%1.0f,%1.0f,%1.2f\n", lon, lat, grid.gridpoints[y * grid.md.nx + x]);
-						}
+		if (grid.md.pds_templ_num == 0 && grid.md.param_cat == 2) {
+			if (grid.md.param_num == 2) { // UGRDA
+				for (int y = 0; y < grid.md.ny; ++y) {
+					for (int x = 0; x < grid.md.nx; ++x) {
+						double lat = (grid.md.lats.elat - grid.md.slat) / (grid.md.ny - 1) * y + grid.md.slat;
+						double lon = (grid.md.lons.elon - grid.md.slon) / (grid.md.nx - 1) * x + grid.md.slon;
+						printf("UGRD:%1.0f,%1.0f,%1.2f\n", lon, lat, grid.gridpoints[y * grid.md.nx + x]);
 					}
-				} else if (grid.md.param_num == 3) { // VGRD
-					for (int y = 0; y < grid.md.ny; ++y) {
-						for (int x = 0; x < grid.md.nx; ++x) {
-							double lat = (grid.md.lats.elat - grid.md.slat) / (grid.md.ny - 1) * y + grid.md.slat;
-							double lon = (grid.md.lons.elon - grid.md.slon) / (grid.md.nx - 1) * x + grid.md.slon;
-							printf("VGRD:%1.0f,%1.0f,%1.2f\n", lon, lat, grid.gridpoints[y * grid.md.nx + x]);
-						}
+				}
+			} else if (grid.md.param_num == 3) { // VGRD
+				for (int y = 0; y < grid.md.ny; ++y) {
+					for (int x = 0; x < grid.md.nx; ++x) {
+						double lat = (grid.md.lats.elat - grid.md.slat) / (grid.md.ny - 1) * y + grid.md.slat;
+						double lon = (grid.md.lons.elon - grid.md.slon) / (grid.md.nx - 1) * x + grid.md.slon;
+						printf("VGRD:%1.0f,%1.0f,%1.2f\n", lon, lat, grid.gridpoints[y * grid.md.nx + x]);
 					}
 				}
 			}
+		}
 
+	}
+	return 0;
+}
+
+/* Decodes many files, read concurrently by the batch reader. The files are
+ * decoded in the order their reads complete. */
+static int decode_files(const char * const * filenames, size_t num_files)
+{
+	GRIBMessage grib;
+	memset(&grib, 0, sizeof(grib));
+
+	batch_reader_t * br = batch_reader_open(filenames, num_files, 0, 0);
+	if (br == NULL) return -1;
+
+	size_t file;
+	const unsigned char * buf;
+	size_t len;
+	int rc;
+	while ((rc = batch_reader_next(br, &file, &buf, &len)) >= 0) {
+		if (rc > 0) continue;
+		size_t cursor = 0;
+		while (grib2_unpack_from_memory(&grib, buf, len, &cursor) == 0) {
+			if (print_message(grib) != 0) {
+				grib2_free(&grib);
+				batch_reader_close(br);
+				return -1;
+			}
 		}
 	}
+	grib2_free(&grib);
+	batch_reader_close(br);
+	return 0;
+}
+
+int main(int argc, char ** argv)
+{
+	if (argc > 2) {
+		return decode_files(argv + 1, static_cast<size_t>(argc - 1));
+	}
+
+	GRIBMessage grib;
+	memset(&grib, 0, sizeof(grib));
+
+	FILE * file = fopen(argv[1], "r");
+	readahead_t * ra = readahead_open(read_func, file, 2, READAHEAD_BUFFERS);
+	for (;;) {
+		int rc = (ra != NULL)
+			? grib2_unpack(&grib, readahead_read, ra)
+			: grib2_unpack(&grib, read_func, file);
+		if (rc < 0) break;
+
+		if (print_message(grib) != 0) return -1;
+	}
+	readahead_close(ra);
 	fclose(file);
 
 	return 0;
@@ -0,0 +1,150 @@
+#include <arena.h>
+#include <stdlib.h>
+
+/* Allocations are aligned for every type the unpackers store. */
+#define ARENA_ALIGN 16
+
+struct arena_block_t {
+	arena_block_t * next;
+	size_t size; /* usable bytes following the header */
+};
+
+#define ARENA_HEADER ((sizeof(arena_block_t) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+static arena_block_t * arena_block(size_t size) /* {{{ */
+{
+	arena_block_t * block;
+
+	if (size < ARENA_MIN_BLOCK) size = ARENA_MIN_BLOCK;
+	block = (arena_block_t *)malloc(ARENA_HEADER + size);
+	if (block == NULL) {
+		fprintf(stderr, "Error: cannot allocate %lu bytes\n", (unsigned long)size);
+		return NULL;
+	}
+	block->next = NULL;
+	block->size = size;
+	return block;
+} /* }}} */
+
+void arena_init(arena_t * arena)
+{
+	arena->blocks = NULL;
+	arena->used = 0;
+}
+
+/* Allocates memory from the arena, valid until the arena is reset. Once the
+ * arena has seen messages of a similar size, no further memory is allocated
+ * from the system.
+ *
+ * @param[inout] arena The arena.
+ * @param[in] size Number of bytes.
+ * @return The memory, NULL if it cannot be allocated.
+ */
+void * arena_alloc(arena_t * arena, size_t size)
+{
+	arena_block_t * block;
+	size_t want;
+	void * p;
+
+	size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	if (arena->blocks == NULL || arena->used + size > arena->blocks->size) {
+		/* blocks grow geometrically, only few are needed until the next reset */
+		want = size;
+		if (arena->blocks != NULL && want < arena->blocks->size * 2) want = arena->blocks->size * 2;
+		block = arena_block(want);
+		if (block == NULL) return NULL;
+		block->next = arena->blocks;
+		arena->blocks = block;
+		arena->used = 0;
+	}
+	p = (unsigned char *)arena->blocks + ARENA_HEADER + arena->used;
+	arena->used += size;
+	return p;
+}
+
+/* Releases all allocations. If more than one block was needed, the blocks are
+ * replaced by a single one large enough for all of them, the next message of
+ * the same size fits into it. */
+void arena_reset(arena_t * arena)
+{
+	arena_block_t * block;
+	size_t total = 0;
+
+	if (arena->blocks != NULL && arena->blocks->next != NULL) {
+		while (arena->blocks != NULL) {
+			block = arena->blocks;
+			arena->blocks = block->next;
+			total += block->size;
+			free(block);
+		}
+		arena->blocks = arena_block(total);
+	}
+	arena->used = 0;
+}
+
+void arena_free(arena_t * arena)
+{
+	arena_block_t * block;
+
+	while (arena->blocks != NULL) {
+		block = arena->blocks;
+		arena->blocks = block->next;
+		free(block);
+	}
+	arena->used = 0;
+}
+
+/* Makes sure the buffer holds at least the specified number of bytes. The
+ * contents are not preserved when the buffer grows.
+ *
+ * @param[inout] pool The buffer.
+ * @param[in] size Number of bytes needed.
+ * @return The buffer, NULL if it cannot be allocated (the previous buffer is kept).
+ */
+void * pool_reserve(pool_t * pool, size_t size)
+{
+	void * p;
+
+	if (size > pool->size) {
+		if (size < pool->size + pool->size / 2) size = pool->size + pool->size / 2;
+		p = malloc(size);
+		if (p == NULL) {
+			fprintf(stderr, "Error: cannot allocate %lu bytes\n", (unsigned long)size);
+			return NULL;
+		}
+		free(pool->data);
+		pool->data = p;
+		pool->size = size;
+	}
+	return pool->data;
+}
+
+/* Same as pool_reserve(), but the contents are preserved when the buffer grows.
+ *
+ * @param[inout] pool The buffer.
+ * @param[in] size Number of bytes needed.
+ * @return The buffer, NULL if it cannot be allocated (the previous buffer is kept).
+ */
+void * pool_grow(pool_t * pool, size_t size)
+{
+	void * p;
+
+	if (size > pool->size) {
+		if (size < pool->size + pool->size / 2) size = pool->size + pool->size / 2;
+		p = realloc(pool->data, size);
+		if (p == NULL) {
+			fprintf(stderr, "Error: cannot allocate %lu bytes\n", (unsigned long)size);
+			return NULL;
+		}
+		pool->data = p;
+		pool->size = size;
+	}
+	return pool->data;
+}
+
+void pool_free(pool_t * pool)
+{
+	free(pool->data);
+	pool->data = NULL;
+	pool->size = 0;
+}
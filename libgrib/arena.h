@@ -0,0 +1,41 @@
+#ifndef __ARENA__H__
+#define __ARENA__H__
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Minimum size of a block of an arena in bytes. */
+#define ARENA_MIN_BLOCK (64 * 1024)
+
+typedef struct arena_block_t arena_block_t;
+
+/* Memory for all allocations belonging to one message. The allocations are
+ * released all at once, the memory is kept for the next message. */
+typedef struct {
+	arena_block_t * blocks; /* list of blocks, the current one first */
+	size_t used; /* bytes used within the current block */
+} arena_t;
+
+/* Grow-only buffer, kept across messages. */
+typedef struct {
+	void * data;
+	size_t size; /* size of the buffer in bytes */
+} pool_t;
+
+void arena_init(arena_t * arena);
+void * arena_alloc(arena_t * arena, size_t size);
+void arena_reset(arena_t * arena);
+void arena_free(arena_t * arena);
+
+void * pool_reserve(pool_t * pool, size_t size);
+void * pool_grow(pool_t * pool, size_t size);
+void pool_free(pool_t * pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,566 @@
+#define _GNU_SOURCE
+#include <batch_reader.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(__NR_io_uring_register) && defined(IORING_FEAT_RW_CUR_POS)
+#define BATCH_READER_URING
+#endif
+
+/* Reads many files concurrently.
+ *
+ * Every file is read as a whole into one of 'depth' buffers, the files are
+ * handed out in the order their reads complete, the messages within are
+ * unpacked in place with the memory unpack functions. With io_uring, the
+ * reads of all buffers are in flight at the same time, submitted and reaped
+ * with a single system call. Without io_uring (not supported by the system or
+ * by the kernel, or not wanted) the files are read one after the other with
+ * pread().
+ *
+ * A buffer grows with the files read into it. All buffers together are kept
+ * below BATCH_READER_MAX_MEMORY: a file which does not fit waits until other
+ * buffers are free, unless no other file is read, so a single file larger
+ * than the limit is still read. Registering the buffers with the kernel needs
+ * buffers which never change, they are allocated once, large enough for the
+ * largest file, if all of them fit into the limit; otherwise the buffers are
+ * not registered.
+ *
+ * For O_DIRECT, the buffers and the lengths of the reads are aligned to
+ * BATCH_READER_ALIGN. A read which returns fewer bytes than requested leaves
+ * the offset unaligned, the rest of the file (and a file whose file system
+ * rejects the read) is read without O_DIRECT.
+ */
+
+#define BATCH_READER_ALIGN 4096
+
+/* Limit of the memory of all buffers. */
+#define BATCH_READER_MAX_MEMORY ((size_t)1024 * 1024 * 1024)
+
+/* Largest number of bytes read by one request. */
+#define BATCH_READER_MAX_READ (1024 * 1024 * 1024)
+
+enum {
+	SLOT_FREE,
+	SLOT_WAITING, /* opened, waiting for memory */
+	SLOT_READING,
+	SLOT_READY,
+	SLOT_FAILED,
+	SLOT_HANDED
+};
+
+typedef struct {
+	unsigned char * data; /* buffer */
+	size_t cap; /* capacity of the buffer */
+	size_t len; /* size of the file */
+	size_t done; /* bytes read */
+	size_t file; /* number of the file */
+	int fd;
+	int direct; /* the file is read with O_DIRECT */
+	int state;
+	int pending; /* a read is in flight */
+} batch_slot_t;
+
+struct batch_reader_t {
+	const char * const * filenames;
+	size_t num_files;
+	size_t next_file; /* next file to be read */
+	unsigned int flags;
+	batch_slot_t * slots;
+	size_t num_slots;
+	size_t cap; /* capacity of every buffer if they never change, otherwise 0 */
+	size_t memory; /* capacity of all buffers */
+	int ring_fd; /* -1 without io_uring */
+#if defined(BATCH_READER_URING)
+	void * sq_map;
+	size_t sq_map_len;
+	void * cq_map;
+	size_t cq_map_len;
+	struct io_uring_sqe * sqes;
+	size_t sqes_len;
+	unsigned int * sq_tail;
+	unsigned int * sq_mask;
+	unsigned int * sq_array;
+	unsigned int * cq_head;
+	unsigned int * cq_tail;
+	unsigned int * cq_mask;
+	struct io_uring_cqe * cqes;
+	unsigned int to_submit; /* requests queued but not submitted yet */
+	int registered; /* the buffers are registered */
+#endif
+};
+
+static size_t align_up(size_t n) /* {{{ */
+{
+	return (n + BATCH_READER_ALIGN - 1) & ~(size_t)(BATCH_READER_ALIGN - 1);
+} /* }}} */
+
+/* Opens the next file and assigns it to the buffer, the buffer is provided
+ * by slot_reserve(). */
+static void slot_assign(batch_reader_t * br, batch_slot_t * slot) /* {{{ */
+{
+	const char * filename = br->filenames[br->next_file];
+	struct stat st;
+
+	slot->file = br->next_file++;
+	slot->len = 0;
+	slot->done = 0;
+	slot->pending = 0;
+	slot->fd = -1;
+	slot->direct = 0;
+	slot->state = SLOT_FAILED;
+
+#if defined(O_DIRECT)
+	if (br->flags & BATCH_READER_DIRECT) {
+		slot->fd = open(filename, O_RDONLY | O_DIRECT);
+		slot->direct = (slot->fd >= 0);
+	}
+#endif
+	if (slot->fd < 0) {
+		/* O_DIRECT is not supported by every file system */
+		slot->fd = open(filename, O_RDONLY);
+	}
+	if (slot->fd < 0) {
+		fprintf(stderr, "Error: cannot open file '%s'\n", filename);
+		return;
+	}
+	if (fstat(slot->fd, &st) != 0 || (br->cap > 0 && (size_t)st.st_size > br->cap)) {
+		/* the file changed since the reader was opened */
+		fprintf(stderr, "Error: cannot read file '%s'\n", filename);
+		close(slot->fd);
+		slot->fd = -1;
+		return;
+	}
+	slot->len = (size_t)st.st_size;
+	slot->state = SLOT_WAITING;
+} /* }}} */
+
+/* Releases the buffer of a slot. */
+static void slot_release(batch_reader_t * br, batch_slot_t * slot) /* {{{ */
+{
+	free(slot->data);
+	br->memory -= slot->cap;
+	slot->data = NULL;
+	slot->cap = 0;
+} /* }}} */
+
+/* Provides the buffer for the file of a waiting slot. The buffers of free
+ * slots are released if the memory exceeds the limit, the slot keeps waiting
+ * if it is still exceeded and other files are read.
+ *
+ * @param[in] br The reader.
+ * @param[in] slot The slot.
+ * @param[in] busy Other files are read or not handed out yet.
+ */
+static void slot_reserve(batch_reader_t * br, batch_slot_t * slot, int busy) /* {{{ */
+{
+	size_t need = align_up(slot->len > 0 ? slot->len : 1);
+	size_t i;
+
+	if (slot->cap < need) {
+		slot_release(br, slot);
+		for (i = 0; i < br->num_slots && br->memory + need > BATCH_READER_MAX_MEMORY; ++i) {
+			if (br->slots[i].state == SLOT_FREE) slot_release(br, &br->slots[i]);
+		}
+		if (br->memory + need > BATCH_READER_MAX_MEMORY && busy) {
+			return;
+		}
+		if (posix_memalign((void **)&slot->data, BATCH_READER_ALIGN, need) != 0) {
+			slot->data = NULL;
+			fprintf(stderr, "Error: cannot allocate %lu bytes\n", (unsigned long)need);
+			close(slot->fd);
+			slot->fd = -1;
+			slot->state = SLOT_FAILED;
+			return;
+		}
+		slot->cap = need;
+		br->memory += need;
+	}
+	slot->state = SLOT_READING;
+} /* }}} */
+
+/* Continues reading a file of a slot without O_DIRECT. */
+static int slot_reopen(batch_reader_t * br, batch_slot_t * slot) /* {{{ */
+{
+	int fd = open(br->filenames[slot->file], O_RDONLY);
+
+	if (fd < 0) {
+		return -1;
+	}
+	close(slot->fd);
+	slot->fd = fd;
+	slot->direct = 0;
+	return 0;
+} /* }}} */
+
+/* Completes a read of the buffer, 'res' is the result of the read, the
+ * negative error number on failure. */
+static void slot_complete(batch_reader_t * br, batch_slot_t * slot, long res) /* {{{ */
+{
+	slot->pending = 0;
+	if (res == -EINVAL && slot->direct && slot_reopen(br, slot) == 0) {
+		return;
+	}
+	if (res < 0) {
+		fprintf(stderr, "Error: cannot read file '%s'\n", br->filenames[slot->file]);
+		slot->state = SLOT_FAILED;
+	} else if (res == 0 && slot->done < slot->len) {
+		fprintf(stderr, "Error: file '%s' is truncated\n", br->filenames[slot->file]);
+		slot->state = SLOT_FAILED;
+	} else {
+		slot->done += (size_t)res;
+		if (slot->done >= slot->len) {
+			/* with O_DIRECT the last read may have been longer than the file */
+			slot->done = slot->len;
+			slot->state = SLOT_READY;
+		} else if (slot->direct && slot->done % BATCH_READER_ALIGN != 0 && slot_reopen(br, slot) != 0) {
+			fprintf(stderr, "Error: cannot read file '%s'\n", br->filenames[slot->file]);
+			slot->state = SLOT_FAILED;
+		}
+	}
+	if (slot->state != SLOT_READING) {
+		close(slot->fd);
+		slot->fd = -1;
+	}
+} /* }}} */
+
+/* Number of bytes of the next read of the buffer. */
+static size_t slot_request(const batch_slot_t * slot) /* {{{ */
+{
+	size_t n = align_up(slot->len) - slot->done;
+
+	return (n > BATCH_READER_MAX_READ) ? BATCH_READER_MAX_READ : n;
+} /* }}} */
+
+#if defined(BATCH_READER_URING)
+
+static int uring_setup(batch_reader_t * br, unsigned int entries) /* {{{ */
+{
+	struct io_uring_params p;
+	struct iovec * iov;
+	unsigned char * sq;
+	unsigned char * cq;
+	size_t i;
+
+	memset(&p, 0, sizeof(p));
+	br->ring_fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+	if (br->ring_fd < 0) {
+		br->ring_fd = -1;
+		return -1;
+	}
+
+	br->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	br->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	br->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	br->sq_map = mmap(NULL, br->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, br->ring_fd, IORING_OFF_SQ_RING);
+	br->cq_map = mmap(NULL, br->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, br->ring_fd, IORING_OFF_CQ_RING);
+	br->sqes = (struct io_uring_sqe *)mmap(NULL, br->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, br->ring_fd, IORING_OFF_SQES);
+	if (br->sq_map == MAP_FAILED || br->cq_map == MAP_FAILED || (void *)br->sqes == MAP_FAILED) {
+		return -1;
+	}
+
+	sq = (unsigned char *)br->sq_map;
+	cq = (unsigned char *)br->cq_map;
+	br->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+	br->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+	br->sq_array = (unsigned int *)(sq + p.sq_off.array);
+	br->cq_head = (unsigned int *)(cq + p.cq_off.head);
+	br->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+	br->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+	br->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	if ((br->flags & BATCH_READER_REGISTER) && br->cap > 0) {
+		/* fails e.g. if the buffers exceed the limit of locked memory, they are used unregistered then */
+		iov = (struct iovec *)malloc(br->num_slots * sizeof(struct iovec));
+		if (iov != NULL) {
+			for (i = 0; i < br->num_slots; ++i) {
+				iov[i].iov_base = br->slots[i].data;
+				iov[i].iov_len = br->cap;
+			}
+			br->registered = syscall(__NR_io_uring_register, br->ring_fd, IORING_REGISTER_BUFFERS, iov, (unsigned int)br->num_slots) == 0;
+			free(iov);
+		}
+	}
+	if (!br->registered) {
+		/* the buffers grow with the files */
+		br->cap = 0;
+	}
+	return 0;
+} /* }}} */
+
+static void uring_teardown(batch_reader_t * br) /* {{{ */
+{
+	if (br->sqes != NULL && (void *)br->sqes != MAP_FAILED) munmap(br->sqes, br->sqes_len);
+	if (br->cq_map != NULL && br->cq_map != MAP_FAILED) munmap(br->cq_map, br->cq_map_len);
+	if (br->sq_map != NULL && br->sq_map != MAP_FAILED) munmap(br->sq_map, br->sq_map_len);
+	if (br->ring_fd >= 0) close(br->ring_fd);
+	br->sqes = NULL;
+	br->cq_map = NULL;
+	br->sq_map = NULL;
+	br->ring_fd = -1;
+} /* }}} */
+
+/* Queues the next read of a buffer. There is always room in the submission
+ * queue, it has an entry for every buffer and every buffer has at most one
+ * read in flight. */
+static void uring_queue(batch_reader_t * br, size_t n) /* {{{ */
+{
+	batch_slot_t * slot = &br->slots[n];
+	struct io_uring_sqe * sqe;
+	unsigned int tail;
+	unsigned int index;
+
+	tail = *br->sq_tail;
+	index = tail & *br->sq_mask;
+	sqe = &br->sqes[index];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sqe->opcode = br->registered ? IORING_OP_READ_FIXED : IORING_OP_READ;
+	sqe->fd = slot->fd;
+	sqe->off = slot->done;
+	sqe->addr = (unsigned long)(slot->data + slot->done);
+	sqe->len = (unsigned int)slot_request(slot);
+	sqe->buf_index = (unsigned short)(br->registered ? n : 0);
+	sqe->user_data = n;
+	br->sq_array[index] = index;
+	__atomic_store_n(br->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	br->to_submit++;
+	slot->pending = 1;
+} /* }}} */
+
+/* Submits all queued reads and waits for at least one completion if 'wait'
+ * is set, all completions available are processed. */
+static int uring_enter(batch_reader_t * br, int wait) /* {{{ */
+{
+	struct io_uring_cqe * cqe;
+	unsigned int head;
+	long rc;
+
+	do {
+		rc = syscall(__NR_io_uring_enter, br->ring_fd, br->to_submit, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	} while (rc < 0 && errno == EINTR);
+	if (rc < 0) {
+		fprintf(stderr, "Error: cannot submit reads\n");
+		return -1;
+	}
+	br->to_submit -= (unsigned int)rc;
+
+	head = *br->cq_head;
+	while (head != __atomic_load_n(br->cq_tail, __ATOMIC_ACQUIRE)) {
+		cqe = &br->cqes[head & *br->cq_mask];
+		slot_complete(br, &br->slots[cqe->user_data], cqe->res);
+		head++;
+	}
+	__atomic_store_n(br->cq_head, head, __ATOMIC_RELEASE);
+	return 0;
+} /* }}} */
+
+#endif
+
+/* Reads the next file with pread(), used without io_uring. */
+static void posix_read(batch_reader_t * br, batch_slot_t * slot) /* {{{ */
+{
+	ssize_t res;
+
+	while (slot->state == SLOT_READING) {
+		do {
+			res = pread(slot->fd, slot->data + slot->done, slot_request(slot), (off_t)slot->done);
+		} while (res < 0 && errno == EINTR);
+		slot_complete(br, slot, (res < 0) ? -(long)errno : (long)res);
+	}
+} /* }}} */
+
+/* Prepares reading a list of files.
+ *
+ * @param[in] filenames Names of the files, must be valid until the reader is closed.
+ * @param[in] num_files Number of files.
+ * @param[in] depth Number of files read concurrently, 0 for BATCH_READER_DEPTH.
+ * @param[in] flags Combination of BATCH_READER_DIRECT, BATCH_READER_REGISTER
+ *     and BATCH_READER_POSIX.
+ * @return The reader, NULL on failure.
+ */
+batch_reader_t * batch_reader_open(const char * const * filenames, size_t num_files, size_t depth, unsigned int flags)
+{
+	batch_reader_t * br;
+	struct stat st;
+	size_t max_len = 0;
+	size_t i;
+
+	if (filenames == NULL && num_files > 0) {
+		return NULL;
+	}
+	if (depth == 0) depth = BATCH_READER_DEPTH;
+	if (depth > num_files) depth = num_files;
+	if (depth == 0) depth = 1;
+
+	/* registered buffers must hold the largest file, files which cannot be accessed fail when read */
+	for (i = 0; (flags & BATCH_READER_REGISTER) && !(flags & BATCH_READER_POSIX) && i < num_files; ++i) {
+		if (stat(filenames[i], &st) == 0 && (size_t)st.st_size > max_len) {
+			max_len = (size_t)st.st_size;
+		}
+	}
+
+	br = (batch_reader_t *)calloc(1, sizeof(batch_reader_t));
+	if (br == NULL) {
+		return NULL;
+	}
+	br->filenames = filenames;
+	br->num_files = num_files;
+	br->flags = flags;
+	br->ring_fd = -1;
+	br->num_slots = (flags & BATCH_READER_POSIX) ? 1 : depth;
+	br->slots = (batch_slot_t *)calloc(br->num_slots, sizeof(batch_slot_t));
+	if (br->slots == NULL) {
+		free(br);
+		return NULL;
+	}
+	for (i = 0; i < br->num_slots; ++i) {
+		br->slots[i].fd = -1;
+	}
+	if (max_len > 0 && align_up(max_len) <= BATCH_READER_MAX_MEMORY / br->num_slots) {
+		br->cap = align_up(max_len);
+		for (i = 0; i < br->num_slots; ++i) {
+			if (posix_memalign((void **)&br->slots[i].data, BATCH_READER_ALIGN, br->cap) != 0) {
+				br->slots[i].data = NULL;
+				fprintf(stderr, "Error: cannot allocate %lu bytes\n", (unsigned long)br->cap);
+				batch_reader_close(br);
+				return NULL;
+			}
+			br->slots[i].cap = br->cap;
+			br->memory += br->cap;
+		}
+	}
+
+#if defined(BATCH_READER_URING)
+	if (!(flags & BATCH_READER_POSIX) && uring_setup(br, (unsigned int)br->num_slots) != 0) {
+		uring_teardown(br);
+	}
+#endif
+	if (br->ring_fd < 0) {
+		/* only one buffer is used by pread() */
+		for (i = 1; i < br->num_slots; ++i) {
+			slot_release(br, &br->slots[i]);
+		}
+		br->num_slots = 1;
+		br->cap = 0;
+	}
+	return br;
+}
+
+/* Returns the next file read completely. The files are returned in the order
+ * their reads complete, not necessarily in the order of the list. The buffer
+ * of the previous file is reused, the data returned is valid until the next
+ * call.
+ *
+ * @param[in] br The reader.
+ * @param[out] file Number of the file within the list.
+ * @param[out] buf Contents of the file.
+ * @param[out] len Size of the file.
+ * @retval 0 Success
+ * @retval 1 The file could not be read, 'file' is valid
+ * @retval -1 No more files
+ */
+int batch_reader_next(batch_reader_t * br, size_t * file, const unsigned char ** buf, size_t * len)
+{
+	batch_slot_t * slot;
+	size_t active;
+	size_t i;
+	size_t k;
+	int busy;
+	int rc;
+
+	if (br == NULL || file == NULL || buf == NULL || len == NULL) {
+		return -1;
+	}
+
+	for (i = 0; i < br->num_slots; ++i) {
+		if (br->slots[i].state == SLOT_HANDED) br->slots[i].state = SLOT_FREE;
+	}
+
+	for (;;) {
+		active = 0;
+		for (i = 0; i < br->num_slots; ++i) {
+			slot = &br->slots[i];
+			if (slot->state == SLOT_FREE && br->next_file < br->num_files) {
+				slot_assign(br, slot);
+			}
+			if (slot->state == SLOT_WAITING) {
+				for (busy = 0, k = 0; k < br->num_slots; ++k) {
+					if (br->slots[k].state == SLOT_READING || br->slots[k].state == SLOT_READY) busy = 1;
+				}
+				slot_reserve(br, slot, busy);
+			}
+			if (slot->state == SLOT_READING && br->ring_fd < 0) {
+				posix_read(br, slot);
+			}
+			if (slot->state == SLOT_READY || slot->state == SLOT_FAILED) {
+				rc = (slot->state == SLOT_READY) ? 0 : 1;
+				*file = slot->file;
+				*buf = (rc == 0) ? slot->data : NULL;
+				*len = (rc == 0) ? slot->len : 0;
+				slot->state = SLOT_HANDED;
+				return rc;
+			}
+			if (slot->state == SLOT_WAITING) {
+				active++;
+			}
+			if (slot->state == SLOT_READING) {
+				active++;
+#if defined(BATCH_READER_URING)
+				if (!slot->pending) {
+					uring_queue(br, i);
+				}
+#endif
+			}
+		}
+		if (active == 0) {
+			return -1;
+		}
+#if defined(BATCH_READER_URING)
+		if (uring_enter(br, 1) != 0) {
+			return -1;
+		}
+#endif
+	}
+}
+
+/* Name of the backend used, "io_uring" or "posix". */
+const char * batch_reader_backend(const batch_reader_t * br)
+{
+	return (br != NULL && br->ring_fd >= 0) ? "io_uring" : "posix";
+}
+
+/* Closes the reader, all files handed out become invalid. */
+void batch_reader_close(batch_reader_t * br)
+{
+	size_t i;
+
+	if (br == NULL) return;
+
+#if defined(BATCH_READER_URING)
+	/* reads still in flight must complete before their buffers are released */
+	for (i = 0; br->ring_fd >= 0 && i < br->num_slots; ++i) {
+		while (br->slots[i].pending) {
+			if (uring_enter(br, 1) != 0) break;
+		}
+		if (br->slots[i].pending) break;
+	}
+	uring_teardown(br);
+#endif
+	for (i = 0; i < br->num_slots; ++i) {
+		if (br->slots[i].fd >= 0) close(br->slots[i].fd);
+		free(br->slots[i].data);
+	}
+	free(br->slots);
+	free(br);
+}
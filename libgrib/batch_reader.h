@@ -0,0 +1,29 @@
+#ifndef __BATCH_READER__H__
+#define __BATCH_READER__H__
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Flags of batch_reader_open(). */
+#define BATCH_READER_DIRECT 0x01 /* read with O_DIRECT, bypassing the page cache */
+#define BATCH_READER_REGISTER 0x02 /* register the buffers with the kernel, if buffers for the largest file fit the memory limit */
+#define BATCH_READER_POSIX 0x04 /* do not use io_uring */
+
+/* Default number of files read concurrently. */
+#define BATCH_READER_DEPTH 16
+
+typedef struct batch_reader_t batch_reader_t;
+
+batch_reader_t * batch_reader_open(const char * const * filenames, size_t num_files, size_t depth, unsigned int flags);
+int batch_reader_next(batch_reader_t * br, size_t * file, const unsigned char ** buf, size_t * len);
+const char * batch_reader_backend(const batch_reader_t * br);
+void batch_reader_close(batch_reader_t * br);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
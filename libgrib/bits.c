@@ -1,5 +1,7 @@
 #include <bits.h>
+#include <bits_simd.h>
 #include <stdlib.h>
+#include <stdint.h>
 
 /* Gets the contents of the various GRIB octets
  *
@@ -75,6 +77,130 @@ int get_bits(const unsigned char * buf, int * loc, size_t off, size_t bits)
 	return 0;
 }
 
+/* Reads 8 bytes as big endian word. */
+static uint64_t load_be64(const unsigned char * p)
+{
+	return ((uint64_t)p[0] << 56)
+		| ((uint64_t)p[1] << 48)
+		| ((uint64_t)p[2] << 40)
+		| ((uint64_t)p[3] << 32)
+		| ((uint64_t)p[4] << 24)
+		| ((uint64_t)p[5] << 16)
+		| ((uint64_t)p[6] <<  8)
+		| ((uint64_t)p[7]);
+}
+
+/* Unpacks byte aligned values of 8, 16, 24 or 32 bits. */
+static void get_bytes_array(const unsigned char * p, size_t bits, size_t count, int * out)
+{
+	size_t n;
+
+	switch (bits) {
+		case 8:
+			for (n = 0; n < count; n++, p += 1) {
+				out[n] = p[0];
+			}
+			break;
+		case 16:
+			for (n = 0; n < count; n++, p += 2) {
+				out[n] = (p[0] << 8) | p[1];
+			}
+			break;
+		case 24:
+			for (n = 0; n < count; n++, p += 3) {
+				out[n] = (p[0] << 16) | (p[1] << 8) | p[2];
+			}
+			break;
+		case 32:
+			for (n = 0; n < count; n++, p += 4) {
+				out[n] = (int)(((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) | ((unsigned int)p[2] << 8) | p[3]);
+			}
+			break;
+	}
+}
+
+/* Unpacks a run of values of the same bit width. This is equivalent to calling
+ * get_bits() for every value, but the bits are read through a 64 bit register
+ * which is refilled a word at a time. Byte aligned runs of 8, 16, 24 and 32 bit
+ * values are read directly. The buffer is never read beyond the last byte
+ * containing bits of the requested values.
+ *
+ * Longer runs are handed to the vectorized kernel selected at runtime (see
+ * set_bits_kernel()), the scalar code unpacks what the kernel leaves over.
+ *
+ * @param[in] buf GRIB buffer as a stream of bytes.
+ * @param[in] off The offset in BITS from the beginning of the buffer to the first value.
+ * @param[in] bits Width of each value in BITS.
+ * @param[in] count Number of values to unpack.
+ * @param[out] out Array to hold the unpacked values, must be able to hold 'count' values.
+ * @retval 0 Success
+ * @retval -1 Failure
+ */
+int get_bits_array(const unsigned char * buf, size_t off, size_t bits, size_t count, int * out)
+{
+	const unsigned char * p;
+	const unsigned char * end;
+	uint64_t acc; /* bit cache, the lowest 'avail' bits are valid */
+	uint64_t mask;
+	size_t avail;
+	size_t k;
+	size_t n;
+
+	/* no work to do */
+	if (count == 0) return 0;
+
+	if (bits > sizeof(int) * 8) {
+		fprintf(stderr,"Error: unpacking %u bits into a %u-bit field\n", (unsigned int)bits, (unsigned int)(sizeof(int) * 8));
+		return -1;
+	}
+
+	/* constant field, nothing stored */
+	if (bits == 0) {
+		for (n = 0; n < count; n++) out[n] = 0;
+		return 0;
+	}
+
+	if (count >= BITS_SIMD_MIN_COUNT) {
+		n = bits_simd_unpack(buf, off, bits, count, (off + bits * count + 7) / 8, out);
+		if (n == count) return 0;
+		off += n * bits;
+		count -= n;
+		out += n;
+	}
+
+	p = buf + off / 8;
+	if (off % 8 == 0 && bits % 8 == 0) {
+		get_bytes_array(p, bits, count, out);
+		return 0;
+	}
+
+	end = buf + (off + bits * count + 7) / 8;
+	mask = ((uint64_t)1 << bits) - 1;
+	avail = 8 - off % 8;
+	acc = *p++ & (0xff >> (off % 8));
+
+	for (n = 0; n < count; n++) {
+		if (avail < bits) {
+			if (end - p >= 8) {
+				/* refill as many whole bytes as the register can take */
+				k = (64 - avail) / 8;
+				if (k > 7) k = 7;
+				acc = (acc << (k * 8)) | (load_be64(p) >> (64 - k * 8));
+				p += k;
+				avail += k * 8;
+			} else {
+				while (avail < bits) {
+					acc = (acc << 8) | *p++;
+					avail += 8;
+				}
+			}
+		}
+		avail -= bits;
+		out[n] = (int)((acc >> avail) & mask);
+	}
+	return 0;
+}
+
 /* Sets the contents of the various GRIB octets
  *
  * @param[out] buf GRIB buffer as stream of bytes.
@@ -170,6 +296,165 @@ int append_bits(buffer_t * buf, int src, size_t bits)
 	return 0;
 }
 
+/* Packs byte aligned values of 8, 16, 24 or 32 bits. */
+static void set_bytes_array(unsigned char * p, const int * src, size_t bits, size_t count)
+{
+	size_t n;
+
+	switch (bits) {
+		case 8:
+			for (n = 0; n < count; n++, p += 1) {
+				p[0] = (unsigned char)src[n];
+			}
+			break;
+		case 16:
+			for (n = 0; n < count; n++, p += 2) {
+				p[0] = (unsigned char)(src[n] >> 8);
+				p[1] = (unsigned char)src[n];
+			}
+			break;
+		case 24:
+			for (n = 0; n < count; n++, p += 3) {
+				p[0] = (unsigned char)(src[n] >> 16);
+				p[1] = (unsigned char)(src[n] >> 8);
+				p[2] = (unsigned char)src[n];
+			}
+			break;
+		case 32:
+			for (n = 0; n < count; n++, p += 4) {
+				p[0] = (unsigned char)((unsigned int)src[n] >> 24);
+				p[1] = (unsigned char)(src[n] >> 16);
+				p[2] = (unsigned char)(src[n] >> 8);
+				p[3] = (unsigned char)src[n];
+			}
+			break;
+	}
+}
+
+/* Appends a run of values of the same bit width to the buffer. This is equivalent
+ * to calling append_bits() for every value, but the bits are collected in a 64 bit
+ * register and written 4 bytes at a time. Byte aligned runs of 8, 16, 24 and 32 bit
+ * values are written directly (vectorized if supported by the CPU, see set_bits_kernel()).
+ * Bits before the first value and behind the last value remain untouched.
+ *
+ * @param[inout] buf The buffer to carry the data.
+ * @param[in] src Values to pack, the upper bits beyond 'bits' are ignored.
+ * @param[in] count Number of values to pack.
+ * @param[in] bits Width of each value in BITS.
+ * @retval 0 Success
+ * @retval -1 Failure
+ */
+int append_bits_array(buffer_t * buf, const int * src, size_t count, size_t bits)
+{
+	unsigned char * p;
+	uint64_t acc; /* bit cache, the lowest 'avail' bits are pending */
+	uint64_t mask;
+	size_t avail;
+	size_t n;
+
+	/* no work to do */
+	if (count == 0 || bits == 0) return 0;
+
+	if (bits > sizeof(int) * 8) {
+		fprintf(stderr,"Error: packing %u bits from a %u-bit field\n", (unsigned int)bits, (unsigned int)(sizeof(int) * 8));
+		return -1;
+	}
+	if ((buf->offset + count * bits + 7) / 8 > buf->length) {
+		fprintf(stderr,"Error: buffer too small to append %u values of %u bits\n", (unsigned int)count, (unsigned int)bits);
+		return -1;
+	}
+
+	p = buf->buffer + buf->offset / 8;
+	if (buf->offset % 8 == 0 && bits % 8 == 0) {
+		n = bits_simd_pack(p, buf->length - buf->offset / 8, src, bits, count);
+		set_bytes_array(p + n * bits / 8, src + n, bits, count - n);
+		buf->offset += count * bits;
+		return 0;
+	}
+
+	mask = ((uint64_t)1 << bits) - 1;
+	avail = buf->offset % 8;
+	acc = (avail > 0) ? (*p >> (8 - avail)) : 0;
+
+	for (n = 0; n < count; n++) {
+		acc = (acc << bits) | ((uint64_t)(unsigned int)src[n] & mask);
+		avail += bits;
+		if (avail >= 32) {
+			avail -= 32;
+			p[0] = (unsigned char)(acc >> (avail + 24));
+			p[1] = (unsigned char)(acc >> (avail + 16));
+			p[2] = (unsigned char)(acc >> (avail + 8));
+			p[3] = (unsigned char)(acc >> avail);
+			p += 4;
+		}
+	}
+	while (avail >= 8) {
+		avail -= 8;
+		*p++ = (unsigned char)(acc >> avail);
+	}
+	if (avail > 0) {
+		/* keep the trailing bits of the last byte, as set_bits() does */
+		*p = (unsigned char)((acc << (8 - avail)) | (*p & (0xff >> avail)));
+	}
+	buf->offset += count * bits;
+	return 0;
+}
+
+/* Appends a bitmap to the buffer, one bit per point. This is equivalent to calling
+ * append_bits() with a width of 1 for every point, but whole bytes of 8 points
+ * are packed at once.
+ *
+ * @param[inout] buf The buffer to carry the data.
+ * @param[in] mask One byte per point, only the lowest bit is appended.
+ * @param[in] count Number of points.
+ * @retval 0 Success
+ * @retval -1 Failure
+ */
+int append_bitmap(buffer_t * buf, const unsigned char * mask, size_t count)
+{
+	const uint64_t ones = ((uint64_t)0x01010101 << 32) | 0x01010101;
+	const uint64_t gather = ((uint64_t)0x80402010 << 32) | 0x08040201;
+	unsigned char * p;
+	uint64_t x;
+	size_t n = 0;
+	size_t k;
+
+	if ((buf->offset + count + 7) / 8 > buf->length) {
+		fprintf(stderr,"Error: buffer too small to append %u bitmap points\n", (unsigned int)count);
+		return -1;
+	}
+
+	/* points up to the next byte boundary */
+	for (; n < count && buf->offset % 8 != 0; n++) {
+		append_bits(buf, mask[n] & 1, 1);
+	}
+
+	p = buf->buffer + buf->offset / 8;
+	k = n;
+	n += bits_simd_pack_bitmap(p, mask + n, count - n);
+	p += (n - k) / 8;
+
+	/* 8 points per byte: the multiplication gathers the lowest bit of every byte
+	 * of the (little endian) word into the most significant byte, first point first */
+	for (; n + 8 <= count; n += 8) {
+		x = ((uint64_t)mask[n + 0])
+			| ((uint64_t)mask[n + 1] <<  8)
+			| ((uint64_t)mask[n + 2] << 16)
+			| ((uint64_t)mask[n + 3] << 24)
+			| ((uint64_t)mask[n + 4] << 32)
+			| ((uint64_t)mask[n + 5] << 40)
+			| ((uint64_t)mask[n + 6] << 48)
+			| ((uint64_t)mask[n + 7] << 56);
+		*p++ = (unsigned char)(((x & ones) * gather) >> 56);
+	}
+	buf->offset += (unsigned int)(n - k);
+
+	for (; n < count; n++) {
+		append_bits(buf, mask[n] & 1, 1);
+	}
+	return 0;
+}
+
 int buffer_alloc(buffer_t * buf, unsigned int length)
 {
 	if (buf == NULL) return -1;
@@ -18,8 +18,13 @@ int buffer_alloc(buffer_t * buf, unsigned int length);
 void buffer_free(buffer_t * buf);
 
 int get_bits(const unsigned char * buf, int * loc, size_t off, size_t bits);
+int get_bits_array(const unsigned char * buf, size_t off, size_t bits, size_t count, int * out);
+const char * get_bits_kernel(void);
+int set_bits_kernel(const char * name);
 int set_bits(unsigned char *buf, int src, size_t off, size_t bits);
 int append_bits(buffer_t * buf, int src, size_t bits);
+int append_bits_array(buffer_t * buf, const int * src, size_t count, size_t bits);
+int append_bitmap(buffer_t * buf, const unsigned char * mask, size_t count);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,527 @@
+#include <bits.h>
+#include <bits_simd.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BITS_SIMD_X86
+#include <immintrin.h>
+#endif
+
+/* Vectorized variants of get_bits_array().
+ *
+ * All kernels work the same way: a group of values is loaded with unaligned
+ * 16 byte loads, a byte shuffle places the (big endian) bytes of every value
+ * into its own 32 or 64 bit lane in host order, a per lane shift removes the
+ * leading bits and a final shift right by (lane width - bits) removes the trailing
+ * bits. Values of up to 25 bits always fit into 4 bytes (25 + 7 bits of phase),
+ * wider values are processed within 64 bit lanes.
+ *
+ * A kernel only processes groups whose loads stay within the packed data and
+ * returns the number of values it unpacked. The remaining values are unpacked
+ * by the scalar code in get_bits_array().
+ */
+
+typedef size_t (*unpack_kernel_t)(const unsigned char *, size_t, size_t, size_t, size_t, int *);
+typedef size_t (*pack_kernel_t)(unsigned char *, size_t, const int *, size_t, size_t);
+typedef size_t (*pack_bitmap_kernel_t)(unsigned char *, const unsigned char *, size_t);
+
+typedef struct {
+	const char * name;
+	int (*supported)(void);
+	unpack_kernel_t unpack;
+	pack_kernel_t pack;
+	pack_bitmap_kernel_t pack_bitmap;
+} bits_kernel_t;
+
+/* shuffle mask and shifts for 4 values, packed into 32 bit lanes */
+typedef struct {
+	unsigned char mask[16];
+	uint32_t shift[4];
+	uint32_t mult[4];
+} lane32_t;
+
+/* shuffle mask and shifts for 2 values, packed into 64 bit lanes */
+typedef struct {
+	unsigned char mask[16];
+	uint64_t shift[2];
+} lane64_t;
+
+static void lane32_init(lane32_t * t, size_t phase, size_t bits)
+{
+	size_t k;
+	size_t i;
+	size_t r;
+
+	for (k = 0; k < 4; k++) {
+		r = phase + k * bits;
+		for (i = 0; i < 4; i++) {
+			t->mask[k * 4 + 3 - i] = (unsigned char)(r / 8 + i);
+		}
+		t->shift[k] = (uint32_t)(r % 8);
+		t->mult[k] = (uint32_t)1 << (r % 8);
+	}
+}
+
+static void lane64_init(lane64_t * t, size_t phase, size_t bits)
+{
+	size_t k;
+	size_t i;
+	size_t r;
+
+	for (k = 0; k < 2; k++) {
+		r = phase + k * bits;
+		for (i = 0; i < 8; i++) {
+			t->mask[k * 8 + 7 - i] = (unsigned char)(r / 8 + i);
+		}
+		t->shift[k] = r % 8;
+	}
+}
+
+static size_t unpack_scalar(const unsigned char * buf, size_t off, size_t bits, size_t count, size_t end, int * out)
+{
+	(void)buf;
+	(void)off;
+	(void)bits;
+	(void)count;
+	(void)end;
+	(void)out;
+	return 0;
+}
+
+static size_t pack_scalar(unsigned char * dst, size_t len, const int * src, size_t bits, size_t count)
+{
+	(void)dst;
+	(void)len;
+	(void)src;
+	(void)bits;
+	(void)count;
+	return 0;
+}
+
+static size_t pack_bitmap_scalar(unsigned char * dst, const unsigned char * mask, size_t count)
+{
+	(void)dst;
+	(void)mask;
+	(void)count;
+	return 0;
+}
+
+#if defined(BITS_SIMD_X86)
+
+static int supported_sse42(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse4.2");
+}
+
+static int supported_avx2(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+static int supported_avx512(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+}
+
+/* 4 values (up to 25 bits) or 2 values (26 to 32 bits) per 128 bit register.
+ * The phase of a group within its first byte changes from group to group,
+ * therefore the tables are prepared for all phases. */
+__attribute__((target("sse4.2")))
+static size_t unpack_sse42(const unsigned char * buf, size_t off, size_t bits, size_t count, size_t end, int * out)
+{
+	lane32_t t32[8];
+	lane64_t t64[8];
+	size_t n = 0;
+	size_t pos = off;
+	size_t p;
+	__m128i x;
+	__m128i a;
+	__m128i b;
+	__m128i cnt;
+
+	if (bits <= 25) {
+		for (p = 0; p < 8; p++) lane32_init(&t32[p], p, bits);
+		cnt = _mm_cvtsi32_si128((int)(32 - bits));
+		while (n + 4 <= count && pos / 8 + 16 <= end) {
+			p = pos % 8;
+			x = _mm_loadu_si128((const __m128i *)(buf + pos / 8));
+			x = _mm_shuffle_epi8(x, _mm_loadu_si128((const __m128i *)t32[p].mask));
+			x = _mm_mullo_epi32(x, _mm_loadu_si128((const __m128i *)t32[p].mult));
+			x = _mm_srl_epi32(x, cnt);
+			_mm_storeu_si128((__m128i *)(out + n), x);
+			n += 4;
+			pos += 4 * bits;
+		}
+	} else {
+		for (p = 0; p < 8; p++) lane64_init(&t64[p], p, bits);
+		cnt = _mm_cvtsi32_si128((int)(64 - bits));
+		while (n + 2 <= count && pos / 8 + 16 <= end) {
+			p = pos % 8;
+			x = _mm_loadu_si128((const __m128i *)(buf + pos / 8));
+			x = _mm_shuffle_epi8(x, _mm_loadu_si128((const __m128i *)t64[p].mask));
+			a = _mm_sll_epi64(x, _mm_loadl_epi64((const __m128i *)&t64[p].shift[0]));
+			b = _mm_sll_epi64(x, _mm_loadl_epi64((const __m128i *)&t64[p].shift[1]));
+			x = _mm_blend_epi16(a, b, 0xf0);
+			x = _mm_srl_epi64(x, cnt);
+			x = _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 1, 2, 0));
+			_mm_storel_epi64((__m128i *)(out + n), x);
+			n += 2;
+			pos += 2 * bits;
+		}
+	}
+	return n;
+}
+
+/* 8 values per iteration. Every 128 bit half is loaded on its own, since 8 values
+ * of up to 32 bits do not fit into one shuffle domain. 8 values always occupy
+ * whole bytes, so the phase of each half is the same for all iterations. */
+__attribute__((target("avx2")))
+static size_t unpack_avx2(const unsigned char * buf, size_t off, size_t bits, size_t count, size_t end, int * out)
+{
+	lane32_t t32[2];
+	lane64_t t64[4];
+	size_t n = 0;
+	size_t pos = off;
+	__m256i x;
+	__m256i y;
+	__m256i ma;
+	__m256i sa;
+	__m256i mb;
+	__m256i sb;
+	__m256i perm;
+	__m128i cnt;
+
+	if (bits <= 25) {
+		lane32_init(&t32[0], off % 8, bits);
+		lane32_init(&t32[1], (off + 4 * bits) % 8, bits);
+		ma = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)t32[0].mask)),
+			_mm_loadu_si128((const __m128i *)t32[1].mask), 1);
+		sa = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)t32[0].shift)),
+			_mm_loadu_si128((const __m128i *)t32[1].shift), 1);
+		cnt = _mm_cvtsi32_si128((int)(32 - bits));
+		while (n + 8 <= count && (pos + 4 * bits) / 8 + 16 <= end) {
+			x = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(buf + pos / 8))),
+				_mm_loadu_si128((const __m128i *)(buf + (pos + 4 * bits) / 8)), 1);
+			x = _mm256_shuffle_epi8(x, ma);
+			x = _mm256_sllv_epi32(x, sa);
+			x = _mm256_srl_epi32(x, cnt);
+			_mm256_storeu_si256((__m256i *)(out + n), x);
+			n += 8;
+			pos += 8 * bits;
+		}
+	} else {
+		lane64_init(&t64[0], off % 8, bits);
+		lane64_init(&t64[1], (off + 2 * bits) % 8, bits);
+		lane64_init(&t64[2], (off + 4 * bits) % 8, bits);
+		lane64_init(&t64[3], (off + 6 * bits) % 8, bits);
+		ma = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)t64[0].mask)),
+			_mm_loadu_si128((const __m128i *)t64[1].mask), 1);
+		sa = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)t64[0].shift)),
+			_mm_loadu_si128((const __m128i *)t64[1].shift), 1);
+		mb = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)t64[2].mask)),
+			_mm_loadu_si128((const __m128i *)t64[3].mask), 1);
+		sb = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)t64[2].shift)),
+			_mm_loadu_si128((const __m128i *)t64[3].shift), 1);
+		perm = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+		cnt = _mm_cvtsi32_si128((int)(64 - bits));
+		while (n + 8 <= count && (pos + 6 * bits) / 8 + 16 <= end) {
+			x = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(buf + pos / 8))),
+				_mm_loadu_si128((const __m128i *)(buf + (pos + 2 * bits) / 8)), 1);
+			y = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(buf + (pos + 4 * bits) / 8))),
+				_mm_loadu_si128((const __m128i *)(buf + (pos + 6 * bits) / 8)), 1);
+			x = _mm256_srl_epi64(_mm256_sllv_epi64(_mm256_shuffle_epi8(x, ma), sa), cnt);
+			y = _mm256_srl_epi64(_mm256_sllv_epi64(_mm256_shuffle_epi8(y, mb), sb), cnt);
+			x = _mm256_permutevar8x32_epi32(x, perm);
+			y = _mm256_permutevar8x32_epi32(y, perm);
+			x = _mm256_inserti128_si256(x, _mm256_castsi256_si128(y), 1);
+			_mm256_storeu_si256((__m256i *)(out + n), x);
+			n += 8;
+			pos += 8 * bits;
+		}
+	}
+	return n;
+}
+
+/* 16 values (up to 25 bits) or 8 values (26 to 32 bits) per iteration, four
+ * 128 bit lanes loaded individually. */
+__attribute__((target("avx512f,avx512bw")))
+static size_t unpack_avx512(const unsigned char * buf, size_t off, size_t bits, size_t count, size_t end, int * out)
+{
+	lane32_t t32[4];
+	lane64_t t64[4];
+	size_t n = 0;
+	size_t pos = off;
+	size_t j;
+	__m512i x;
+	__m512i m;
+	__m512i s;
+	__m128i cnt;
+
+	if (bits <= 25) {
+		for (j = 0; j < 4; j++) lane32_init(&t32[j], (off + 4 * j * bits) % 8, bits);
+		m = _mm512_castsi128_si512(_mm_loadu_si128((const __m128i *)t32[0].mask));
+		m = _mm512_inserti32x4(m, _mm_loadu_si128((const __m128i *)t32[1].mask), 1);
+		m = _mm512_inserti32x4(m, _mm_loadu_si128((const __m128i *)t32[2].mask), 2);
+		m = _mm512_inserti32x4(m, _mm_loadu_si128((const __m128i *)t32[3].mask), 3);
+		s = _mm512_castsi128_si512(_mm_loadu_si128((const __m128i *)t32[0].shift));
+		s = _mm512_inserti32x4(s, _mm_loadu_si128((const __m128i *)t32[1].shift), 1);
+		s = _mm512_inserti32x4(s, _mm_loadu_si128((const __m128i *)t32[2].shift), 2);
+		s = _mm512_inserti32x4(s, _mm_loadu_si128((const __m128i *)t32[3].shift), 3);
+		cnt = _mm_cvtsi32_si128((int)(32 - bits));
+		while (n + 16 <= count && (pos + 12 * bits) / 8 + 16 <= end) {
+			x = _mm512_castsi128_si512(_mm_loadu_si128((const __m128i *)(buf + pos / 8)));
+			x = _mm512_inserti32x4(x, _mm_loadu_si128((const __m128i *)(buf + (pos + 4 * bits) / 8)), 1);
+			x = _mm512_inserti32x4(x, _mm_loadu_si128((const __m128i *)(buf + (pos + 8 * bits) / 8)), 2);
+			x = _mm512_inserti32x4(x, _mm_loadu_si128((const __m128i *)(buf + (pos + 12 * bits) / 8)), 3);
+			x = _mm512_shuffle_epi8(x, m);
+			x = _mm512_sllv_epi32(x, s);
+			x = _mm512_srl_epi32(x, cnt);
+			_mm512_storeu_si512((void *)(out + n), x);
+			n += 16;
+			pos += 16 * bits;
+		}
+	} else {
+		for (j = 0; j < 4; j++) lane64_init(&t64[j], (off + 2 * j * bits) % 8, bits);
+		m = _mm512_castsi128_si512(_mm_loadu_si128((const __m128i *)t64[0].mask));
+		m = _mm512_inserti32x4(m, _mm_loadu_si128((const __m128i *)t64[1].mask), 1);
+		m = _mm512_inserti32x4(m, _mm_loadu_si128((const __m128i *)t64[2].mask), 2);
+		m = _mm512_inserti32x4(m, _mm_loadu_si128((const __m128i *)t64[3].mask), 3);
+		s = _mm512_castsi128_si512(_mm_loadu_si128((const __m128i *)t64[0].shift));
+		s = _mm512_inserti32x4(s, _mm_loadu_si128((const __m128i *)t64[1].shift), 1);
+		s = _mm512_inserti32x4(s, _mm_loadu_si128((const __m128i *)t64[2].shift), 2);
+		s = _mm512_inserti32x4(s, _mm_loadu_si128((const __m128i *)t64[3].shift), 3);
+		cnt = _mm_cvtsi32_si128((int)(64 - bits));
+		while (n + 8 <= count && (pos + 6 * bits) / 8 + 16 <= end) {
+			x = _mm512_castsi128_si512(_mm_loadu_si128((const __m128i *)(buf + pos / 8)));
+			x = _mm512_inserti32x4(x, _mm_loadu_si128((const __m128i *)(buf + (pos + 2 * bits) / 8)), 1);
+			x = _mm512_inserti32x4(x, _mm_loadu_si128((const __m128i *)(buf + (pos + 4 * bits) / 8)), 2);
+			x = _mm512_inserti32x4(x, _mm_loadu_si128((const __m128i *)(buf + (pos + 6 * bits) / 8)), 3);
+			x = _mm512_shuffle_epi8(x, m);
+			x = _mm512_sllv_epi64(x, s);
+			x = _mm512_srl_epi64(x, cnt);
+			_mm256_storeu_si256((__m256i *)(out + n), _mm512_cvtepi64_epi32(x));
+			n += 8;
+			pos += 8 * bits;
+		}
+	}
+	return n;
+}
+
+/* Packs byte aligned values of 8, 16, 24 or 32 bits, 4 values per 128 bit
+ * register. The byte shuffle moves the low bytes of every value into big endian
+ * order. The 16 byte store clears the bytes behind the 4 packed values, which
+ * are overwritten by the next group: stores are done only as long as they end
+ * within the packed values, the remaining values are left to the caller. */
+__attribute__((target("sse4.2")))
+static size_t pack_sse42(unsigned char * dst, size_t len, const int * src, size_t bits, size_t count)
+{
+	unsigned char mask[16];
+	size_t bytes = bits / 8;
+	size_t k;
+	size_t i;
+	size_t n = 0;
+	__m128i m;
+	__m128i x;
+
+	memset(mask, 0x80, sizeof(mask));
+	for (k = 0; k < 4; k++) {
+		for (i = 0; i < bytes; i++) {
+			mask[k * bytes + i] = (unsigned char)(k * 4 + bytes - 1 - i);
+		}
+	}
+	m = _mm_loadu_si128((const __m128i *)mask);
+
+	if (count * bytes < len) {
+		len = count * bytes;
+	}
+	while (n + 4 <= count && n * bytes + 16 <= len) {
+		x = _mm_loadu_si128((const __m128i *)(src + n));
+		_mm_storeu_si128((__m128i *)(dst + n * bytes), _mm_shuffle_epi8(x, m));
+		n += 4;
+	}
+	return n;
+}
+
+/* Packs 16 bitmap points per 128 bit register: the bytes are reversed within
+ * each group of 8 (the first point goes into the most significant bit), the
+ * lowest bit of every byte is moved into its sign bit and collected by movemask. */
+__attribute__((target("sse4.2")))
+static size_t pack_bitmap_sse42(unsigned char * dst, const unsigned char * mask, size_t count)
+{
+	const __m128i rev = _mm_set_epi8(8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7);
+	__m128i x;
+	size_t n;
+	int bits;
+
+	for (n = 0; n + 16 <= count; n += 16) {
+		x = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(mask + n)), rev);
+		bits = _mm_movemask_epi8(_mm_slli_epi16(x, 7));
+		*dst++ = (unsigned char)bits;
+		*dst++ = (unsigned char)(bits >> 8);
+	}
+	return n;
+}
+
+/* Same as pack_bitmap_sse42(), 32 points per 256 bit register. */
+__attribute__((target("avx2")))
+static size_t pack_bitmap_avx2(unsigned char * dst, const unsigned char * mask, size_t count)
+{
+	const __m256i rev = _mm256_set_epi8(
+		8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7,
+		8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7);
+	__m256i x;
+	size_t n;
+	unsigned int bits;
+
+	for (n = 0; n + 32 <= count; n += 32) {
+		x = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(mask + n)), rev);
+		bits = (unsigned int)_mm256_movemask_epi8(_mm256_slli_epi16(x, 7));
+		*dst++ = (unsigned char)bits;
+		*dst++ = (unsigned char)(bits >> 8);
+		*dst++ = (unsigned char)(bits >> 16);
+		*dst++ = (unsigned char)(bits >> 24);
+	}
+	return n;
+}
+
+#endif
+
+static int supported_always(void)
+{
+	return 1;
+}
+
+/* available kernels, best first */
+static const bits_kernel_t kernels[] = {
+#if defined(BITS_SIMD_X86)
+	{ "avx512", supported_avx512, unpack_avx512, pack_sse42,  pack_bitmap_avx2   },
+	{ "avx2",   supported_avx2,   unpack_avx2,   pack_sse42,  pack_bitmap_avx2   },
+	{ "sse4.2", supported_sse42,  unpack_sse42,  pack_sse42,  pack_bitmap_sse42  },
+#endif
+	{ "scalar", supported_always, unpack_scalar, pack_scalar, pack_bitmap_scalar }
+};
+
+#define NUM_KERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+static const bits_kernel_t * active = NULL;
+static pthread_once_t active_once = PTHREAD_ONCE_INIT;
+
+static const bits_kernel_t * find_kernel(const char * name)
+{
+	size_t i;
+
+	for (i = 0; i < NUM_KERNELS; i++) {
+		if (strcmp(kernels[i].name, name) == 0) {
+			return kernels[i].supported() ? &kernels[i] : NULL;
+		}
+	}
+	return NULL;
+}
+
+/* Selects the kernel to use: the one named by the environment variable
+ * GRIB_BITS_KERNEL if it is supported, otherwise the best one the CPU supports. */
+static const bits_kernel_t * select_kernel(void)
+{
+	const char * name = getenv("GRIB_BITS_KERNEL");
+	const bits_kernel_t * k;
+	size_t i;
+
+	if (name != NULL && name[0] != '\0') {
+		k = find_kernel(name);
+		if (k != NULL) return k;
+		fprintf(stderr, "Warning: bit unpacking kernel '%s' not available\n", name);
+	}
+	for (i = 0; i < NUM_KERNELS; i++) {
+		if (kernels[i].supported()) return &kernels[i];
+	}
+	return &kernels[NUM_KERNELS - 1];
+}
+
+/* Selects the kernel on first use, see pthread_once(). */
+static void select_active(void)
+{
+	active = select_kernel();
+}
+
+/* Unpacks as many values as possible with the active kernel.
+ *
+ * @param[in] buf GRIB buffer as a stream of bytes.
+ * @param[in] off The offset in BITS from the beginning of the buffer to the first value.
+ * @param[in] bits Width of each value in BITS, 1 to 32.
+ * @param[in] count Number of values to unpack.
+ * @param[in] end Size of the buffer in bytes, the kernel does not read beyond it.
+ * @param[out] out Array to hold the unpacked values.
+ * @return Number of values unpacked, the remaining values are up to the caller.
+ */
+size_t bits_simd_unpack(const unsigned char * buf, size_t off, size_t bits, size_t count, size_t end, int * out)
+{
+	pthread_once(&active_once, select_active);
+	if (bits == 0 || bits > 32) return 0;
+	return active->unpack(buf, off, bits, count, end, out);
+}
+
+/* Packs as many byte aligned values as possible with the active kernel.
+ *
+ * @param[out] dst Destination of the first value, must be byte aligned.
+ * @param[in] len Number of bytes available at 'dst', the kernel does not write beyond.
+ * @param[in] src Values to pack, the upper bits beyond 'bits' are ignored.
+ * @param[in] bits Width of each value in BITS, 8, 16, 24 or 32.
+ * @param[in] count Number of values to pack.
+ * @return Number of values packed, the remaining values are up to the caller.
+ */
+size_t bits_simd_pack(unsigned char * dst, size_t len, const int * src, size_t bits, size_t count)
+{
+	pthread_once(&active_once, select_active);
+	if (bits == 0 || bits > 32 || bits % 8 != 0) return 0;
+	return active->pack(dst, len, src, bits, count);
+}
+
+/* Packs as many bitmap points as possible with the active kernel, one bit per
+ * point and the first point in the most significant bit.
+ *
+ * @param[out] dst Destination of the first point, must be byte aligned.
+ * @param[in] mask One byte per point, only the lowest bit is packed.
+ * @param[in] count Number of points.
+ * @return Number of points packed, always a multiple of 8.
+ */
+size_t bits_simd_pack_bitmap(unsigned char * dst, const unsigned char * mask, size_t count)
+{
+	pthread_once(&active_once, select_active);
+	return active->pack_bitmap(dst, mask, count);
+}
+
+/* Returns the name of the kernel used by get_bits_array() and append_bits_array(). */
+const char * get_bits_kernel(void)
+{
+	pthread_once(&active_once, select_active);
+	return active->name;
+}
+
+/* Selects the kernel used by get_bits_array() and append_bits_array(), not
+ * while other threads unpack or pack.
+ *
+ * @param[in] name Name of the kernel ("scalar", "sse4.2", "avx2", "avx512"),
+ *     NULL selects the best kernel supported by the CPU.
+ * @retval 0 Success
+ * @retval -1 The kernel is unknown or not supported by the CPU
+ */
+int set_bits_kernel(const char * name)
+{
+	const bits_kernel_t * k;
+
+	pthread_once(&active_once, select_active);
+	if (name == NULL) {
+		active = select_kernel();
+		return 0;
+	}
+	k = find_kernel(name);
+	if (k == NULL) return -1;
+	active = k;
+	return 0;
+}
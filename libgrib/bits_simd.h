@@ -0,0 +1,21 @@
+#ifndef __BITS_SIMD__H__
+#define __BITS_SIMD__H__
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Minimum number of values for which the vectorized kernels are used. */
+#define BITS_SIMD_MIN_COUNT 64
+
+size_t bits_simd_unpack(const unsigned char * buf, size_t off, size_t bits, size_t count, size_t end, int * out);
+size_t bits_simd_pack(unsigned char * dst, size_t len, const int * src, size_t bits, size_t count);
+size_t bits_simd_pack_bitmap(unsigned char * dst, const unsigned char * mask, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,165 @@
+#include <bits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Compares every bit unpacking kernel against get_bits() and the bulk packing
+ * functions against append_bits() for all widths allowed by simple packing, all
+ * bit phases and various run lengths. */
+
+static const char * KERNELS[] = { "scalar", "sse4.2", "avx2", "avx512" };
+
+#define NUM_KERNELS (sizeof(KERNELS) / sizeof(KERNELS[0]))
+#define MAX_COUNT 1000
+#define BUF_SIZE (MAX_COUNT * 4 + 16)
+#define PACK_SLACK 32 /* bytes behind the packed values, must remain untouched */
+
+static int check(const unsigned char * data, size_t off, size_t bits, size_t count, int * out)
+{
+	unsigned char * buf;
+	size_t len = (off + bits * count + 7) / 8;
+	size_t n;
+	int ref;
+	int errors = 0;
+
+	/* exact size, to catch reads past the packed data with memory checkers */
+	buf = (unsigned char *)malloc(len + 1);
+	memcpy(buf, data, len);
+	memset(out, 0xa5, count * sizeof(int));
+	if (get_bits_array(buf, off, bits, count, out) != 0) {
+		free(buf);
+		return 1;
+	}
+	for (n = 0; n < count; n++) {
+		ref = 0;
+		get_bits(buf, &ref, off + n * bits, bits);
+		if (ref != out[n]) {
+			if (errors == 0) {
+				printf("  mismatch: bits=%u off=%u count=%u index=%u: %08x != %08x\n",
+					(unsigned int)bits, (unsigned int)off, (unsigned int)count, (unsigned int)n, ref, out[n]);
+			}
+			errors++;
+		}
+	}
+	free(buf);
+	return errors;
+}
+
+static int check_pack(const unsigned char * data, size_t off, size_t bits, size_t count)
+{
+	buffer_t ref = { NULL, 0, 0 };
+	buffer_t buf = { NULL, 0, 0 };
+	const int * src = (const int *)data;
+	unsigned int used = (unsigned int)((off + bits * count + 7) / 8);
+	unsigned int len = used + PACK_SLACK;
+	size_t n;
+	int errors;
+
+	buffer_alloc(&ref, len);
+	buffer_alloc(&buf, len);
+	memcpy(ref.buffer, data + 1, used);
+	memset(ref.buffer + used, 0xa5, PACK_SLACK);
+	memcpy(buf.buffer, ref.buffer, len);
+	ref.offset = buf.offset = (unsigned int)off;
+
+	for (n = 0; n < count; n++) {
+		append_bits(&ref, src[n], bits);
+	}
+	if (append_bits_array(&buf, src, count, bits) != 0) {
+		errors = 1;
+	} else {
+		errors = (ref.offset != buf.offset) || memcmp(ref.buffer, buf.buffer, len);
+	}
+	if (errors) {
+		printf("  pack mismatch: bits=%u off=%u count=%u\n", (unsigned int)bits, (unsigned int)off, (unsigned int)count);
+	}
+	buffer_free(&ref);
+	buffer_free(&buf);
+	return errors;
+}
+
+static int check_bitmap(const unsigned char * data, size_t off, size_t count)
+{
+	buffer_t ref = { NULL, 0, 0 };
+	buffer_t buf = { NULL, 0, 0 };
+	unsigned char mask[MAX_COUNT];
+	unsigned int len = (unsigned int)((off + count + 7) / 8 + 1);
+	size_t n;
+	int errors;
+
+	for (n = 0; n < count; n++) {
+		mask[n] = data[n] & 1;
+	}
+	buffer_alloc(&ref, len);
+	buffer_alloc(&buf, len);
+	memcpy(ref.buffer, data, len);
+	memcpy(buf.buffer, data, len);
+	ref.offset = buf.offset = (unsigned int)off;
+
+	for (n = 0; n < count; n++) {
+		append_bits(&ref, mask[n], 1);
+	}
+	if (append_bitmap(&buf, mask, count) != 0) {
+		errors = 1;
+	} else {
+		errors = (ref.offset != buf.offset) || memcmp(ref.buffer, buf.buffer, len);
+	}
+	if (errors) {
+		printf("  bitmap mismatch: off=%u count=%u\n", (unsigned int)off, (unsigned int)count);
+	}
+	buffer_free(&ref);
+	buffer_free(&buf);
+	return errors;
+}
+
+int main(int argc, char ** argv)
+{
+	unsigned char data[BUF_SIZE];
+	int out[MAX_COUNT];
+	size_t i;
+	size_t bits;
+	size_t off;
+	size_t count;
+	int errors;
+	int total = 0;
+
+	(void)argc;
+	(void)argv;
+
+	srand(1);
+	for (i = 0; i < BUF_SIZE; i++) {
+		data[i] = (unsigned char)rand();
+	}
+
+	for (i = 0; i < NUM_KERNELS; i++) {
+		if (set_bits_kernel(KERNELS[i]) != 0) {
+			printf("%-8s: not supported\n", KERNELS[i]);
+			continue;
+		}
+		errors = 0;
+		for (bits = 1; bits <= 32; bits++) {
+			for (off = 0; off < 16; off++) {
+				for (count = 1; count <= MAX_COUNT; count += (count < 80) ? 1 : 61) {
+					errors += check(data, off, bits, count, out);
+				}
+			}
+		}
+		for (bits = 1; bits <= 32; bits++) {
+			for (off = 0; off < 16; off++) {
+				for (count = 1; count <= MAX_COUNT; count += (count < 80) ? 1 : 61) {
+					errors += check_pack(data, off, bits, count);
+				}
+			}
+		}
+		for (off = 0; off < 16; off++) {
+			for (count = 1; count <= MAX_COUNT; count += (count < 80) ? 1 : 61) {
+				errors += check_bitmap(data, off, count);
+			}
+		}
+		printf("%-8s: %s\n", KERNELS[i], errors ? "FAILED" : "ok");
+		total += errors;
+	}
+	set_bits_kernel(NULL);
+
+	return total ? -1 : 0;
+}
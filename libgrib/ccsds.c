@@ -0,0 +1,230 @@
+#include <ccsds.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_AEC
+#include <libaec.h>
+#endif
+
+/* CCSDS adaptive entropy coding of packed values, template 5.42.
+ *
+ * The packed values are compressed by libaec. They are decoded right into
+ * the memory of the gridpoints: the samples (1, 2 or 4 bytes each) are
+ * written to the end of the output buffer, then scaled from the front to the
+ * end. A sample is always read before the gridpoint overlapping it is
+ * written, no memory is needed besides the gridpoints.
+ *
+ * The file does not depend on the rest of the library, it is shared with
+ * libgrib2.
+ *
+ * CCSDS support is compiled in by defining HAVE_AEC.
+ */
+
+#if !defined(GRIB_MISSING_VALUE)
+#define GRIB_MISSING_VALUE (1.e30)
+#endif
+
+#ifdef HAVE_AEC
+
+/* Returns the number of bytes of a sample of libaec. */
+static size_t ccsds_sample_size(size_t bits) /* {{{ */
+{
+	size_t size = (bits + 7) / 8;
+	return (size == 3) ? 4 : size;
+} /* }}} */
+
+/* Returns the flags of libaec for samples in the byte order of the host,
+ * the options of the message describe the compressed stream only. */
+static unsigned int ccsds_flags(int flags) /* {{{ */
+{
+	const unsigned int one = 1;
+	unsigned int f = (unsigned int)flags & ~(unsigned int)(AEC_DATA_3BYTE | AEC_DATA_MSB);
+
+	if (*(const unsigned char *)&one == 0) {
+		f |= AEC_DATA_MSB;
+	}
+	return f;
+} /* }}} */
+
+/* Scales samples to gridpoints, the samples may overlap the end of the gridpoints. */
+static void ccsds_scale(const unsigned char * s, size_t size, double ref, double scale, const unsigned char * bitmap, size_t num_points, double * out) /* {{{ */
+{
+	unsigned short u16;
+	unsigned int u32;
+	size_t n;
+
+	for (n = 0; n < num_points; n++) {
+		if (bitmap != NULL && bitmap[n] == 0) {
+			out[n] = GRIB_MISSING_VALUE;
+			continue;
+		}
+		switch (size) {
+			case 1:
+				out[n] = ref + s[0] * scale;
+				break;
+			case 2:
+				memcpy(&u16, s, 2);
+				out[n] = ref + u16 * scale;
+				break;
+			default:
+				memcpy(&u32, s, 4);
+				out[n] = ref + u32 * scale;
+				break;
+		}
+		s += size;
+	}
+} /* }}} */
+
+#endif
+
+/* Decodes CCSDS compressed gridpoints and writes the scaled values directly
+ * onto the grid.
+ *
+ * @param[in] buf The compressed values.
+ * @param[in] len Length of the compressed values in bytes.
+ * @param[in] bits Number of bits of the packed values, 0 for a constant field.
+ * @param[in] flags CCSDS compression options mask.
+ * @param[in] block_size Block size in samples.
+ * @param[in] rsi Reference sample interval.
+ * @param[in] ref Reference value, already scaled by 10^-D.
+ * @param[in] scale Combined scale factor 2^E * 10^-D.
+ * @param[in] bitmap One byte per point, 1 if the point is present. NULL if all
+ *     points are present.
+ * @param[in] num_points Number of gridpoints.
+ * @param[out] out The gridpoints, must hold 'num_points' values.
+ * @retval 0 Success
+ * @retval -1 Failure
+ */
+int unpack_ccsds(const unsigned char * buf, size_t len, size_t bits, int flags, int block_size, int rsi, double ref, double scale, const unsigned char * bitmap, size_t num_points, double * out)
+{
+	size_t num_packed = num_points;
+	size_t n;
+#ifdef HAVE_AEC
+	struct aec_stream strm;
+	size_t size;
+	int rc;
+#endif
+
+	if (bitmap != NULL) {
+		for (num_packed = 0, n = 0; n < num_points; n++) {
+			if (bitmap[n] == 1) num_packed++;
+		}
+	}
+
+	if (bits > 0 && num_packed > 0) {
+#ifdef HAVE_AEC
+		if (bits > 32) {
+			fprintf(stderr, "Error: CCSDS values of %u bits are not supported\n", (unsigned int)bits);
+			return -1;
+		}
+		size = ccsds_sample_size(bits);
+		strm.next_in = buf;
+		strm.avail_in = len;
+		strm.next_out = (unsigned char *)out + num_points * sizeof(double) - num_packed * size;
+		strm.avail_out = num_packed * size;
+		strm.bits_per_sample = (unsigned int)bits;
+		strm.block_size = (unsigned int)block_size;
+		strm.rsi = (unsigned int)rsi;
+		strm.flags = ccsds_flags(flags);
+		rc = aec_buffer_decode(&strm);
+		if (rc != AEC_OK || strm.total_out != num_packed * size) {
+			fprintf(stderr, "Error: cannot decode CCSDS data (%d)\n", rc);
+			return -1;
+		}
+		ccsds_scale((unsigned char *)out + num_points * sizeof(double) - num_packed * size, size, ref, scale,
+			bitmap, num_points, out);
+		return 0;
+#else
+		fprintf(stderr, "Error: CCSDS support not available\n");
+		(void)buf;
+		(void)len;
+		(void)flags;
+		(void)block_size;
+		(void)rsi;
+		(void)scale;
+		return -1;
+#endif
+	}
+
+	for (n = 0; n < num_points; n++) {
+		out[n] = (bitmap == NULL || bitmap[n] == 1) ? ref : GRIB_MISSING_VALUE;
+	}
+	return 0;
+}
+
+/* Compresses packed values by CCSDS adaptive entropy coding.
+ *
+ * @param[in] vals The packed values.
+ * @param[in] num Number of values.
+ * @param[in] bits Number of bits of the packed values, 1 to 32.
+ * @param[in] flags CCSDS compression options mask.
+ * @param[in] block_size Block size in samples.
+ * @param[in] rsi Reference sample interval.
+ * @param[out] out The compressed values.
+ * @param[inout] len Size of the output in bytes, on return the length of the
+ *     compressed values.
+ * @retval 0 Success
+ * @retval -1 Failure, e.g. output too small
+ */
+int pack_ccsds(const unsigned int * vals, size_t num, size_t bits, int flags, int block_size, int rsi, unsigned char * out, size_t * len)
+{
+#ifdef HAVE_AEC
+	struct aec_stream strm;
+	unsigned char * samples;
+	unsigned short u16;
+	size_t size;
+	size_t n;
+	int rc;
+
+	if (bits == 0 || bits > 32) {
+		fprintf(stderr, "Error: CCSDS values of %u bits are not supported\n", (unsigned int)bits);
+		return -1;
+	}
+	size = ccsds_sample_size(bits);
+	if (size == sizeof(unsigned int)) {
+		samples = (unsigned char *)vals;
+	} else {
+		samples = (unsigned char *)malloc(num * size);
+		if (samples == NULL) {
+			return -1;
+		}
+		for (n = 0; n < num; n++) {
+			if (size == 1) {
+				samples[n] = (unsigned char)vals[n];
+			} else {
+				u16 = (unsigned short)vals[n];
+				memcpy(samples + n * 2, &u16, 2);
+			}
+		}
+	}
+
+	strm.next_in = samples;
+	strm.avail_in = num * size;
+	strm.next_out = out;
+	strm.avail_out = *len;
+	strm.bits_per_sample = (unsigned int)bits;
+	strm.block_size = (unsigned int)block_size;
+	strm.rsi = (unsigned int)rsi;
+	strm.flags = ccsds_flags(flags);
+	rc = aec_buffer_encode(&strm);
+	if (samples != (unsigned char *)vals) {
+		free(samples);
+	}
+	if (rc != AEC_OK) {
+		fprintf(stderr, "Error: cannot encode CCSDS data (%d)\n", rc);
+		return -1;
+	}
+	*len = strm.total_out;
+	return 0;
+#else
+	(void)vals;
+	(void)num;
+	(void)bits;
+	(void)flags;
+	(void)block_size;
+	(void)rsi;
+	(void)out;
+	(void)len;
+	fprintf(stderr, "Error: CCSDS support not available\n");
+	return -1;
+#endif
+}
@@ -0,0 +1,17 @@
+#ifndef __CCSDS__H__
+#define __CCSDS__H__
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int unpack_ccsds(const unsigned char * buf, size_t len, size_t bits, int flags, int block_size, int rsi, double ref, double scale, const unsigned char * bitmap, size_t num_points, double * out);
+int pack_ccsds(const unsigned int * vals, size_t num, size_t bits, int flags, int block_size, int rsi, unsigned char * out, size_t * len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
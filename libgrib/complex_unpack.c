@@ -0,0 +1,494 @@
+#include <complex_unpack.h>
+#include <bits.h>
+#include <scale.h>
+#include <spatial_diff.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Decoding of complex packed gridpoints, templates 5.2 and 5.3.
+ *
+ * The packed values are split into groups, each group has its own reference,
+ * width in bits and length. The group references, widths and lengths are
+ * stored as three arrays, each starting at a byte boundary, followed by the
+ * packed values of all groups. Every array and every group is unpacked by
+ * the bulk bit reader. Template 5.3 additionally stores the values as first
+ * or second order spatial differences, the extra descriptors needed to undo
+ * the differencing precede the group references.
+ *
+ * Missing values are coded within the groups as the largest (primary) and
+ * the second largest (secondary) value of the width of the group. Groups of
+ * width 0 are missing as a whole if their reference is coded that way. Missing
+ * values are not part of the spatial differencing.
+ *
+ * The position of a group within the data section is only known after
+ * reading all group widths and lengths in front of it, its original values
+ * only after undoing the differencing of all groups in front of it. A group
+ * index records both for every group, an area of the field is then unpacked
+ * from the groups of the area only, see unpack_complex_range().
+ */
+
+/* Reads an extra descriptor of the spatial differencing, sign and magnitude. */
+static int complex_descriptor(const unsigned char * buf, size_t off, int octets) /* {{{ */
+{
+	int sign;
+	int value;
+
+	get_bits(buf, &sign, off, 1);
+	get_bits(buf, &value, off + 1, octets * 8 - 1);
+	return (sign == 1) ? -value : value;
+} /* }}} */
+
+/* Returns the largest value of the given number of bits, the code of the
+ * primary missing value. */
+static unsigned long complex_missing_code(size_t bits) /* {{{ */
+{
+	return (bits >= 32) ? 0xfffffffful : (1ul << bits) - 1;
+} /* }}} */
+
+/* Returns true if a packed value of a group, the group reference not yet
+ * added, is coded as missing. */
+static int complex_is_missing(const GRIBMetadata * md, const GRIB2Group * group, int val) /* {{{ */
+{
+	unsigned long code;
+	unsigned long v;
+
+	if (md->complex_pack.miss_mgmt == 0) {
+		return 0;
+	}
+	if (group->width == 0) {
+		code = complex_missing_code((size_t)md->pack_width);
+		v = group->ref;
+	} else {
+		code = complex_missing_code(group->width);
+		v = (unsigned long)(unsigned int)val;
+	}
+	return v == code || (md->complex_pack.miss_mgmt == 2 && v == code - 1);
+} /* }}} */
+
+/* Allocates a group index for the groups of a field. */
+static GRIB2GroupIndex * complex_index_alloc(const GRIBMetadata * md) /* {{{ */
+{
+	GRIB2GroupIndex * index;
+	size_t ng = (size_t)md->complex_pack.num_groups;
+
+	index = (GRIB2GroupIndex *)malloc(sizeof(GRIB2GroupIndex) + ng * sizeof(GRIB2Group));
+	if (index == NULL) {
+		fprintf(stderr,"Error: cannot allocate memory for %u groups\n", (unsigned int)ng);
+		return NULL;
+	}
+	memset(index, 0, sizeof(GRIB2GroupIndex) + ng * sizeof(GRIB2Group));
+	index->num_groups = (uint32_t)ng;
+	return index;
+} /* }}} */
+
+/* Reads an array of group descriptors starting at a byte boundary, the
+ * offset is advanced to the byte boundary behind the array. */
+static int complex_read_array(const unsigned char * buf, size_t len, size_t * off, size_t bits, size_t ng, int * out) /* {{{ */
+{
+	size_t end = (*off + ng * bits + 7) / 8 * 8;
+
+	if (end > len * 8) {
+		fprintf(stderr,"Error: data section too short for %u groups\n", (unsigned int)ng);
+		return -1;
+	}
+	if (get_bits_array(buf, *off, bits, ng, out) != 0) {
+		return -1;
+	}
+	*off = end;
+	return 0;
+} /* }}} */
+
+/* Reads the extra descriptors of the spatial differencing, the group
+ * references, widths and lengths and determines the position of every
+ * group. The seeds of the groups are not set. */
+static int complex_read_groups(const unsigned char * buf, size_t len, const GRIBMetadata * md, GRIB2GroupIndex * index) /* {{{ */
+{
+	GRIB2Group * groups = (GRIB2Group *)grib2_group_index_groups(index);
+	const size_t ng = index->num_groups;
+	const int octets = md->complex_pack.num_octets;
+	int * gref;
+	int * gwidth;
+	int * glen;
+	size_t off = 40; /* first bit after the header of the data section */
+	size_t total;
+	size_t g;
+
+	/* extra descriptors of the spatial differencing */
+	if (md->complex_pack.order > 0) {
+		if (octets < 1 || octets > 4 || off + (md->complex_pack.order + 1) * octets * 8 > len * 8) {
+			fprintf(stderr,"Error: %d octets of spatial differencing descriptors\n", octets);
+			return -1;
+		}
+		index->ival1 = complex_descriptor(buf, off, octets);
+		off += octets * 8;
+		if (md->complex_pack.order == 2) {
+			index->ival2 = complex_descriptor(buf, off, octets);
+			off += octets * 8;
+		}
+		index->minsd = complex_descriptor(buf, off, octets);
+		off += octets * 8;
+	}
+
+	gref = (int *)malloc(ng * 3 * sizeof(int));
+	if (gref == NULL) {
+		return -1;
+	}
+	gwidth = gref + ng;
+	glen = gwidth + ng;
+
+	/* group references, widths and lengths, each array starts at a byte boundary */
+	if (complex_read_array(buf, len, &off, md->pack_width, ng, gref) != 0
+		|| complex_read_array(buf, len, &off, md->complex_pack.width_bits, ng, gwidth) != 0
+		|| complex_read_array(buf, len, &off, md->complex_pack.length_bits, ng, glen) != 0) {
+		free(gref);
+		return -1;
+	}
+
+	/* the values of all groups, one after the other without alignment */
+	total = 0;
+	for (g = 0; g < ng; g++) {
+		gwidth[g] += md->complex_pack.ref_width;
+		glen[g] = (g + 1 < ng) ? md->complex_pack.ref_length + glen[g] * md->complex_pack.length_incr : md->complex_pack.last_length;
+		if (gwidth[g] < 0 || gwidth[g] > 32 || glen[g] < 0) {
+			fprintf(stderr,"Error: group %u of width %d and length %d\n", (unsigned int)g, gwidth[g], glen[g]);
+			free(gref);
+			return -1;
+		}
+		groups[g].offset = off;
+		groups[g].first = (uint32_t)total;
+		groups[g].length = (uint32_t)glen[g];
+		groups[g].ref = (uint32_t)gref[g];
+		groups[g].width = (uint8_t)gwidth[g];
+		total += (size_t)glen[g];
+		off += (size_t)glen[g] * gwidth[g];
+	}
+	free(gref);
+	if (total != (size_t)md->num_packed || off > len * 8) {
+		fprintf(stderr,"Error: groups of %u values do not match %d packed values\n", (unsigned int)total, md->num_packed);
+		return -1;
+	}
+	return 0;
+} /* }}} */
+
+/* Unpacks the values of a group and adds the group reference. Missing values
+ * are flagged, the number of missing values is returned, -1 in case of an
+ * error. */
+static int complex_group_values(const unsigned char * buf, const GRIBMetadata * md, const GRIB2Group * group, int * vals, unsigned char * miss) /* {{{ */
+{
+	int num_missing = 0;
+	size_t k;
+
+	if (group->width == 0) {
+		for (k = 0; k < group->length; k++) {
+			vals[k] = (int)group->ref;
+		}
+		if (complex_is_missing(md, group, 0)) {
+			memset(miss, 1, group->length);
+			return (int)group->length;
+		}
+		memset(miss, 0, group->length);
+		return 0;
+	}
+
+	if (get_bits_array(buf, (size_t)group->offset, group->width, group->length, vals) != 0) {
+		return -1;
+	}
+	for (k = 0; k < group->length; k++) {
+		miss[k] = (unsigned char)complex_is_missing(md, group, vals[k]);
+		num_missing += miss[k];
+		vals[k] += (int)group->ref;
+	}
+	return num_missing;
+} /* }}} */
+
+/* Unpacks all groups into the original values and returns the number of
+ * values which are missing, -1 in case of an error. Only the values which
+ * are not missing are kept, in order, the missing values are flagged. */
+static int complex_values(const unsigned char * buf, size_t len, const GRIBMetadata * md, GRIB2GroupIndex * index, int * vals, unsigned char * miss) /* {{{ */
+{
+	const GRIB2Group * groups = grib2_group_index_groups(index);
+	const size_t num = (size_t)md->num_packed;
+	int num_missing = 0;
+	int rc;
+	size_t g;
+	size_t k;
+	size_t n;
+
+	if (complex_read_groups(buf, len, md, index) != 0) {
+		return -1;
+	}
+	for (g = 0; g < index->num_groups; g++) {
+		rc = complex_group_values(buf, md, &groups[g], vals + groups[g].first, miss + groups[g].first);
+		if (rc < 0) {
+			return -1;
+		}
+		num_missing += rc;
+	}
+
+	/* only values which are not missing are kept and differenced */
+	if (num_missing > 0) {
+		for (k = 0, n = 0; n < num; n++) {
+			if (!miss[n]) {
+				vals[k++] = vals[n];
+			}
+		}
+	}
+	if (md->complex_pack.order > 0) {
+		spatial_diff_undo(vals, num - num_missing, md->complex_pack.order, index->ival1, index->ival2, index->minsd);
+	}
+	return num_missing;
+} /* }}} */
+
+/* Decodes complex packed gridpoints, with or without spatial differencing,
+ * and writes the scaled values onto the grid. Points not present in the bitmap
+ * and missing values are set to GRIB_MISSING_VALUE.
+ *
+ * @param[in] buf The data section.
+ * @param[in] len Length of the data section in bytes.
+ * @param[in] md Metadata of the grid, data representation template 5.2 or 5.3.
+ * @param[in] scale Combined scale factor 2^E * 10^-D.
+ * @param[in] num_points Number of gridpoints.
+ * @param[out] out The gridpoints, must hold 'num_points' values.
+ * @retval 0 Success
+ * @retval -1 Failure
+ */
+int unpack_complex(const unsigned char * buf, size_t len, const GRIBMetadata * md, double scale, size_t num_points, double * out)
+{
+	const size_t num = (size_t)md->num_packed;
+	GRIB2GroupIndex * index;
+	int * vals;
+	unsigned char * miss;
+	unsigned char * map = NULL;
+	int num_missing;
+	size_t k;
+	size_t n;
+
+	/* constant field */
+	if (md->pack_width == 0 || md->complex_pack.num_groups == 0 || num == 0) {
+		for (n = 0; n < num_points; n++) {
+			out[n] = (md->bitmap == NULL || md->bitmap[n] == 1) ? md->R : GRIB_MISSING_VALUE;
+		}
+		return 0;
+	}
+
+	if (md->bitmap == NULL && num < num_points) {
+		fprintf(stderr,"Error: %u packed values for %u gridpoints\n", (unsigned int)num, (unsigned int)num_points);
+		return -1;
+	}
+	index = complex_index_alloc(md);
+	if (index == NULL) {
+		return -1;
+	}
+	vals = (int *)malloc(num * (sizeof(int) + 1));
+	if (vals == NULL) {
+		free(index);
+		return -1;
+	}
+	miss = (unsigned char *)(vals + num);
+
+	num_missing = complex_values(buf, len, md, index, vals, miss);
+	free(index);
+	if (num_missing < 0) {
+		free(vals);
+		return -1;
+	}
+
+	if (num_missing == 0) {
+		scale_values(vals, md->R, scale, md->bitmap, num_points, out);
+	} else {
+		/* bitmap and missing values combined */
+		map = (unsigned char *)malloc(num_points);
+		if (map == NULL) {
+			free(vals);
+			return -1;
+		}
+		for (k = 0, n = 0; n < num_points; n++) {
+			if (md->bitmap == NULL || md->bitmap[n] == 1) {
+				map[n] = (k < num && !miss[k]);
+				k++;
+			} else {
+				map[n] = 0;
+			}
+		}
+		scale_values(vals, md->R, scale, map, num_points, out);
+		free(map);
+	}
+
+	free(vals);
+	return 0;
+}
+
+/* Builds the group index of complex packed gridpoints. All groups are
+ * unpacked once, the index records the position of every group and the
+ * seeds needed to undo the spatial differencing from the group on.
+ *
+ * @param[in] buf The data section.
+ * @param[in] len Length of the data section in bytes.
+ * @param[in] md Metadata of the grid, data representation template 5.2 or 5.3.
+ * @return The index, to be released by free(). NULL in case of an error.
+ */
+GRIB2GroupIndex * complex_index_build(const unsigned char * buf, size_t len, const GRIBMetadata * md)
+{
+	const size_t num = (size_t)md->num_packed;
+	GRIB2GroupIndex * index;
+	GRIB2Group * groups;
+	int * vals;
+	unsigned char * miss;
+	uint32_t count = 0;
+	size_t g;
+	size_t k;
+
+	if (md->pack_width == 0 || md->complex_pack.num_groups == 0 || num == 0) {
+		fprintf(stderr,"Error: constant field, there are no groups\n");
+		return NULL;
+	}
+	index = complex_index_alloc(md);
+	if (index == NULL) {
+		return NULL;
+	}
+	vals = (int *)malloc(num * (sizeof(int) + 1));
+	if (vals == NULL) {
+		free(index);
+		return NULL;
+	}
+	miss = (unsigned char *)(vals + num);
+
+	if (complex_values(buf, len, md, index, vals, miss) < 0) {
+		free(vals);
+		free(index);
+		return NULL;
+	}
+
+	/* the original values in front of every group, missing values excluded */
+	groups = (GRIB2Group *)grib2_group_index_groups(index);
+	for (g = 0; g < index->num_groups; g++) {
+		groups[g].count = count;
+		groups[g].seed1 = (count >= 1) ? (uint32_t)vals[count - 1] : 0;
+		groups[g].seed2 = (count >= 2) ? (uint32_t)vals[count - 2] : 0;
+		for (k = groups[g].first; k < groups[g].first + groups[g].length; k++) {
+			count += !miss[k];
+		}
+	}
+
+	free(vals);
+	return index;
+}
+
+/* Decodes a range of complex packed values through the group index, only
+ * the groups containing the range are read. Like unpack_scaled(), the values
+ * are scattered according to the bitmap, points not present in the bitmap and
+ * missing values are set to GRIB_MISSING_VALUE.
+ *
+ * @param[in] buf The data section.
+ * @param[in] md Metadata of the grid, data representation template 5.2 or 5.3.
+ * @param[in] index The group index, see complex_index_build().
+ * @param[in] scale Combined scale factor 2^E * 10^-D.
+ * @param[in] first Number of the first packed value.
+ * @param[in] bitmap One byte per point, 1 if the point is present. NULL if all
+ *     points are present.
+ * @param[in] num_points Number of gridpoints.
+ * @param[out] out The gridpoints, must hold 'num_points' values.
+ * @retval 0 Success
+ * @retval -1 Failure
+ */
+int unpack_complex_range(const unsigned char * buf, const GRIBMetadata * md, const GRIB2GroupIndex * index, double scale, size_t first, const unsigned char * bitmap, size_t num_points, double * out)
+{
+	const GRIB2Group * groups = grib2_group_index_groups(index);
+	const int order = md->complex_pack.order;
+	int * vals = NULL;
+	unsigned char * miss = NULL;
+	size_t cap = 0;
+	size_t count;
+	size_t last;
+	size_t lo;
+	size_t hi;
+	size_t g;
+	size_t k;
+	size_t p;
+	unsigned int prev1;
+	unsigned int prev2;
+	unsigned int x;
+	uint32_t c;
+
+	/* number of packed values of the range */
+	if (bitmap == NULL) {
+		count = num_points;
+	} else {
+		for (count = 0, p = 0; p < num_points; p++) {
+			count += (bitmap[p] == 1);
+		}
+	}
+	last = first + count;
+	if (last > (size_t)md->num_packed || index->num_groups != (uint32_t)md->complex_pack.num_groups) {
+		fprintf(stderr,"Error: range of packed values not within the group index\n");
+		return -1;
+	}
+	if (md->pack_width == 0 || index->num_groups == 0) {
+		for (p = 0; p < num_points; p++) {
+			out[p] = (bitmap == NULL || bitmap[p] == 1) ? md->R : GRIB_MISSING_VALUE;
+		}
+		return 0;
+	}
+
+	/* the group containing the first value */
+	lo = 0;
+	hi = index->num_groups;
+	while (hi - lo > 1) {
+		g = (lo + hi) / 2;
+		if (groups[g].first <= first) lo = g; else hi = g;
+	}
+
+	p = 0;
+	for (g = lo; g < index->num_groups && groups[g].first < last; g++) {
+		if (groups[g].length > cap) {
+			free(vals);
+			cap = groups[g].length;
+			vals = (int *)malloc(cap * (sizeof(int) + 1));
+			if (vals == NULL) {
+				return -1;
+			}
+			miss = (unsigned char *)(vals + cap);
+		}
+		if (complex_group_values(buf, md, &groups[g], vals, miss) < 0) {
+			free(vals);
+			return -1;
+		}
+
+		/* the differencing is undone from the seeds of the group on */
+		c = groups[g].count;
+		prev1 = groups[g].seed1;
+		prev2 = groups[g].seed2;
+		for (k = 0; k < groups[g].length && groups[g].first + k < last; k++) {
+			x = (unsigned int)vals[k];
+			if (!miss[k] && order > 0) {
+				if (c == 0) {
+					x = (unsigned int)index->ival1;
+				} else if (order == 2 && c == 1) {
+					x = (unsigned int)index->ival2;
+				} else if (order == 1) {
+					x += prev1 + (unsigned int)index->minsd;
+				} else {
+					x += 2 * prev1 - prev2 + (unsigned int)index->minsd;
+				}
+				prev2 = prev1;
+				prev1 = x;
+				c++;
+			}
+			if (groups[g].first + k < first) {
+				continue;
+			}
+			if (bitmap != NULL) {
+				for (; p < num_points && bitmap[p] != 1; p++) {
+					out[p] = GRIB_MISSING_VALUE;
+				}
+			}
+			out[p++] = miss[k] ? GRIB_MISSING_VALUE : md->R + (int)x * scale;
+		}
+	}
+	for (; p < num_points; p++) {
+		out[p] = GRIB_MISSING_VALUE;
+	}
+
+	free(vals);
+	return 0;
+}
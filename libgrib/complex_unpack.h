@@ -0,0 +1,18 @@
+#ifndef __COMPLEX_UNPACK__H__
+#define __COMPLEX_UNPACK__H__
+
+#include <grib2.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int unpack_complex(const unsigned char * buf, size_t len, const GRIBMetadata * md, double scale, size_t num_points, double * out);
+GRIB2GroupIndex * complex_index_build(const unsigned char * buf, size_t len, const GRIBMetadata * md);
+int unpack_complex_range(const unsigned char * buf, const GRIBMetadata * md, const GRIB2GroupIndex * index, double scale, size_t first, const unsigned char * bitmap, size_t num_points, double * out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -6,6 +6,8 @@
 	http://www.wmo.int/pages/prog/www/WDM/Guides/Guide-binary-2.html
 */
 
+#include <arena.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -66,6 +68,13 @@ typedef struct {
 	double ref_val;
 	double ** gridpoints;
 	int ngy;
+	struct {
+		pool_t storage; /* messages read from streams */
+		pool_t ext;
+		pool_t rows;
+		pool_t values;
+		pool_t bitmap;
+	} mem; /* memory reused for all records, released by grib1_free() */
 } GRIBRecord;
 
 #ifdef __cplusplus
@@ -1,5 +1,7 @@
 #include <grib1_unpack.h>
 #include <bits.h>
+#include <scale.h>
+#include <scan.h>
 #include <conv_float.h>
 #include <stdlib.h>
 #include <string.h>
@@ -148,21 +150,23 @@ static int grib1_unpackPDS(GRIBRecord * grib) /* {{{ */
 
 	grib->offset += 224;
 	if (grib->pds_len > 28) {
-		if (grib->pds_ext != NULL) {
-			free(grib->pds_ext);
-			grib->pds_ext = NULL;
-		}
 		if (grib->pds_len < 40) {
 			fprintf(stderr,"Warning: PDS extension is in wrong location\n");
 			grib->pds_ext_len = grib->pds_len - 28;
-			grib->pds_ext = (unsigned char *)malloc(grib->pds_ext_len);
+			grib->pds_ext = (unsigned char *)pool_reserve(&grib->mem.ext, grib->pds_ext_len);
+			if (grib->pds_ext == NULL) {
+				return -1;
+			}
 			for (n = 0; n < grib->pds_ext_len; n++) {
 				grib->pds_ext[n] = c_buf[36 + n];
 			}
 			grib->offset += grib->pds_ext_len * 8;
 		} else {
 			grib->pds_ext_len = grib->pds_len - 40;
-			grib->pds_ext = (unsigned char *)malloc(grib->pds_ext_len);
+			grib->pds_ext = (unsigned char *)pool_reserve(&grib->mem.ext, grib->pds_ext_len);
+			if (grib->pds_ext == NULL) {
+				return -1;
+			}
 			for (n = 0; n < grib->pds_ext_len; n++) {
 				grib->pds_ext[n] = c_buf[48 + n];
 			}
@@ -305,22 +309,39 @@ static int grib1_unpackGDS(GRIBRecord * grib) /* {{{ */
 	return 0;
 } /* }}} */
 
+/* Sets up the rows of the gridpoints (ngy rows of nx points) within memory
+ * kept across records. */
+static int grib1_alloc_gridpoints(GRIBRecord * grib) /* {{{ */
+{
+	double * values;
+	int n;
+
+	grib->gridpoints = (double **)pool_reserve(&grib->mem.rows, grib->ngy * sizeof(double *));
+	values = (double *)pool_reserve(&grib->mem.values, (size_t)grib->ngy * grib->nx * sizeof(double));
+	if (grib->gridpoints == NULL || values == NULL) {
+		grib->gridpoints = NULL;
+		return -1;
+	}
+	for (n = 0; n < grib->ngy; n++) {
+		grib->gridpoints[n] = values + (size_t)n * grib->nx;
+	}
+	return 0;
+} /* }}} */
+
 static int grib1_unpackBDS(GRIBRecord * grib) /* {{{ */
 {
 	int n;
-	int m;
 	int boff;
-	int bcnt = 0;
 	int num_packed = 0;
 	int bms_length;
 	int sign;
 	int ub;
 	int tref;
-	int * bitmap = NULL;
+	int bit;
+	unsigned char * bitmap = NULL;
 	int E;
-	int * packed = NULL;
-	int cnt;
-	double e;
+	size_t off;
+	double scale;
 	double d = pow(10.0, grib->D);
 
 	if (grib->bms_included == 1) {
@@ -336,10 +357,14 @@ static int grib1_unpackBDS(GRIBRecord * grib) /* {{{ */
 			return -1;
 		}
 		num_packed = (bms_length - 6) * 8 - ub;
-		bitmap = (int *)malloc(sizeof(int)*num_packed);
+		bitmap = (unsigned char *)pool_reserve(&grib->mem.bitmap, num_packed);
+		if (bitmap == NULL) {
+			return -1;
+		}
 		boff = grib->offset + 48;
 		for (n = 0; n < num_packed; n++) {
-			get_bits(grib->buffer, &bitmap[n], boff, 1);
+			get_bits(grib->buffer, &bit, boff, 1);
+			bitmap[n] = bit;
 			boff++;
 		}
 		grib->offset += bms_length * 8;
@@ -365,7 +390,7 @@ static int grib1_unpackBDS(GRIBRecord * grib) /* {{{ */
 	if (sign == 1) {
 		E =- E;
 	}
-	e = pow(2.0, E);
+	scale = pow(2.0, E) / d;
 
 	/* reference value */
 	grib->ref_val = ibm2real(grib->buffer, grib->offset + 48) / d;
@@ -375,9 +400,7 @@ static int grib1_unpackBDS(GRIBRecord * grib) /* {{{ */
 		grib->offset += 88;
 		if (grib->pack_width > 0) {
 			num_packed = (grib->bds_len * 8 - 88 - ub) / grib->pack_width;
-			packed = (int *)malloc(sizeof(int)*num_packed);
 		}
-		cnt = 0;
 		switch (grib->data_rep) {
 			case 0: /* Latitude/Longitude grid */
 			case 4: /* Gaussian Lat/Lon grid */
@@ -393,118 +416,72 @@ static int grib1_unpackBDS(GRIBRecord * grib) /* {{{ */
 				}
 			case 3: /* Lambert Conformal grid */
 			case 5: /* Polar Stereographic grid */
-				for (n = 0; n < num_packed; n++) {
-					get_bits(grib->buffer, &packed[n], grib->offset, grib->pack_width);
-					grib->offset += grib->pack_width;
-				}
-
-				if (grib->gridpoints != NULL) {
-					for (n = 0; n < grib->ngy; n++) {
-						free(grib->gridpoints[n]);
-					}
-					free(grib->gridpoints);
-				}
-
 				grib->ngy = grib->ny;
-				grib->gridpoints = (double **)malloc(sizeof(double) * grib->ngy);
-				for (n = 0; n < grib->ngy; n++) {
-					grib->gridpoints[n] = (double *)malloc(sizeof(double) * grib->nx);
+				if (grib1_alloc_gridpoints(grib) != 0) {
+					return -1;
 				}
-				for (n = 0; n < grib->ny; n++) {
-					for (m = 0; m < grib->nx; m++) {
-						if (bitmap == NULL || (bitmap != NULL && bitmap[bcnt++] == 1)) {
-							if (packed == NULL) {
-								/* constant field */
-								grib->gridpoints[n][m] = grib->ref_val;
-							} else {
-								grib->gridpoints[n][m] = grib->ref_val + packed[cnt++] * e / d;
-							}
-						} else {
-							grib->gridpoints[n][m] = GRIB_MISSING_VALUE;
-						}
-					}
+
+				/* a constant field (no packed values) unpacks to the reference value,
+				   the rows are contiguous and unpacked at once */
+				off = grib->offset;
+				if (unpack_scaled_split(grib->buffer, &off, grib->pack_width, grib->ref_val, scale,
+					bitmap, (size_t)grib->ny * grib->nx, grib->gridpoints[0]) != 0) {
+					return -1;
 				}
+				grib->offset = off;
 				break;
 				/* no recognized GDS, so just unpack the stream of gridpoints */
 			default:
 				grib->ngy = grib->ny = 1;
-				grib->gridpoints = (double **)malloc(sizeof(double)*grib->ngy);
-				for (n = 0; n < grib->ngy; n++) {
-					grib->gridpoints[n] = (double *)malloc(sizeof(double)*grib->nx);
+				grib->nx = num_packed;
+				if (grib1_alloc_gridpoints(grib) != 0) {
+					return -1;
 				}
-				for (n = 0; n < num_packed; n++) {
-					if (bitmap == NULL || (bitmap != NULL && bitmap[bcnt++] == 1)) {
-						grib->gridpoints[0][n] = grib->ref_val+packed[n] * e / d;
-					} else {
-						grib->gridpoints[0][n] = GRIB_MISSING_VALUE;
-					}
-					grib->nx++;
+				off = grib->offset;
+				if (unpack_scaled_split(grib->buffer, &off, grib->pack_width, grib->ref_val, scale,
+					bitmap, num_packed, grib->gridpoints[0]) != 0) {
+					return -1;
 				}
+				grib->offset = off;
 				break;
 		}
 	} else {
 		/* second-order packing */
 		fprintf(stderr,"Error: complex packing not currently supported\n");
-		if (packed != NULL) {
-			free(packed);
-			packed = NULL;
-		}
 		return -1;
 	}
-	free(packed);
 	return 0;
 } /* }}} */
 
+/* Reads from the stream until the window contains the indicator "GRIB". */
 static int search_next_message(unsigned char * temp, int (*read_func)(void * buf, unsigned int len))
 {
-	int n;
+	size_t n;
 
-	if (strncmp((char *)temp, "GRIB", 4) != 0) {
-		while (temp[0] != 0x47 || temp[1] != 0x52 || temp[2] != 0x49 || temp[3] != 0x42) {
-			switch (temp[1]) {
-				case 0x47:
-					for (n = 0; n < 3; n++) {
-						temp[n] = temp[n+1];
-					}
-					if (read_func(&temp[3], 1) == 0) {
-						return -1;
-					}
-					break;
-
-				default:
-					switch (temp[2]) {
-						case 0x47:
-							for (n = 0; n < 2; n++) {
-								temp[n] = temp[n+2];
-							}
-							if (read_func(&temp[2], 2) == 0) {
-								return -1;
-							}
-							break;
-
-						default:
-							switch(temp[3]) {
-								case 0x47:
-									temp[0] = temp[3];
-									if (read_func(&temp[1], 3) == 0) {
-										return -1;
-									}
-									break;
-								default:
-									if (read_func(temp, 4) == 0) {
-										return -1;
-									}
-									break;
-							}
-							break;
-					}
-					break;
-			}
+	while ((n = grib_magic_shift(temp)) > 0) {
+		if (read_func(&temp[4 - n], n) == 0) {
+			return -1;
 		}
 	}
 	return 0;
 }
 
+/* Unpacks the first 8 octets of the indicator section. */
+static void grib1_unpackIS_header(GRIBRecord * grib, const unsigned char * is) /* {{{ */
+{
+	get_bits(is, &grib->total_len, 32, 24);
+	if (grib->total_len == 24) {
+		grib->ed_num = 0;
+		grib->pds_len = grib->total_len;
+
+		/* add the four bytes for 'GRIB' + 3 bytes for the length of the section following the PDS */
+		grib->total_len += 7;
+	} else {
+		grib->ed_num = 1;
+	}
+	grib->nx = grib->ny = 0;
+} /* }}} */
+
 static int grib1_unpackIS(GRIBRecord * grib, int (*read_func)(void * buf, unsigned int len)) /* {{{ */
 {
 	unsigned char temp[8];
@@ -515,9 +492,7 @@ static int grib1_unpackIS(GRIBRecord * grib, int (*read_func)(void * buf, unsign
 		return -1;
 	}
 
-	if (grib->buffer != NULL) {
-		free(grib->buffer);
-	}
+	grib->buffer = NULL;
 
 	if (read_func(temp, 4) != 4) {
 		return -1;
@@ -531,19 +506,11 @@ static int grib1_unpackIS(GRIBRecord * grib, int (*read_func)(void * buf, unsign
 		return 1;
 	}
 
-	get_bits(temp, &grib->total_len, 32, 24);
-	if (grib->total_len == 24) {
-		grib->ed_num = 0;
-		grib->pds_len = grib->total_len;
-
-		/* add the four bytes for 'GRIB' + 3 bytes for the length of the section following the PDS */
-		grib->total_len += 7;
-	} else {
-		grib->ed_num = 1;
+	grib1_unpackIS_header(grib, temp);
+	if (grib->total_len < 12 || pool_reserve(&grib->mem.storage, grib->total_len + 4) == NULL) {
+		return 1;
 	}
-
-	grib->nx = grib->ny = 0;
-	grib->buffer = (unsigned char *)malloc((grib->total_len + 4) * sizeof(unsigned char));
+	grib->buffer = (unsigned char *)grib->mem.storage.data;
 	memcpy(grib->buffer, temp, 8);
 	num = grib->total_len - 8;
 	status = read_func(&grib->buffer[8], num);
@@ -557,14 +524,41 @@ static int grib1_unpackIS(GRIBRecord * grib, int (*read_func)(void * buf, unsign
 	}
 } /* }}} */
 
-int grib1_unpack(GRIBRecord * grib, int (*read_func)(void * buf, unsigned int len))
+/* Same as grib1_unpackIS(), but the message is referenced in place within the
+ * specified memory instead of being copied. */
+static int grib1_unpackIS_memory(GRIBRecord * grib, const unsigned char * buf, size_t len, size_t * cursor) /* {{{ */
 {
-	if (read_func == NULL) {
+	size_t pos;
+
+	grib->buffer = NULL;
+
+	pos = *cursor + grib_find_message(buf + *cursor, len - *cursor, 0);
+	if (pos + 8 > len) {
+		*cursor = len;
 		return -1;
 	}
-	if (grib1_unpackIS(grib, read_func) != 0) {
-		return -1;
+
+	/* skip this indicator if the message turns out to be unusable */
+	*cursor = pos + 4;
+
+	grib1_unpackIS_header(grib, buf + pos);
+	if (grib->total_len < 8 || (size_t)grib->total_len > len - pos) {
+		fprintf(stderr,"Error: truncated message\n");
+		return 1;
 	}
+	if (memcmp(buf + pos + grib->total_len - 4, "7777", 4) != 0) {
+		fprintf(stderr,"Warning: no end section found\n");
+	}
+
+	/* the message is only read, never modified */
+	grib->buffer = (unsigned char *)(buf + pos);
+	*cursor = pos + grib->total_len;
+	return 0;
+} /* }}} */
+
+/* Unpacks all sections following the indicator section. */
+static int grib1_unpack_sections(GRIBRecord * grib) /* {{{ */
+{
 	if (grib1_unpackPDS(grib) != 0) {
 		return -1;
 	}
@@ -577,5 +571,72 @@ int grib1_unpack(GRIBRecord * grib, int (*read_func)(void * buf, unsigned int le
 		return -1;
 	}
 	return 0;
+} /* }}} */
+
+int grib1_unpack(GRIBRecord * grib, int (*read_func)(void * buf, unsigned int len))
+{
+	if (read_func == NULL) {
+		return -1;
+	}
+	if (grib1_unpackIS(grib, read_func) != 0) {
+		return -1;
+	}
+	return grib1_unpack_sections(grib);
+}
+
+/* Unpacks the next message found in memory, starting at the cursor. The message
+ * is not copied, the buffer of the record points into the specified memory,
+ * which therefore must not be released before the record.
+ *
+ * Like grib1_unpack(), the buffer of the record must be NULL on the first call.
+ *
+ * @param[inout] grib The record.
+ * @param[in] buf Memory containing GRIB1 messages.
+ * @param[in] len Size of the memory in bytes.
+ * @param[inout] cursor Offset within the memory at which the search for the next message
+ *     starts. On return the offset behind the unpacked message.
+ * @retval 0 Success
+ * @retval -1 Failure, or no more messages
+ */
+int grib1_unpack_from_memory(GRIBRecord * grib, const unsigned char * buf, size_t len, size_t * cursor)
+{
+	if (buf == NULL || cursor == NULL || *cursor > len) {
+		return -1;
+	}
+	if (grib1_unpackIS_memory(grib, buf, len, cursor) != 0) {
+		return -1;
+	}
+	return grib1_unpack_sections(grib);
 }
 
+/* Unpacks the next message of a mapped file, see grib1_unpack_from_memory().
+ * The file must stay mapped as long as the record is used. */
+int grib1_unpack_mapped(GRIBRecord * grib, mapped_file_t * mf)
+{
+	int rc;
+
+	if (mf == NULL) {
+		return -1;
+	}
+
+	rc = grib1_unpack_from_memory(grib, mf->data, mf->len, &mf->cursor);
+	mapped_file_advise(mf);
+	return rc;
+}
+
+/* Releases all memory of the record, including the memory kept for the next
+ * record. The record may be reused afterwards. */
+void grib1_free(GRIBRecord * grib)
+{
+	if (grib == NULL) {
+		return;
+	}
+	pool_free(&grib->mem.storage);
+	pool_free(&grib->mem.ext);
+	pool_free(&grib->mem.rows);
+	pool_free(&grib->mem.values);
+	pool_free(&grib->mem.bitmap);
+	grib->buffer = NULL;
+	grib->pds_ext = NULL;
+	grib->gridpoints = NULL;
+}
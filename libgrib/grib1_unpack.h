@@ -2,12 +2,16 @@
 #define __GRIB1_UNPACK__H__
 
 #include <grib1.h>
+#include <mapped_file.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 int grib1_unpack(GRIBRecord * grib, int (*read_func)(void * buf, unsigned int len));
+int grib1_unpack_from_memory(GRIBRecord * grib, const unsigned char * buf, size_t len, size_t * cursor);
+int grib1_unpack_mapped(GRIBRecord * grib, mapped_file_t * mf);
+void grib1_free(GRIBRecord * grib);
 
 #ifdef __cplusplus
 }
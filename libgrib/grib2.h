@@ -1,6 +1,9 @@
 #ifndef __GRIB2__H__
 #define __GRIB2__H__
 
+#include <arena.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -73,17 +76,86 @@ typedef struct {
 	int D;
 	int num_packed;
 	int pack_width;
+	int precision; /* IEEE floating point data (template 5.4), 1: 32 bit, 2: 64 bit */
+	struct {
+		int split_method;
+		int miss_mgmt; /* 0: no missing values, 1: primary, 2: primary and secondary */
+		float primary_miss;
+		float secondary_miss;
+		int num_groups;
+		int ref_width; /* reference of the group widths */
+		int width_bits;
+		int ref_length; /* reference of the group lengths */
+		int length_incr;
+		int last_length; /* true length of the last group */
+		int length_bits;
+		int order; /* order of the spatial differencing, 0 for template 5.2 */
+		int num_octets; /* octets of the extra descriptors of the spatial differencing */
+	} complex_pack;
+	struct {
+		int flags; /* CCSDS compression options mask */
+		int block_size; /* in samples */
+		int rsi; /* reference sample interval */
+	} ccsds; /* template 5.42 */
 	int bms_ind;
 	unsigned char * bitmap;
+	int sec_offset[8]; /* offsets in bytes of the sections in effect, relative to the message, 0 if absent */
 } GRIBMetadata;
 
+/* A group of complex packed values (templates 5.2 and 5.3), see
+ * GRIB2GroupIndex. The layout is fixed, group indices are kept in files. */
+typedef struct {
+	uint64_t offset; /* offset in bits of the packed values, relative to the data section */
+	uint32_t first; /* number of the first packed value */
+	uint32_t length; /* number of packed values */
+	uint32_t ref; /* group reference */
+	uint32_t seed1; /* last value in front of the group which is not missing, spatial differencing only */
+	uint32_t seed2; /* value in front of seed1, second order spatial differencing only */
+	uint32_t count; /* number of values in front of the group which are not missing */
+	uint8_t width; /* width in bits of the packed values */
+	uint8_t reserved[7];
+} GRIB2Group;
+
+/* Index of the groups of a complex packed field, the groups follow the
+ * index immediately, see grib2_group_index_groups(). Unpacking an area of
+ * the field through the index reads only the groups of the area, see
+ * grib2_grid_crop(). */
+typedef struct {
+	int32_t ival1; /* extra descriptors of the spatial differencing */
+	int32_t ival2;
+	int32_t minsd;
+	uint32_t num_groups;
+} GRIB2GroupIndex;
+
+#define grib2_group_index_groups(index) ((const GRIB2Group *)((const GRIB2GroupIndex *)(index) + 1))
+
 typedef struct {
 	GRIBMetadata md;
-	double * gridpoints;
+	double * gridpoints; /* unpacked on demand, access through grib2_grid_values() */
+	const GRIB2GroupIndex * groups; /* index of the groups of complex packed fields, NULL if not known */
+	int swapped; /* IEEE data (template 5.4) swapped in the buffer owned by the message, see grib2_grid_float32() */
 } GRIB2Grid;
 
+/* A float within a message, not necessarily aligned, see grib2_grid_float32(). */
+#if defined(__GNUC__)
+typedef float grib2_float32_t __attribute__((aligned(1)));
+#else
+typedef float grib2_float32_t;
+#endif
+
+/* An area of a grid, see grib2_grid_area(). */
+typedef struct {
+	int i0; /* first column */
+	int j0; /* first row */
+	int ni; /* number of columns */
+	int nj; /* number of rows */
+} GRIB2Area;
+
 typedef struct {
-	unsigned char * buffer;
+	unsigned char * buffer; /* the message, NULL only before the first call and after grib2_free() */
+	pool_t storage; /* memory messages read from streams are kept in, reused for all messages */
+	arena_t arena; /* grids, bitmaps and gridpoints of the message, reused for all messages */
+	void * jpc_state; /* state of the JPEG2000 decoder, reused for all fields */
 	int offset;  /* offset in bytes to next GRIB2 section */
 	int total_len;
 	int disc;
@@ -100,6 +172,7 @@ typedef struct {
 	int prod_status;
 	int data_type;
 	GRIBMetadata md;
+	int has_data; /* buffer contains the data sections, gridpoints can be unpacked */
 	int num_grids;
 	GRIB2Grid * grids;
 } GRIBMessage;
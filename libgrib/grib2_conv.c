@@ -1530,7 +1530,6 @@ int grib2_to_grib1_packBMS(GRIBMessage * msg, int grid_number, buffer_t * grib1,
 {
 	int length = 6 + (num_points + 7) / 8; /* length in bytes */
 	int unused = 8 - (num_points % 8); /* unused bits */
-	unsigned int n;
 
 	/* length of the BMS */
 	append_bits(grib1, length, 24);
@@ -1542,9 +1541,7 @@ int grib2_to_grib1_packBMS(GRIBMessage * msg, int grid_number, buffer_t * grib1,
 	append_bits(grib1, 0, 16);
 
 	/* the bitmap */
-	for (n = 0; n < num_points; n++) {
-		append_bits(grib1, msg->grids[grid_number].md.bitmap[n], 1);
-	}
+	if (append_bitmap(grib1, msg->grids[grid_number].md.bitmap, num_points) != 0) return -1;
 
 	grib1->offset += unused;
 
@@ -1555,7 +1552,6 @@ int grib2_to_grib1_packBDS(GRIBMessage * msg, int grid_number, buffer_t * grib1,
 {
 	int length = 11 + (num_to_pack * pack_width + 7) / 8; /* length in bytes */
 	int unused = (length - 11) * 8 - (num_to_pack * pack_width); /* unused bits */
-	size_t m;
 	int E;
 	int32_t ibm_rep;
 
@@ -1583,9 +1579,7 @@ int grib2_to_grib1_packBDS(GRIBMessage * msg, int grid_number, buffer_t * grib1,
 	append_bits(grib1, pack_width, 8);
 
 	/* packed data values */
-	for (m = 0; m < num_to_pack; m++) {
-		append_bits(grib1, pvals[m], pack_width);
-	}
+	if (append_bits_array(grib1, pvals, num_to_pack, pack_width) != 0) return -1;
 
 	grib1->offset += unused;
 
@@ -1593,7 +1587,18 @@ int grib2_to_grib1_packBDS(GRIBMessage * msg, int grid_number, buffer_t * grib1,
 } /* }}} */
 
 
-int grib2_to_grib1_conv(int (*read_func)(void *, unsigned int, void *), void * read_ptr, int (*write_func)(const void *, unsigned int, void *), void * write_ptr) /* {{{ */
+/* Converts all grids of a GRIB2 message into GRIB1 records.
+ *
+ * @param[in] grib_msg The unpacked GRIB2 message.
+ * @param[inout] grib1 Buffer for the GRIB1 records, reused for all messages.
+ * @param[inout] max_length Size of the buffer.
+ * @param[inout] packed Memory for the packed values, reused for all messages.
+ * @param[in] write_func Function to write the GRIB1 records.
+ * @param[in] write_ptr Parameter of the write function.
+ * @retval 0 Success
+ * @retval -1 Failure
+ */
+static int grib2_to_grib1_message(GRIBMessage * grib_msg, buffer_t * grib1, int * max_length, pool_t * packed, int (*write_func)(const void *, unsigned int, void *), void * write_ptr) /* {{{ */
 {
 	int m;
 	unsigned int cnt;
@@ -1601,134 +1606,192 @@ int grib2_to_grib1_conv(int (*read_func)(void *, unsigned int, void *), void * r
 	int num_points;
 	int num_to_pack;
 	int pack_width;
-	int * pvals = NULL;
+	int * pvals;
 	int max_pack;
+	const double * gridpoints;
 
 	int i_grid;
 
-	GRIBMessage grib_msg;
-
-	buffer_t grib1 = { NULL, 0, 0 };
 	int length = 0;
-	int max_length = 0;
-
-	grib_msg.buffer = NULL;
-	grib_msg.grids = NULL;
 
-	while (grib2_unpack(&grib_msg, read_func, read_ptr) == 0) {
-		for (i_grid = 0; i_grid < grib_msg.num_grids; ++i_grid) {
-			/* calculate the octet length of the GRIB1 grid (minus the Indicator and End
-			   Sections, which are both fixed in length */
-			switch (grib_msg.md.pds_templ_num) {
-				case 0:
-				case 8:
-					length = 28;
-					break;
-				case 1:
-				case 11:
-					length = 43;
-					break;
-				case 2:
-				case 12:
-					length = 42;
-					break;
-				default:
-					buffer_free(&grib1);
-					fprintf(stderr,"Unable to map Product Definition Template %d into GRIB1\n", grib_msg.md.pds_templ_num);
-					return -1;
-			}
+	for (i_grid = 0; i_grid < grib_msg->num_grids; ++i_grid) {
+		/* calculate the octet length of the GRIB1 grid (minus the Indicator and End
+		   Sections, which are both fixed in length */
+		switch (grib_msg->md.pds_templ_num) {
+			case 0:
+			case 8:
+				length = 28;
+				break;
+			case 1:
+			case 11:
+				length = 43;
+				break;
+			case 2:
+			case 12:
+				length = 42;
+				break;
+			default:
+				buffer_free(grib1);
+				fprintf(stderr,"Unable to map Product Definition Template %d into GRIB1\n", grib_msg->md.pds_templ_num);
+				return -1;
+		}
 
-			switch (grib_msg.md.gds_templ_num) {
-				case 0:
-					length += 32;
-					num_points = grib_msg.md.nx * grib_msg.md.ny;
-					break;
-				case 30:
-					length += 42;
-					num_points = grib_msg.md.nx * grib_msg.md.ny;
-					break;
-				default:
-					buffer_free(&grib1);
-					fprintf(stderr,"Unable to map Grid Definition Template %d into GRIB1\n", grib_msg.md.gds_templ_num);
-					return -1;
-			}
+		switch (grib_msg->md.gds_templ_num) {
+			case 0:
+				length += 32;
+				num_points = grib_msg->md.nx * grib_msg->md.ny;
+				break;
+			case 30:
+				length += 42;
+				num_points = grib_msg->md.nx * grib_msg->md.ny;
+				break;
+			default:
+				buffer_free(grib1);
+				fprintf(stderr,"Unable to map Grid Definition Template %d into GRIB1\n", grib_msg->md.gds_templ_num);
+				return -1;
+		}
 
-			if (grib_msg.grids[i_grid].md.bitmap != NULL) {
-				length += 6 + (num_points + 7) / 8;
-				num_to_pack = 0;
-				for (m = 0; m < num_points; m++) {
-					if (grib_msg.grids[i_grid].md.bitmap[m] == 1) {
-						num_to_pack++;
-					}
+		if (grib_msg->grids[i_grid].md.bitmap != NULL) {
+			length += 6 + (num_points + 7) / 8;
+			num_to_pack = 0;
+			for (m = 0; m < num_points; m++) {
+				if (grib_msg->grids[i_grid].md.bitmap[m] == 1) {
+					num_to_pack++;
 				}
-			} else {
-				num_to_pack = num_points;
 			}
+		} else {
+			num_to_pack = num_points;
+		}
 
-			pvals = (int *)malloc(sizeof(int) * num_to_pack);
-			max_pack = 0;
-			cnt = 0;
-			for (m = 0; m < num_points; m++) {
-				if (grib_msg.grids[i_grid].gridpoints[m] != GRIB_MISSING_VALUE) {
-					pvals[cnt] = lroundf((grib_msg.grids[i_grid].gridpoints[m] - grib_msg.grids[i_grid].md.R) * pow(10.0, grib_msg.grids[i_grid].md.D) / pow(2.0, grib_msg.grids[i_grid].md.E));
-					if (pvals[cnt] > max_pack) {
-						max_pack = pvals[cnt];
-					}
-					cnt++;
+		gridpoints = grib2_grid_values(grib_msg, i_grid);
+		if (gridpoints == NULL) {
+			buffer_free(grib1);
+			fprintf(stderr, "Unable to unpack the gridpoints of grid %d\n", i_grid);
+			return -1;
+		}
+
+		pvals = (int *)pool_reserve(packed, sizeof(int) * num_to_pack);
+		if (pvals == NULL) {
+			buffer_free(grib1);
+			return -1;
+		}
+		max_pack = 0;
+		cnt = 0;
+		for (m = 0; m < num_points; m++) {
+			if (gridpoints[m] != GRIB_MISSING_VALUE) {
+				pvals[cnt] = lroundf((gridpoints[m] - grib_msg->grids[i_grid].md.R) * pow(10.0, grib_msg->grids[i_grid].md.D) / pow(2.0, grib_msg->grids[i_grid].md.E));
+				if (pvals[cnt] > max_pack) {
+					max_pack = pvals[cnt];
 				}
+				cnt++;
 			}
-			pack_width = 1;
-			while (pow(2.0, pack_width) - 1 < max_pack) {
-				pack_width++;
-			}
-			length += 11 + (num_to_pack * pack_width + 7) / 8;
+		}
+		pack_width = 1;
+		while (pow(2.0, pack_width) - 1 < max_pack) {
+			pack_width++;
+		}
+		length += 11 + (num_to_pack * pack_width + 7) / 8;
 
-			/* allocate enough memory for the GRIB1 buffer */
-			if (length > max_length) {
-				buffer_free(&grib1);
-				buffer_alloc(&grib1, length);
-				max_length = length;
-			}
+		/* allocate enough memory for the GRIB1 buffer */
+		if (length > *max_length) {
+			buffer_free(grib1);
+			buffer_alloc(grib1, length);
+			*max_length = length;
+		}
 
-			grib1.offset = 0;
+		grib1->offset = 0;
 
-			/* pack the Product Definition Section */
-			if (grib2_to_grib1_packPDS(&grib_msg, i_grid, &grib1) != 0) {
-				buffer_free(&grib1);
-				return -1;
-			}
+		/* pack the Product Definition Section */
+		if (grib2_to_grib1_packPDS(grib_msg, i_grid, grib1) != 0) {
+			buffer_free(grib1);
+			return -1;
+		}
 
-			/* pack the Grid Definition Section */
-			if (grib2_to_grib1_packGDS(&grib_msg, i_grid, &grib1) != 0) {
-				buffer_free(&grib1);
+		/* pack the Grid Definition Section */
+		if (grib2_to_grib1_packGDS(grib_msg, i_grid, grib1) != 0) {
+			buffer_free(grib1);
+			return -1;
+		}
+
+		/* pack the Bitmap Section, if it exists */
+		if (grib_msg->grids[i_grid].md.bitmap != NULL) {
+			if (grib2_to_grib1_packBMS(grib_msg, i_grid, grib1, num_points) != 0) {
+				buffer_free(grib1);
 				return -1;
 			}
+		}
 
-			/* pack the Bitmap Section, if it exists */
-			if (grib_msg.grids[i_grid].md.bitmap != NULL) {
-				if (grib2_to_grib1_packBMS(&grib_msg, i_grid, &grib1, num_points) != 0) {
-					buffer_free(&grib1);
-					return -1;
-				}
-			}
+		/* pack the Binary Data Section */
+		if (grib2_to_grib1_packBDS(grib_msg, i_grid, grib1, pvals, num_to_pack, pack_width) != 0) {
+			buffer_free(grib1);
+			return -1;
+		}
 
-			/* pack the Binary Data Section */
-			if (grib2_to_grib1_packBDS(&grib_msg, i_grid, &grib1, pvals, num_to_pack, pack_width) != 0) {
-				buffer_free(&grib1);
-				return -1;
-			}
+		/* output the GRIB1 grid */
+		if (grib1_write_raw(grib1->buffer, length, write_func, write_ptr) != 0) {
+			buffer_free(grib1);
+			fprintf(stderr, "%s:%d: Cannot write GRIB1 data\n", __FILE__, __LINE__);
+			return -1;
+		}
+	}
+	return 0;
+} /* }}} */
 
-			free(pvals);
+int grib2_to_grib1_conv(int (*read_func)(void *, unsigned int, void *), void * read_ptr, int (*write_func)(const void *, unsigned int, void *), void * write_ptr) /* {{{ */
+{
+	GRIBMessage grib_msg;
 
-			/* output the GRIB1 grid */
-			if (grib1_write_raw(grib1.buffer, length, write_func, write_ptr) != 0) {
-				buffer_free(&grib1);
-				fprintf(stderr, "%s:%d: Cannot write GRIB1 data\n", __FILE__, __LINE__);
-				return -1;
-			}
+	buffer_t grib1 = { NULL, 0, 0 };
+	int max_length = 0;
+	pool_t packed = { NULL, 0 };
+
+	grib_msg.buffer = NULL;
+
+	while (grib2_unpack(&grib_msg, read_func, read_ptr) == 0) {
+		if (grib2_to_grib1_message(&grib_msg, &grib1, &max_length, &packed, write_func, write_ptr) != 0) {
+			buffer_free(&grib1);
+			pool_free(&packed);
+			grib2_free(&grib_msg);
+			return -1;
 		}
 	}
 	buffer_free(&grib1);
+	pool_free(&packed);
+	grib2_free(&grib_msg);
 	return 0;
 } /* }}} */
 
+/* Converts all GRIB2 messages found in memory, the messages are unpacked in
+ * place (see grib2_unpack_from_memory()).
+ *
+ * @param[in] buf Memory containing GRIB2 messages.
+ * @param[in] len Size of the memory in bytes.
+ * @param[in] write_func Function to write the GRIB1 records.
+ * @param[in] write_ptr Parameter of the write function.
+ * @retval 0 Success
+ * @retval -1 Failure
+ */
+int grib2_to_grib1_conv_memory(const unsigned char * buf, size_t len, int (*write_func)(const void *, unsigned int, void *), void * write_ptr) /* {{{ */
+{
+	GRIBMessage grib_msg;
+
+	buffer_t grib1 = { NULL, 0, 0 };
+	int max_length = 0;
+	pool_t packed = { NULL, 0 };
+	size_t cursor = 0;
+
+	grib_msg.buffer = NULL;
+
+	while (grib2_unpack_from_memory(&grib_msg, buf, len, &cursor) == 0) {
+		if (grib2_to_grib1_message(&grib_msg, &grib1, &max_length, &packed, write_func, write_ptr) != 0) {
+			buffer_free(&grib1);
+			pool_free(&packed);
+			grib2_free(&grib_msg);
+			return -1;
+		}
+	}
+	buffer_free(&grib1);
+	pool_free(&packed);
+	grib2_free(&grib_msg);
+	return 0;
+} /* }}} */
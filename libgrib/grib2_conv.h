@@ -14,6 +14,7 @@ int grib2_to_grib1_packBMS(GRIBMessage * msg, int grid_number, buffer_t * grib1,
 int grib2_to_grib1_packBDS(GRIBMessage * msg, int grid_number, buffer_t * grib1, int * pvals, size_t num_to_pack, int pack_width);
 
 int grib2_to_grib1_conv(int (*read_func)(void *, unsigned int, void *), void *, int (*write_func)(const void *, unsigned int, void *), void *);
+int grib2_to_grib1_conv_memory(const unsigned char * buf, size_t len, int (*write_func)(const void *, unsigned int, void *), void *);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,422 @@
+#include <grib2_index.h>
+#include <grib2_unpack.h>
+#include <complex_unpack.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* Index of the fields of a GRIB2 file, kept in a sidecar file next to it.
+ *
+ * The index records for every field the position of its message and of the
+ * sections in effect for the field, together with the metadata needed to
+ * select fields. Looking up a field does not require to read any message in
+ * front of it, only the sections of the field itself are unpacked.
+ *
+ * Complex packed fields (templates 5.2 and 5.3) additionally have their
+ * group index kept in the index file, see GRIB2GroupIndex. Areas of these
+ * fields unpacked through the index read only the groups of the area, the
+ * group metadata of the field is not scanned again.
+ *
+ * The index file is mapped into memory as it is, it is considered stale if
+ * the size or the modification time of the GRIB2 file do not match the
+ * values recorded in the index.
+ */
+
+/* Appends the entries of all fields of an unpacked message. */
+static int append_entries(const GRIBMessage * msg, size_t pos, grib2_index_entry_t ** entries, size_t * num, size_t * cap) /* {{{ */
+{
+	grib2_index_entry_t * e;
+	const GRIBMetadata * md;
+	int n;
+	int s;
+
+	for (n = 0; n < msg->num_grids; n++) {
+		if (*num == *cap) {
+			*cap = (*cap == 0) ? 256 : *cap * 2;
+			e = (grib2_index_entry_t *)realloc(*entries, *cap * sizeof(grib2_index_entry_t));
+			if (e == NULL) {
+				fprintf(stderr, "Error: cannot allocate memory for the index\n");
+				return -1;
+			}
+			*entries = e;
+		}
+		md = &msg->grids[n].md;
+		e = &(*entries)[(*num)++];
+		memset(e, 0, sizeof(grib2_index_entry_t));
+		e->msg_offset = pos;
+		e->msg_len = (uint32_t)msg->total_len;
+		for (s = 0; s < 8; s++) {
+			e->sec_offset[s] = (uint32_t)md->sec_offset[s];
+		}
+		e->lvl1 = md->lvl1;
+		e->lvl2 = md->lvl2;
+		e->fcst_time = md->fcst_time;
+		e->time = msg->time;
+		e->yr = (uint16_t)msg->yr;
+		e->field = (uint16_t)n;
+		e->drs_templ_num = (uint16_t)md->drs_templ_num;
+		e->mo = (uint8_t)msg->mo;
+		e->dy = (uint8_t)msg->dy;
+		e->disc = (uint8_t)msg->disc;
+		e->param_cat = (uint8_t)md->param_cat;
+		e->param_num = (uint8_t)md->param_num;
+		e->lvl1_type = (uint8_t)md->lvl1_type;
+		e->lvl2_type = (uint8_t)md->lvl2_type;
+		e->time_unit = (uint8_t)md->time_unit;
+		e->pack_width = (uint8_t)md->pack_width;
+	}
+	return 0;
+} /* }}} */
+
+/* Builds the entries of all fields of a mapped GRIB2 file, only the metadata
+ * of the messages is unpacked. Messages which cannot be unpacked are not part
+ * of the index. */
+static int build_entries(const mapped_file_t * grib, grib2_index_entry_t ** entries, size_t * num) /* {{{ */
+{
+	GRIBMessage msg;
+	size_t cursor = 0;
+	size_t cap = 0;
+	int rc = 0;
+
+	*entries = NULL;
+	*num = 0;
+	msg.buffer = NULL;
+	while (rc == 0 && cursor < grib->len) {
+		if (grib2_unpack_metadata_from_memory(&msg, grib->data, grib->len, &cursor) != 0) {
+			continue;
+		}
+		rc = append_entries(&msg, cursor - msg.total_len, entries, num, &cap);
+	}
+
+	grib2_free(&msg);
+
+	if (rc != 0) {
+		free(*entries);
+		*entries = NULL;
+		*num = 0;
+	}
+	return rc;
+} /* }}} */
+
+/* Builds the group indices of all complex packed fields, these fields are
+ * unpacked once. Fields without groups, e.g. constant fields, or fields which
+ * cannot be unpacked have no group index. */
+static int build_groups(const mapped_file_t * grib, grib2_index_entry_t * entries, size_t num, unsigned char ** groups, size_t * size) /* {{{ */
+{
+	GRIBMessage msg;
+	GRIB2GroupIndex * index;
+	unsigned char * p;
+	size_t cap = 0;
+	size_t len;
+	size_t n;
+	int sec_offset[8];
+	int s;
+	int rc = 0;
+
+	*groups = NULL;
+	*size = 0;
+	msg.buffer = NULL;
+	for (n = 0; rc == 0 && n < num; n++) {
+		if (entries[n].drs_templ_num != 2 && entries[n].drs_templ_num != 3) {
+			continue;
+		}
+		for (s = 0; s < 8; s++) {
+			sec_offset[s] = (int)entries[n].sec_offset[s];
+		}
+		if (grib2_unpack_field(&msg, grib->data, grib->len, (size_t)entries[n].msg_offset, sec_offset) != 0) {
+			continue;
+		}
+		index = grib2_grid_group_index(&msg, 0);
+		if (index == NULL) {
+			continue;
+		}
+		len = sizeof(GRIB2GroupIndex) + index->num_groups * sizeof(GRIB2Group);
+		if (*size + len > cap) {
+			cap = (*size + len > cap * 2) ? *size + len : cap * 2;
+			p = (unsigned char *)realloc(*groups, cap);
+			if (p == NULL) {
+				fprintf(stderr, "Error: cannot allocate memory for the index\n");
+				free(index);
+				rc = -1;
+				break;
+			}
+			*groups = p;
+		}
+		memcpy(*groups + *size, index, len);
+		entries[n].groups_offset = *size;
+		entries[n].has_groups = 1;
+		*size += len;
+		free(index);
+	}
+
+	grib2_free(&msg);
+
+	if (rc != 0) {
+		free(*groups);
+		*groups = NULL;
+		*size = 0;
+	}
+	return rc;
+} /* }}} */
+
+/* Writes the index file. The file is written under a temporary name and
+ * renamed afterwards, readers never see a partially written index. */
+static int write_index(const char * index_filename, const mapped_file_t * grib, const grib2_index_entry_t * entries, size_t num, const unsigned char * groups, size_t groups_size) /* {{{ */
+{
+	grib2_index_header_t header;
+	char * tmp;
+	FILE * fp;
+	int rc = 0;
+
+	tmp = (char *)malloc(strlen(index_filename) + 5);
+	if (tmp == NULL) {
+		return -1;
+	}
+	strcpy(tmp, index_filename);
+	strcat(tmp, ".tmp");
+
+	fp = fopen(tmp, "wb");
+	if (fp == NULL) {
+		free(tmp);
+		return -1;
+	}
+	header.magic = GRIB2_INDEX_MAGIC;
+	header.version = GRIB2_INDEX_VERSION;
+	header.entry_size = sizeof(grib2_index_entry_t);
+	header.num_entries = (uint32_t)num;
+	header.src_size = grib->len;
+	header.src_mtime = grib->mtime;
+	header.groups_size = groups_size;
+	if (fwrite(&header, sizeof(header), 1, fp) != 1) rc = -1;
+	if (rc == 0 && num > 0 && fwrite(entries, sizeof(grib2_index_entry_t), num, fp) != num) rc = -1;
+	if (rc == 0 && groups_size > 0 && fwrite(groups, groups_size, 1, fp) != 1) rc = -1;
+	if (fclose(fp) != 0) rc = -1;
+	if (rc == 0 && rename(tmp, index_filename) != 0) rc = -1;
+	if (rc != 0) {
+		fprintf(stderr, "Error: cannot write index file '%s'\n", index_filename);
+		remove(tmp);
+	}
+	free(tmp);
+	return rc;
+} /* }}} */
+
+/* Maps an existing index file, if it is valid and up to date. */
+static int map_index(grib2_index_t * idx, const char * index_filename) /* {{{ */
+{
+	const grib2_index_header_t * header;
+	FILE * fp;
+
+	/* a missing index is not an error, check before mapping */
+	fp = fopen(index_filename, "rb");
+	if (fp == NULL) {
+		return -1;
+	}
+	fclose(fp);
+
+	if (mapped_file_open(&idx->idx, index_filename) != 0) {
+		return -1;
+	}
+	mapped_file_random(&idx->idx);
+	header = (const grib2_index_header_t *)idx->idx.data;
+	if (idx->idx.len < sizeof(grib2_index_header_t)
+		|| header->magic != GRIB2_INDEX_MAGIC
+		|| header->version != GRIB2_INDEX_VERSION
+		|| header->entry_size != sizeof(grib2_index_entry_t)
+		|| idx->idx.len != sizeof(grib2_index_header_t) + (size_t)header->num_entries * sizeof(grib2_index_entry_t) + header->groups_size
+		|| header->src_size != idx->grib.len
+		|| header->src_mtime != idx->grib.mtime) {
+		mapped_file_close(&idx->idx);
+		return -1;
+	}
+	idx->entries = (const grib2_index_entry_t *)(idx->idx.data + sizeof(grib2_index_header_t));
+	idx->num_entries = header->num_entries;
+	idx->groups = (const unsigned char *)(idx->entries + idx->num_entries);
+	idx->groups_size = (size_t)header->groups_size;
+	return 0;
+} /* }}} */
+
+static char * index_name(const char * filename) /* {{{ */
+{
+	char * s;
+
+	s = (char *)malloc(strlen(filename) + sizeof(GRIB2_INDEX_SUFFIX));
+	if (s != NULL) {
+		strcpy(s, filename);
+		strcat(s, GRIB2_INDEX_SUFFIX);
+	}
+	return s;
+} /* }}} */
+
+/* Builds the index of a GRIB2 file and writes it.
+ *
+ * @param[in] filename Name of the GRIB2 file.
+ * @param[in] index_filename Name of the index file, NULL to use the name of
+ *     the GRIB2 file with GRIB2_INDEX_SUFFIX appended.
+ * @retval 0 Success
+ * @retval -1 Failure
+ */
+int grib2_index_build(const char * filename, const char * index_filename)
+{
+	mapped_file_t grib;
+	grib2_index_entry_t * entries;
+	unsigned char * groups = NULL;
+	size_t groups_size = 0;
+	size_t num;
+	char * name;
+	int rc;
+
+	if (filename == NULL) {
+		return -1;
+	}
+	name = (index_filename == NULL) ? index_name(filename) : (char *)index_filename;
+	if (name == NULL || mapped_file_open(&grib, filename) != 0) {
+		if (name != index_filename) free(name);
+		return -1;
+	}
+	mapped_file_random(&grib); /* only the data of complex packed fields is read */
+	rc = build_entries(&grib, &entries, &num);
+	if (rc == 0) {
+		rc = build_groups(&grib, entries, num, &groups, &groups_size);
+	}
+	if (rc == 0) {
+		rc = write_index(name, &grib, entries, num, groups, groups_size);
+	}
+	free(groups);
+	free(entries);
+	mapped_file_close(&grib);
+	if (name != index_filename) free(name);
+	return rc;
+}
+
+/* Opens a GRIB2 file for random access through its index. The index file is
+ * used if it is up to date, otherwise it is built and written. If the index
+ * file cannot be written (e.g. a read only directory), the index is kept in
+ * memory.
+ *
+ * @param[out] idx The index.
+ * @param[in] filename Name of the GRIB2 file.
+ * @retval 0 Success
+ * @retval -1 Failure
+ */
+int grib2_index_open(grib2_index_t * idx, const char * filename)
+{
+	char * name;
+
+	if (idx == NULL || filename == NULL) {
+		return -1;
+	}
+	memset(idx, 0, sizeof(grib2_index_t));
+	if (mapped_file_open(&idx->grib, filename) != 0) {
+		return -1;
+	}
+	mapped_file_random(&idx->grib);
+
+	name = index_name(filename);
+	if (name == NULL) {
+		grib2_index_close(idx);
+		return -1;
+	}
+	if (map_index(idx, name) != 0) {
+		if (build_entries(&idx->grib, &idx->built, &idx->num_entries) != 0
+			|| build_groups(&idx->grib, idx->built, idx->num_entries, &idx->built_groups, &idx->groups_size) != 0) {
+			free(name);
+			grib2_index_close(idx);
+			return -1;
+		}
+		idx->entries = idx->built;
+		idx->groups = idx->built_groups;
+		write_index(name, &idx->grib, idx->built, idx->num_entries, idx->built_groups, idx->groups_size);
+	}
+	free(name);
+	return 0;
+}
+
+/* Closes the index and the GRIB2 file. All messages unpacked through the
+ * index become invalid. */
+void grib2_index_close(grib2_index_t * idx)
+{
+	if (idx == NULL) return;
+	mapped_file_close(&idx->idx);
+	mapped_file_close(&idx->grib);
+	free(idx->built);
+	free(idx->built_groups);
+	idx->built = NULL;
+	idx->built_groups = NULL;
+	idx->entries = NULL;
+	idx->num_entries = 0;
+	idx->groups = NULL;
+	idx->groups_size = 0;
+}
+
+/* Searches the next field matching the specified metadata. Every criterion
+ * may be -1 to match all fields, the level value is only compared if the
+ * level type is specified.
+ *
+ * @param[in] idx The index.
+ * @param[in] start Number of the entry to start the search at.
+ * @param[in] disc Discipline.
+ * @param[in] param_cat Parameter category.
+ * @param[in] param_num Parameter number.
+ * @param[in] lvl1_type Type of the first fixed surface.
+ * @param[in] lvl1 Value of the first fixed surface.
+ * @return Number of the entry found, -1 if there is none.
+ */
+long grib2_index_find(const grib2_index_t * idx, size_t start, int disc, int param_cat, int param_num, int lvl1_type, double lvl1)
+{
+	const grib2_index_entry_t * e;
+	size_t n;
+
+	if (idx == NULL) return -1;
+	for (n = start; n < idx->num_entries; n++) {
+		e = &idx->entries[n];
+		if (disc >= 0 && e->disc != disc) continue;
+		if (param_cat >= 0 && e->param_cat != param_cat) continue;
+		if (param_num >= 0 && e->param_num != param_num) continue;
+		if (lvl1_type >= 0) {
+			if (e->lvl1_type != lvl1_type) continue;
+			if (fabs(e->lvl1 - lvl1) > 1.0e-6 * fabs(lvl1)) continue;
+		}
+		return (long)n;
+	}
+	return -1;
+}
+
+/* Unpacks a field found in the index. Only the message of the field is read,
+ * see grib2_unpack_field(). Like grib2_unpack(), the buffer of the message
+ * must be NULL on the first call. The group index of a complex packed field
+ * is set for the grid, it remains valid until the index is closed.
+ *
+ * @param[inout] grib The message, containing only the field on return.
+ * @param[in] idx The index.
+ * @param[in] n Number of the entry.
+ * @retval 0 Success
+ * @retval -1 Failure
+ */
+int grib2_index_unpack(GRIBMessage * grib, const grib2_index_t * idx, size_t n)
+{
+	const grib2_index_entry_t * e;
+	const GRIB2GroupIndex * groups;
+	int sec_offset[8];
+	int s;
+
+	if (grib == NULL || idx == NULL || n >= idx->num_entries) {
+		return -1;
+	}
+	e = &idx->entries[n];
+	if (e->msg_offset + e->msg_len > idx->grib.len) {
+		return -1;
+	}
+	for (s = 0; s < 8; s++) {
+		sec_offset[s] = (int)e->sec_offset[s];
+	}
+	if (grib2_unpack_field(grib, idx->grib.data, idx->grib.len, (size_t)e->msg_offset, sec_offset) != 0) {
+		return -1;
+	}
+	if (e->has_groups && e->groups_offset + sizeof(GRIB2GroupIndex) <= idx->groups_size) {
+		groups = (const GRIB2GroupIndex *)(idx->groups + e->groups_offset);
+		if (e->groups_offset + sizeof(GRIB2GroupIndex) + (size_t)groups->num_groups * sizeof(GRIB2Group) <= idx->groups_size) {
+			grib->grids[0].groups = groups;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,78 @@
+#ifndef __GRIB2_INDEX__H__
+#define __GRIB2_INDEX__H__
+
+#include <grib2.h>
+#include <mapped_file.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Suffix appended to the name of a GRIB2 file to get the name of its index. */
+#define GRIB2_INDEX_SUFFIX ".gidx"
+
+#define GRIB2_INDEX_MAGIC 0x58444947 /* "GIDX", written in native byte order */
+#define GRIB2_INDEX_VERSION 2
+
+/* Header of an index file, followed by 'num_entries' entries and the group
+ * indices of all complex packed fields. The file is written in native byte
+ * order, an index of another byte order does not match the magic and is
+ * rebuilt. */
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t entry_size; /* sizeof(grib2_index_entry_t) */
+	uint32_t num_entries;
+	uint64_t src_size; /* size of the GRIB2 file the index was built from */
+	int64_t src_mtime; /* modification time of the GRIB2 file the index was built from */
+	uint64_t groups_size; /* size of the group indices following the entries */
+} grib2_index_header_t;
+
+/* One entry per field (data section) of the GRIB2 file. */
+typedef struct {
+	uint64_t msg_offset; /* offset of the message within the file */
+	uint32_t msg_len; /* total length of the message */
+	uint64_t groups_offset; /* offset of the group index of the field, relative to the group indices, see has_groups */
+	uint32_t sec_offset[8]; /* offsets of the sections in effect for the field, relative to the message */
+	double lvl1;
+	double lvl2;
+	int32_t fcst_time;
+	int32_t time; /* reference time, hhmmss */
+	uint16_t yr;
+	uint16_t field; /* number of the field within the message */
+	uint16_t drs_templ_num;
+	uint8_t mo;
+	uint8_t dy;
+	uint8_t disc;
+	uint8_t param_cat;
+	uint8_t param_num;
+	uint8_t lvl1_type;
+	uint8_t lvl2_type;
+	uint8_t time_unit;
+	uint8_t pack_width;
+	uint8_t has_groups; /* complex packed field with a group index, see GRIB2GroupIndex */
+} grib2_index_entry_t;
+
+typedef struct {
+	mapped_file_t grib; /* the GRIB2 file */
+	mapped_file_t idx; /* the index file, not mapped if the index could not be written */
+	grib2_index_entry_t * built; /* entries built in memory if the index file could not be written */
+	unsigned char * built_groups; /* group indices built in memory if the index file could not be written */
+	const grib2_index_entry_t * entries;
+	size_t num_entries;
+	const unsigned char * groups; /* group indices of the complex packed fields */
+	size_t groups_size;
+} grib2_index_t;
+
+int grib2_index_build(const char * filename, const char * index_filename);
+int grib2_index_open(grib2_index_t * idx, const char * filename);
+void grib2_index_close(grib2_index_t * idx);
+long grib2_index_find(const grib2_index_t * idx, size_t start, int disc, int param_cat, int param_num, int lvl1_type, double lvl1);
+int grib2_index_unpack(GRIBMessage * grib, const grib2_index_t * idx, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,161 @@
+#include <grib2_parallel.h>
+#include <grib2_unpack.h>
+#include <workpool.h>
+#include <scan.h>
+#include <scale.h>
+#include <jpeg2000.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Unpacks the messages of a block of memory in parallel, see workpool.c.
+ * The message boundaries are determined first, every message is a task. */
+
+typedef struct {
+	const unsigned char * buf;
+	size_t len;
+	const size_t * offsets;
+	GRIBMessage * slots;
+	int (*func)(GRIBMessage *, size_t, void *);
+	void * ptr;
+} grib2_parallel_t;
+
+/* Unpacks a message and all of its grids into a slot. */
+static int grib2_parallel_run(void * ptr, size_t task, size_t slot) /* {{{ */
+{
+	grib2_parallel_t * p = (grib2_parallel_t *)ptr;
+	GRIBMessage * grib = &p->slots[slot];
+	size_t cursor = p->offsets[task];
+	int n;
+
+	if (grib2_unpack_from_memory(grib, p->buf, p->len, &cursor) != 0) {
+		return -1;
+	}
+	for (n = 0; n < grib->num_grids; n++) {
+		if (grib2_grid_values(grib, n) == NULL) {
+			return -1;
+		}
+	}
+	return 0;
+} /* }}} */
+
+static int grib2_parallel_emit(void * ptr, size_t task, size_t slot) /* {{{ */
+{
+	grib2_parallel_t * p = (grib2_parallel_t *)ptr;
+
+	return p->func(&p->slots[slot], task, p->ptr);
+} /* }}} */
+
+/* Determines the positions of all messages within the memory. Messages which
+ * are truncated or have no end section are skipped.
+ *
+ * @param[in] buf Memory containing GRIB2 messages.
+ * @param[in] len Size of the memory in bytes.
+ * @param[out] offsets Offsets of the messages, to be released with free().
+ * @param[out] num Number of messages.
+ * @retval 0 Success
+ * @retval -1 Failure
+ */
+int grib2_frame_messages(const unsigned char * buf, size_t len, size_t ** offsets, size_t * num)
+{
+	size_t cursor = 0;
+	size_t cap = 0;
+	size_t pos;
+	size_t total;
+	size_t * p;
+
+	if (buf == NULL || offsets == NULL || num == NULL) {
+		return -1;
+	}
+	*offsets = NULL;
+	*num = 0;
+	while (cursor < len) {
+		pos = cursor + grib_find_message(buf + cursor, len - cursor, 2);
+		if (pos + 16 > len) break;
+		total = ((size_t)buf[pos + 12] << 24) | ((size_t)buf[pos + 13] << 16) | ((size_t)buf[pos + 14] << 8) | (size_t)buf[pos + 15];
+		if (total < 20 || total > len - pos || memcmp(buf + pos + total - 4, "7777", 4) != 0) {
+			cursor = pos + 4;
+			continue;
+		}
+		if (*num == cap) {
+			cap = (cap == 0) ? 256 : cap * 2;
+			p = (size_t *)realloc(*offsets, cap * sizeof(size_t));
+			if (p == NULL) {
+				fprintf(stderr, "Error: cannot allocate memory for the messages\n");
+				free(*offsets);
+				*offsets = NULL;
+				*num = 0;
+				return -1;
+			}
+			*offsets = p;
+		}
+		(*offsets)[(*num)++] = pos;
+		cursor = pos + total;
+	}
+	return 0;
+}
+
+/* Unpacks all GRIB2 messages found in memory on a pool of threads. Every
+ * message is passed to the function with all gridpoints unpacked, the
+ * function is never called concurrently. The message is only valid during
+ * the call. A message which cannot be unpacked aborts the run, the messages
+ * unpacked but not passed yet are dropped.
+ *
+ * Every JPEG2000 code stream and every field is decoded by a single thread
+ * while the pool runs (see jpeg2000_threads() and unpack_split_threads()),
+ * the previous settings are restored afterwards.
+ *
+ * @param[in] buf Memory containing GRIB2 messages, e.g. a mapped file.
+ * @param[in] len Size of the memory in bytes.
+ * @param[in] num_threads Number of threads, 0 for one per processor.
+ * @param[in] ordered Pass the messages in the order of the memory, otherwise
+ *     in the order they are unpacked.
+ * @param[in] func Function receiving the messages and their number, returns 0
+ *     to continue, everything else aborts.
+ * @param[in] ptr Pointer passed to the function.
+ * @retval 0 Success
+ * @retval -1 Failure, a message cannot be unpacked, or aborted by the function
+ */
+int grib2_unpack_parallel(const unsigned char * buf, size_t len, unsigned int num_threads, int ordered, int (*func)(GRIBMessage * grib, size_t n, void * ptr), void * ptr)
+{
+	grib2_parallel_t p;
+	size_t * offsets;
+	size_t num;
+	size_t num_slots;
+	size_t i;
+	unsigned int jpc_threads;
+	unsigned int split_threads;
+	int rc;
+
+	if (func == NULL || grib2_frame_messages(buf, len, &offsets, &num) != 0) {
+		return -1;
+	}
+
+	num_slots = workpool_slots(num_threads, ordered);
+	p.slots = (GRIBMessage *)malloc(num_slots * sizeof(GRIBMessage));
+	if (p.slots == NULL) {
+		free(offsets);
+		return -1;
+	}
+	for (i = 0; i < num_slots; ++i) {
+		p.slots[i].buffer = NULL;
+	}
+	p.buf = buf;
+	p.len = len;
+	p.offsets = offsets;
+	p.func = func;
+	p.ptr = ptr;
+
+	/* the messages are decoded in parallel, not the code streams or fields */
+	jpc_threads = jpeg2000_threads(1);
+	split_threads = unpack_split_threads(1);
+	rc = workpool_run(num, num_threads, ordered, grib2_parallel_run, grib2_parallel_emit, &p);
+	unpack_split_threads(split_threads);
+	jpeg2000_threads(jpc_threads);
+
+	for (i = 0; i < num_slots; ++i) {
+		grib2_free(&p.slots[i]);
+	}
+	free(p.slots);
+	free(offsets);
+	return rc;
+}
@@ -0,0 +1,17 @@
+#ifndef __GRIB2_PARALLEL__H__
+#define __GRIB2_PARALLEL__H__
+
+#include <grib2.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int grib2_frame_messages(const unsigned char * buf, size_t len, size_t ** offsets, size_t * num);
+int grib2_unpack_parallel(const unsigned char * buf, size_t len, unsigned int num_threads, int ordered, int (*func)(GRIBMessage * grib, size_t n, void * ptr), void * ptr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,82 +1,29 @@
 #include <grib2_unpack.h>
 #include <bits.h>
-#include <jasper/jasper.h>
+#include <scale.h>
+#include <scan.h>
+#include <jpeg2000.h>
+#include <png_unpack.h>
+#include <complex_unpack.h>
+#include <ieee_float.h>
+#include <ccsds.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
 
 #define UNUSED_ARG(a) (void)(a)
 
-static int dec_jpeg2000(char * injpc, int bufsize, int * outfld) /* {{{ */
-{
-	int ier;
-	int i;
-	int j;
-	int k;
-	jas_image_t * image = NULL;
-	jas_stream_t * jpcstream = NULL;
-	jas_image_cmpt_t * pcmpt = NULL;
-	char * opts = NULL;
-	jas_matrix_t * data = NULL;
-
-	/*
-	jas_init();
-	*/
-
-	ier = 0;
-
-	/*   
-	Create jas_stream_t containing input JPEG200 codestream in memory.
-	*/       
-
-	jpcstream = jas_stream_memopen(injpc, bufsize);
-
-	/*   
-	Decode JPEG200 codestream into jas_image_t structure.
-	*/       
-	image = jpc_decode(jpcstream, opts);
-	if (image == 0) {
-		printf(" jpc_decode return = %d \n", ier);
-		return -3;
-	}
-
-	pcmpt = image->cmpts_[0];
-
-	/*
-	Expecting jpeg2000 image to be grayscale only.
-	No color components.
-	*/
-	if (image->numcmpts_ != 1 ) {
-		printf("dec_jpeg2000: Found color image. Grayscale expected.\n");
-		return -5;
-	}
+/* Initial size of the memory messages read from streams are kept in. */
+#define GRIB2_MIN_STORAGE (64 * 1024)
 
-	/*
-	Create a data matrix of grayscale image values decoded from
-	the jpeg2000 codestream.
-	*/
-	data = jas_matrix_create(jas_image_height(image), jas_image_width(image));
-	jas_image_readcmpt(image, 0, 0, 0, jas_image_width(image), jas_image_height(image), data);
-
-	/*
-	Copy data matrix to output integer array.
-	*/
-	k = 0;
-	for (i = 0;i < pcmpt->height_; i++) {
-		for (j = 0;j < pcmpt->width_; j++) {
-			outfld[k++] = data->rows_[i][j];
-		}
-	}
+/* Size of the window in bytes the data sections are read through in streaming mode. */
+#define GRIB2_STREAM_WINDOW (64 * 1024)
 
-	/*
-	Clean up JasPer work structures.
-	*/
-	jas_matrix_destroy(data);
-	ier = jas_stream_close(jpcstream);
-	jas_image_destroy(image);
+/* Number of gridpoints passed at once to the callback in streaming mode. */
+#define GRIB2_STREAM_CHUNK 4096
 
-	return 0;
-} /* }}} */
+/* Tolerance, in gridpoints, of the edges of an area. */
+#define GRIB2_AREA_EPS 1.e-6
 
 static int grib2_unpackIDS(GRIBMessage * grib_msg) /* {{{ */
 {
@@ -441,21 +388,15 @@ static int grib2_unpackPDS(GRIBMessage * grib_msg) /* {{{ */
 
 					/* number of values missing from process */
 					get_bits(grib_msg->buffer,&grib_msg->md.stat_proc.nmiss,grib_msg->offset+start+64,32);
-					if (grib_msg->md.stat_proc.proc_code != NULL) {
-						free(grib_msg->md.stat_proc.proc_code);
-						free(grib_msg->md.stat_proc.incr_type);
-						free(grib_msg->md.stat_proc.time_unit);
-						free(grib_msg->md.stat_proc.time_length);
-						free(grib_msg->md.stat_proc.incr_unit);
-						free(grib_msg->md.stat_proc.incr_length);
-						grib_msg->md.stat_proc.proc_code = NULL;
+					grib_msg->md.stat_proc.proc_code = (int *)arena_alloc(&grib_msg->arena, grib_msg->md.stat_proc.num_ranges * 6 * sizeof(int));
+					if (grib_msg->md.stat_proc.proc_code == NULL) {
+						return -1;
 					}
-					grib_msg->md.stat_proc.proc_code=(int *)malloc(grib_msg->md.stat_proc.num_ranges*sizeof(int));
-					grib_msg->md.stat_proc.incr_type=(int *)malloc(grib_msg->md.stat_proc.num_ranges*sizeof(int));
-					grib_msg->md.stat_proc.time_unit=(int *)malloc(grib_msg->md.stat_proc.num_ranges*sizeof(int));
-					grib_msg->md.stat_proc.time_length=(int *)malloc(grib_msg->md.stat_proc.num_ranges*sizeof(int));
-					grib_msg->md.stat_proc.incr_unit=(int *)malloc(grib_msg->md.stat_proc.num_ranges*sizeof(int));
-					grib_msg->md.stat_proc.incr_length=(int *)malloc(grib_msg->md.stat_proc.num_ranges*sizeof(int));
+					grib_msg->md.stat_proc.incr_type = grib_msg->md.stat_proc.proc_code + grib_msg->md.stat_proc.num_ranges;
+					grib_msg->md.stat_proc.time_unit = grib_msg->md.stat_proc.incr_type + grib_msg->md.stat_proc.num_ranges;
+					grib_msg->md.stat_proc.time_length = grib_msg->md.stat_proc.time_unit + grib_msg->md.stat_proc.num_ranges;
+					grib_msg->md.stat_proc.incr_unit = grib_msg->md.stat_proc.time_length + grib_msg->md.stat_proc.num_ranges;
+					grib_msg->md.stat_proc.incr_length = grib_msg->md.stat_proc.incr_unit + grib_msg->md.stat_proc.num_ranges;
 					off = start + 96;
 					for (n = 0; n < grib_msg->md.stat_proc.num_ranges; n++) {
 						get_bits(grib_msg->buffer,&grib_msg->md.stat_proc.proc_code[n],grib_msg->offset+off,8);
@@ -490,6 +431,8 @@ static int grib2_unpackDRS(GRIBMessage * grib) /* {{{ */
 		case 0:
 		case 40:
 		case 40000:
+		case 41:
+		case 42:
 			get_bits(grib->buffer, (int *)&grib->md.R,grib->offset + 88, 32);
 			get_bits(grib->buffer, &sign, grib->offset + 120, 1);
 			get_bits(grib->buffer, &value, grib->offset + 121, 15);
@@ -505,6 +448,67 @@ static int grib2_unpackDRS(GRIBMessage * grib) /* {{{ */
 			grib->md.D = value;
 			grib->md.R /= pow(10.0, grib->md.D);
 			get_bits(grib->buffer, &grib->md.pack_width, grib->offset + 152, 8);
+			if (grib->md.drs_templ_num == 42) {
+				get_bits(grib->buffer, &grib->md.ccsds.flags, grib->offset + 168, 8);
+				get_bits(grib->buffer, &grib->md.ccsds.block_size, grib->offset + 176, 8);
+				get_bits(grib->buffer, &grib->md.ccsds.rsi, grib->offset + 184, 16);
+			}
+			break;
+
+		case 2:
+		case 3:
+			get_bits(grib->buffer, (int *)&grib->md.R,grib->offset + 88, 32);
+			get_bits(grib->buffer, &sign, grib->offset + 120, 1);
+			get_bits(grib->buffer, &value, grib->offset + 121, 15);
+			if (sign == 1) {
+				value = -value;
+			}
+			grib->md.E = value;
+			get_bits(grib->buffer,&sign,grib->offset+136,1);
+			get_bits(grib->buffer,&value,grib->offset+137,15);
+			if (sign == 1) {
+				value = -value;
+			}
+			grib->md.D = value;
+			grib->md.R /= pow(10.0, grib->md.D);
+			get_bits(grib->buffer, &grib->md.pack_width, grib->offset + 152, 8);
+			/* group splitting and missing value management */
+			get_bits(grib->buffer, &grib->md.complex_pack.split_method, grib->offset + 168, 8);
+			get_bits(grib->buffer, &grib->md.complex_pack.miss_mgmt, grib->offset + 176, 8);
+			get_bits(grib->buffer, (int *)&grib->md.complex_pack.primary_miss, grib->offset + 184, 32);
+			get_bits(grib->buffer, (int *)&grib->md.complex_pack.secondary_miss, grib->offset + 216, 32);
+			/* groups */
+			get_bits(grib->buffer, &grib->md.complex_pack.num_groups, grib->offset + 248, 32);
+			get_bits(grib->buffer, &grib->md.complex_pack.ref_width, grib->offset + 280, 8);
+			get_bits(grib->buffer, &grib->md.complex_pack.width_bits, grib->offset + 288, 8);
+			get_bits(grib->buffer, &grib->md.complex_pack.ref_length, grib->offset + 296, 32);
+			get_bits(grib->buffer, &grib->md.complex_pack.length_incr, grib->offset + 328, 8);
+			get_bits(grib->buffer, &grib->md.complex_pack.last_length, grib->offset + 336, 32);
+			get_bits(grib->buffer, &grib->md.complex_pack.length_bits, grib->offset + 368, 8);
+			/* spatial differencing */
+			grib->md.complex_pack.order = 0;
+			grib->md.complex_pack.num_octets = 0;
+			if (grib->md.drs_templ_num == 3) {
+				get_bits(grib->buffer, &grib->md.complex_pack.order, grib->offset + 376, 8);
+				get_bits(grib->buffer, &grib->md.complex_pack.num_octets, grib->offset + 384, 8);
+				if (grib->md.complex_pack.order != 1 && grib->md.complex_pack.order != 2) {
+					fprintf(stderr,"Spatial differencing of order %d is not understood\n",grib->md.complex_pack.order);
+					return -1;
+				}
+			}
+			break;
+
+		case 4:
+			/* the values are not scaled */
+			grib->md.R = 0.0;
+			grib->md.E = 0;
+			grib->md.D = 0;
+			get_bits(grib->buffer, &grib->md.precision, grib->offset + 88, 8);
+			if (grib->md.precision != 1 && grib->md.precision != 2) {
+				fprintf(stderr,"IEEE precision %d is not understood\n",grib->md.precision);
+				return -1;
+			}
+			grib->md.pack_width = (grib->md.precision == 1) ? 32 : 64;
 			break;
 
 		default:
@@ -527,7 +531,10 @@ static int grib2_unpackBMS(GRIBMessage * grib) /* {{{ */
 		case 0:
 			get_bits(grib->buffer, &len, grib->offset, 32);
 			len = (len - 6) * 8;
-			grib->md.bitmap = (unsigned char *)malloc(len * sizeof(unsigned char));
+			grib->md.bitmap = (unsigned char *)arena_alloc(&grib->arena, len * sizeof(unsigned char));
+			if (grib->md.bitmap == NULL) {
+				return -1;
+			}
 			for (n = 0; n < len; n++) {
 				get_bits(grib->buffer, &bit, grib->offset + 48 + n, 1);
 				grib->md.bitmap[n] = bit;
@@ -545,130 +552,174 @@ static int grib2_unpackBMS(GRIBMessage * grib) /* {{{ */
 	return 0;
 } /* }}} */
 
-static int grib2_unpackDS(GRIBMessage * grib, int grid_num) /* {{{ */
+/* Unpacks the gridpoints of a grid from its data section, the position of the
+ * data section and all information needed are part of the metadata of the grid. */
+static int grib2_unpackDS(const unsigned char * buffer, GRIBMessage * grib, GRIB2Grid * grid) /* {{{ */
 {
-	int off;
-	int n;
-	int pval;
+	const GRIBMetadata * md = &grid->md;
+	size_t off;
+	int num_points;
 	int len;
-	int * jvals;
-	int cnt;
+	double scale;
+
+	off = (size_t)md->sec_offset[7] * 8 + 40;
+	num_points = md->ny * md->nx;
 
-	off = grib->offset + 40;
-	switch (grib->md.drs_templ_num) { /* see table 5.0 */
+	/* the reference value is already scaled by 10^-D, see grib2_unpackDRS */
+	scale = pow(2.0, md->E) / pow(10.0, md->D);
+
+	switch (md->drs_templ_num) { /* see table 5.0 */
 		case 0: /* Grid Point Data - Simple Packaging */
-			(grib->grids[grid_num]).gridpoints=(double *)malloc(grib->md.ny * grib->md.nx * sizeof(double));
-			for (n=0; n < grib->md.ny * grib->md.nx; n++) {
-				if (grib->md.bitmap == NULL || grib->md.bitmap[n] == 1) {
-					get_bits(grib->buffer, &pval, off, grib->md.pack_width);
-					grib->grids[grid_num].gridpoints[n] = grib->md.R+pval * pow(2.0, grib->md.E) / pow(10.0, grib->md.D);
-					off += grib->md.pack_width;
-				} else {
-					grib->grids[grid_num].gridpoints[n] = GRIB_MISSING_VALUE;
-				}
+			grid->gridpoints = (double *)arena_alloc(&grib->arena, num_points * sizeof(double));
+			if (grid->gridpoints == NULL) {
+				return -1;
+			}
+			if (unpack_scaled_split(buffer, &off, md->pack_width, md->R, scale,
+				md->bitmap, num_points, grid->gridpoints) != 0) {
+				return -1;
+			}
+			break;
+
+		case 2: /* Grid Point Data - Complex Packing */
+		case 3: /* Grid Point Data - Complex Packing and Spatial Differencing */
+			get_bits(buffer, &len, md->sec_offset[7] * 8, 32);
+			grid->gridpoints = (double *)arena_alloc(&grib->arena, num_points * sizeof(double));
+			if (grid->gridpoints == NULL) {
+				return -1;
+			}
+			if (unpack_complex(&buffer[md->sec_offset[7]], (len > 0) ? (size_t)len : 0, md,
+				scale, num_points, grid->gridpoints) != 0) {
+				return -1;
+			}
+			break;
+
+		case 4: /* Grid Point Data - IEEE Floating Point Data */
+			get_bits(buffer, &len, md->sec_offset[7] * 8, 32);
+			len = len - 5;
+			grid->gridpoints = (double *)arena_alloc(&grib->arena, num_points * sizeof(double));
+			if (grid->gridpoints == NULL) {
+				return -1;
+			}
+			if (unpack_ieee(&buffer[md->sec_offset[7] + 5], (len > 0) ? (size_t)len : 0, md->precision,
+				grid->swapped, md->bitmap, num_points, grid->gridpoints) != 0) {
+				return -1;
 			}
 			break;
 
 		case 40: /* Grid Point Data - JPEG2000 Compression */
 		case 40000:
-			get_bits(grib->buffer, &len,grib->offset, 32);
+			get_bits(buffer, &len, md->sec_offset[7] * 8, 32);
 			len = len - 5;
-			jvals = (int *)malloc(grib->md.ny * grib->md.nx * sizeof(int));
-			(grib->grids[grid_num]).gridpoints = (double *)malloc(grib->md.ny * grib->md.nx * sizeof(double));
-			if (len > 0) {
-				dec_jpeg2000((char *)&grib->buffer[grib->offset / 8 + 5], len, jvals);
-			}
-			cnt = 0;
-			for (n = 0; n < grib->md.ny * grib->md.nx; n++) {
-				if (grib->md.bitmap == NULL || grib->md.bitmap[n] == 1) {
-					if (len == 0) {
-						jvals[cnt] = 0;
-					}
-					grib->grids[grid_num].gridpoints[n] = grib->md.R
-						+ jvals[cnt++] * pow(2.0, grib->md.E) / pow(10.0, grib->md.D);
-				} else {
-					grib->grids[grid_num].gridpoints[n] = GRIB_MISSING_VALUE;
-				}
+			grid->gridpoints = (double *)arena_alloc(&grib->arena, num_points * sizeof(double));
+			if (grid->gridpoints == NULL) {
+				return -1;
+			}
+			jpeg2000_decode(NULL, &grib->jpc_state, &buffer[md->sec_offset[7] + 5], (len > 0) ? (size_t)len : 0,
+				md->R, scale, md->bitmap, num_points, grid->gridpoints);
+			break;
+
+		case 41: /* Grid Point Data - PNG Compression */
+			get_bits(buffer, &len, md->sec_offset[7] * 8, 32);
+			len = len - 5;
+			grid->gridpoints = (double *)arena_alloc(&grib->arena, num_points * sizeof(double));
+			if (grid->gridpoints == NULL) {
+				return -1;
+			}
+			if (unpack_png(&buffer[md->sec_offset[7] + 5], (len > 0) ? (size_t)len : 0, md->pack_width,
+				md->R, scale, md->bitmap, num_points, grid->gridpoints) != 0) {
+				return -1;
+			}
+			break;
+
+		case 42: /* Grid Point Data - CCSDS Recommended Lossless Compression */
+			get_bits(buffer, &len, md->sec_offset[7] * 8, 32);
+			len = len - 5;
+			grid->gridpoints = (double *)arena_alloc(&grib->arena, num_points * sizeof(double));
+			if (grid->gridpoints == NULL) {
+				return -1;
+			}
+			if (unpack_ccsds(&buffer[md->sec_offset[7] + 5], (len > 0) ? (size_t)len : 0, md->pack_width,
+				md->ccsds.flags, md->ccsds.block_size, md->ccsds.rsi,
+				md->R, scale, md->bitmap, num_points, grid->gridpoints) != 0) {
+				return -1;
 			}
-			free(jvals);
 			break;
 	}
 
 	return 0;
 } /* }}} */
 
+/* Reads from the stream until the window of 16 bytes contains the complete
+ * indicator section of a GRIB2 message. The stream is read in blocks of up to
+ * 16 bytes, never beyond the indicator section of the message found. */
 static int search_next_message(unsigned char * temp, int (*read_func)(void * buf, unsigned int len, void * ptr), void * ptr)
 {
-	int n;
+	size_t have = 0; /* number of valid bytes within the window */
+	size_t k;
 
-	while (strncmp((const char *)temp, "GRIB", 4) != 0) {
-		if (temp[1] == 'G') {
-			for (n = 0; n < 3; n++) temp[n] = temp[n+1];
-			if (read_func(&temp[3], 1, ptr) <= 0) return -1;
-			continue;
+	for (;;) {
+		if (have < 16) {
+			if (read_func(&temp[have], 16 - have, ptr) != (int)(16 - have)) return -1;
+			have = 16;
 		}
-
-		if (temp[2] == 'G') {
-			for (n = 0; n < 2; n++) temp[n] = temp[n+2];
-			if (read_func(&temp[2], 2, ptr) <= 0) return -1;
-			continue;
+		k = grib_find_message(temp, 16, 2);
+		if (k == 0) return 0;
+		if (k == 16) {
+			/* no candidate with a complete header, keep the bytes which may start one */
+			k = 16 - (GRIB_SCAN_HEADER - 1);
 		}
-
-		if (temp[3] == 'G') {
-			for (n = 0; n < 1; n++) temp[n] = temp[n+3];
-			if (read_func(&temp[1], 3, ptr) <= 0) return -1;
-			continue;
-		}
-
-		if (read_func(temp, 4, ptr) <= 0) return -1;
+		memmove(temp, &temp[k], 16 - k);
+		have = 16 - k;
 	}
-	return 0;
 }
 
+/* Releases the data of the previous message, the memory is kept for the next
+ * one. The first call is recognized by a NULL buffer, all other pointers are
+ * not initialized at this point. From then on the buffer is never NULL. */
+static void grib2_release(GRIBMessage * grib_msg) /* {{{ */
+{
+	if (grib_msg->buffer == NULL) {
+		grib_msg->storage.data = NULL;
+		grib_msg->storage.size = 0;
+		arena_init(&grib_msg->arena);
+		grib_msg->jpc_state = NULL;
+		pool_reserve(&grib_msg->storage, GRIB2_MIN_STORAGE);
+	} else {
+		arena_reset(&grib_msg->arena);
+	}
+	grib_msg->buffer = (unsigned char *)grib_msg->storage.data;
+	grib_msg->grids = NULL;
+	grib_msg->num_grids = 0;
+	grib_msg->md.bitmap = NULL;
+	grib_msg->md.stat_proc.proc_code = NULL;
+} /* }}} */
+
+/* Unpacks the first 16 octets of the indicator section. */
+static void grib2_unpackIS_header(GRIBMessage * grib_msg, const unsigned char * is) /* {{{ */
+{
+	get_bits(is, &grib_msg->disc, 48, 8);
+	get_bits(is, &grib_msg->ed_num, 56, 8);
+	get_bits(is, &grib_msg->total_len, 96, 32);
+	grib_msg->md.nx = grib_msg->md.ny = 0;
+} /* }}} */
+
 static int grib2_unpackIS(GRIBMessage * grib_msg, int (*read_func)(void * buf, unsigned int len, void * ptr), void * ptr) /* {{{ */
 {
 	unsigned char temp[16];
 	int status;
-	int n;
 	size_t num;
 
-	if (grib_msg->buffer != NULL) {
-		free(grib_msg->buffer);
-		grib_msg->buffer = NULL;
-	} else {
-		grib_msg->grids = NULL;
-		grib_msg->md.stat_proc.proc_code = NULL;
-	}
-	if (grib_msg->grids != NULL) {
-		for (n = 0; n < grib_msg->num_grids; n++) {
-			if (grib_msg->grids[n].md.bitmap != NULL) {
-				free(grib_msg->grids[n].md.bitmap);
-				grib_msg->grids[n].md.bitmap = NULL;
-			}
-			free(grib_msg->grids[n].gridpoints);
-		}
-		free(grib_msg->grids);
-		grib_msg->grids = NULL;
-	}
-	grib_msg->num_grids = 0;
-
-	if (read_func(temp, 4, ptr) != 4) {
-		return -1;
-	}
+	grib2_release(grib_msg);
 
 	if (search_next_message(temp, read_func, ptr) != 0) {
 		return -1;
 	}
 
-	if (read_func(&temp[4], 12, ptr) == 0) {
+	grib2_unpackIS_header(grib_msg, temp);
+	if (grib_msg->total_len < 20 || pool_reserve(&grib_msg->storage, grib_msg->total_len + 4) == NULL) {
 		return -1;
 	}
-
-	get_bits(temp, &grib_msg->disc, 48, 8);
-	get_bits(temp, &grib_msg->ed_num, 56, 8);
-	get_bits(temp, &grib_msg->total_len, 96, 32);
-	grib_msg->md.nx = grib_msg->md.ny = 0;
-	grib_msg->buffer = (unsigned char *)malloc((grib_msg->total_len + 4) * sizeof(unsigned char));
+	grib_msg->buffer = (unsigned char *)grib_msg->storage.data;
 	memcpy(grib_msg->buffer, temp, 16);
 	num = grib_msg->total_len - 16;
 	status = read_func(&grib_msg->buffer[16], num, ptr);
@@ -684,20 +735,154 @@ static int grib2_unpackIS(GRIBMessage * grib_msg, int (*read_func)(void * buf, u
 	return 0;
 } /* }}} */
 
-int grib2_unpack(GRIBMessage * grib, int (*read_func)(void * buf, unsigned int len, void * ptr), void * ptr)
+/* Same as grib2_unpackIS(), but the data of the data sections is skipped,
+ * using the skip function if there is one. The buffer only holds the other
+ * sections and the first 5 octets (length and number) of every data section,
+ * it grows with the sections read, see grib2_unpack_sections(). */
+static int grib2_unpackIS_metadata(GRIBMessage * grib_msg, int (*read_func)(void * buf, unsigned int len, void * ptr), int (*skip_func)(unsigned int len, void * ptr), void * ptr) /* {{{ */
 {
-	int n;
-	int off;
+	unsigned char temp[16];
+	unsigned char * p;
+	size_t used; /* octets of the buffer in use */
+	int pos; /* offset within the message */
 	int len;
-	int sec_num;
+	int num;
 
-	if (read_func == NULL) {
+	grib2_release(grib_msg);
+
+	if (search_next_message(temp, read_func, ptr) != 0) {
 		return -1;
 	}
 
-	if (grib2_unpackIS(grib, read_func, ptr) != 0) {
+	grib2_unpackIS_header(grib_msg, temp);
+	if (grib_msg->total_len < 20) {
+		return -1;
+	}
+	memcpy(grib_msg->buffer, temp, 16);
+	used = 16;
+
+	for (pos = 16; pos + 4 <= grib_msg->total_len; pos += len) {
+		if (pool_grow(&grib_msg->storage, used + 5) == NULL) {
+			return -1;
+		}
+		grib_msg->buffer = (unsigned char *)grib_msg->storage.data;
+		p = &grib_msg->buffer[used];
+		if (read_func(p, 4, ptr) != 4) {
+			return -1;
+		}
+		if (strncmp((char *)p, "7777", 4) == 0) {
+			break;
+		}
+		get_bits(p, &len, 0, 32);
+		if (len < 5 || len > grib_msg->total_len - pos || read_func(&p[4], 1, ptr) != 1) {
+			return -1;
+		}
+		if (p[4] != 7) {
+			if (pool_grow(&grib_msg->storage, used + len) == NULL) {
+				return -1;
+			}
+			grib_msg->buffer = (unsigned char *)grib_msg->storage.data;
+			if (read_func(&grib_msg->buffer[used + 5], len - 5, ptr) != len - 5) {
+				return -1;
+			}
+			used += len;
+			continue;
+		}
+		used += 5;
+		if (skip_func != NULL) {
+			if (skip_func(len - 5, ptr) != 0) {
+				return -1;
+			}
+			continue;
+		}
+		/* the data is read behind the octets in use and dropped */
+		if (pool_grow(&grib_msg->storage, used + GRIB2_MIN_STORAGE) == NULL) {
+			return -1;
+		}
+		grib_msg->buffer = (unsigned char *)grib_msg->storage.data;
+		for (num = len - 5; num > 0; num -= GRIB2_MIN_STORAGE) {
+			if (read_func(&grib_msg->buffer[used], (num < GRIB2_MIN_STORAGE) ? num : GRIB2_MIN_STORAGE, ptr)
+				!= ((num < GRIB2_MIN_STORAGE) ? num : GRIB2_MIN_STORAGE)) {
+				return -1;
+			}
+		}
+	}
+	if (pos + 4 != grib_msg->total_len) {
+		fprintf(stderr, "Warning: no end section found\n");
+		return -1;
+	}
+	grib_msg->offset = 128;
+	return 0;
+} /* }}} */
+
+/* Same as grib2_unpackIS(), but the message is referenced in place within the
+ * specified memory instead of being copied. */
+static int grib2_unpackIS_memory(GRIBMessage * grib_msg, const unsigned char * buf, size_t len, size_t * cursor) /* {{{ */
+{
+	size_t pos;
+
+	grib2_release(grib_msg);
+
+	pos = *cursor + grib_find_message(buf + *cursor, len - *cursor, 2);
+	if (pos + 16 > len) {
+		*cursor = len;
 		return -1;
 	}
+
+	/* skip this indicator if the message turns out to be unusable */
+	*cursor = pos + 4;
+
+	grib2_unpackIS_header(grib_msg, buf + pos);
+	if (grib_msg->total_len < 20 || (size_t)grib_msg->total_len > len - pos) {
+		fprintf(stderr, "Error: truncated message\n");
+		return -1;
+	}
+	if (memcmp(buf + pos + grib_msg->total_len - 4, "7777", 4) != 0) {
+		fprintf(stderr, "Warning: no end section found\n");
+		return -1;
+	}
+
+	/* the message is only read, never modified */
+	grib_msg->buffer = (unsigned char *)(buf + pos);
+	grib_msg->offset = 128;
+	*cursor = pos + grib_msg->total_len;
+	return 0;
+} /* }}} */
+
+/* Unpacks one of the sections 2 to 6 at the current offset. */
+static int grib2_unpack_section(GRIBMessage * grib, int sec_num) /* {{{ */
+{
+	switch (sec_num) {
+		case 2:
+			return grib2_unpackLUS(grib);
+		case 3:
+			return grib2_unpackGDS(grib);
+		case 4:
+			return grib2_unpackPDS(grib);
+		case 5:
+			return grib2_unpackDRS(grib);
+		case 6:
+			return grib2_unpackBMS(grib);
+	}
+	return 0;
+} /* }}} */
+
+/* Unpacks all sections following the indicator section, except the data of
+ * the data sections. Without data, only the first 5 octets of the data
+ * sections are part of the buffer (see grib2_unpackIS_metadata()) and the
+ * gridpoints are not available; the section offsets remain offsets within
+ * the message. */
+static int grib2_unpack_sections(GRIBMessage * grib, int with_data) /* {{{ */
+{
+	int n;
+	int off;
+	int len;
+	int sec_num;
+	int skipped = 0; /* octets of the message in front of the offset not within the buffer */
+
+	grib->has_data = with_data;
+	memset(grib->md.sec_offset, 0, sizeof(grib->md.sec_offset));
+	grib->md.sec_offset[1] = grib->offset / 8;
 	if (grib2_unpackIDS(grib) != 0) {
 		return -1;
 	}
@@ -709,50 +894,786 @@ int grib2_unpack(GRIBMessage * grib, int (*read_func)(void * buf, unsigned int l
 		get_bits(grib->buffer, &sec_num, off + 32, 8);
 		if (sec_num == 7) {
 			grib->num_grids++;
+			if (!with_data) {
+				len = 5;
+			}
 		}
 		off += len * 8;
 	}
-	grib->grids = (GRIB2Grid *)malloc(grib->num_grids * sizeof(GRIB2Grid));
+	grib->grids = (GRIB2Grid *)arena_alloc(&grib->arena, grib->num_grids * sizeof(GRIB2Grid));
+	if (grib->grids == NULL) {
+		return -1;
+	}
 	n = 0;
 	while (strncmp(&((char *)grib->buffer)[grib->offset/8], "7777", 4) != 0) {
 		get_bits(grib->buffer, &len, grib->offset, 32);
 		get_bits(grib->buffer, &sec_num, grib->offset + 32, 8);
+		if (sec_num >= 2 && sec_num <= 7 && !(sec_num == 6 && grib->buffer[grib->offset / 8 + 5] == 254)) {
+			/* a bitmap section referring to the previous bitmap does not replace it */
+			grib->md.sec_offset[sec_num] = grib->offset / 8 + skipped;
+		}
 		switch (sec_num) {
 			case 2:
-				if (grib2_unpackLUS(grib) != 0) {
+			case 3:
+			case 4:
+			case 5:
+			case 6:
+				if (grib2_unpack_section(grib, sec_num) != 0) {
 					return -1;
 				}
 				break;
-			case 3:
-				if (grib2_unpackGDS(grib) != 0) {
-					return -1;
+			case 7:
+				/* the gridpoints are unpacked on demand, see grib2_grid_values() */
+				grib->grids[n].md = grib->md;
+				grib->grids[n].gridpoints = NULL;
+				grib->grids[n].groups = NULL;
+				grib->grids[n].swapped = 0;
+				n++;
+				if (!with_data) {
+					skipped += len - 5;
+					len = 5;
 				}
 				break;
-			case 4:
-				if (grib2_unpackPDS(grib) != 0) {
-					return -1;
+		}
+		grib->offset += len * 8;
+	}
+	return 0;
+} /* }}} */
+
+int grib2_unpack(GRIBMessage * grib, int (*read_func)(void * buf, unsigned int len, void * ptr), void * ptr)
+{
+	if (read_func == NULL) {
+		return -1;
+	}
+
+	if (grib2_unpackIS(grib, read_func, ptr) != 0) {
+		return -1;
+	}
+	return grib2_unpack_sections(grib, 1);
+}
+
+/* Returns the gridpoints of a grid, they are unpacked on the first access.
+ * Grids which are not accessed are never unpacked. The gridpoints belong to
+ * the message, they are released with it.
+ *
+ * @param[inout] grib The message.
+ * @param[in] n Number of the grid within the message.
+ * @return The gridpoints, NULL if they cannot be unpacked or are not available
+ *     (message unpacked by grib2_unpack_metadata()).
+ */
+double * grib2_grid_values(GRIBMessage * grib, int n)
+{
+	GRIB2Grid * grid;
+
+	if (grib == NULL || n < 0 || n >= grib->num_grids) {
+		return NULL;
+	}
+	grid = &grib->grids[n];
+	if (grid->gridpoints == NULL && grib->has_data) {
+		if (grib2_unpackDS(grib->buffer, grib, grid) != 0) {
+			grid->gridpoints = NULL;
+		}
+	}
+	return grid->gridpoints;
+}
+
+/* Returns the range of indices of the points of a regular axis which are
+ * within [v1, v2], limited to the axis. */
+static int grib2_axis_range(double first, double step, int n, double v1, double v2, int * i0, int * i1) /* {{{ */
+{
+	double a = (v1 - first) / step;
+	double b = (v2 - first) / step;
+	double lo = ceil(((a < b) ? a : b) - GRIB2_AREA_EPS);
+	double hi = floor(((a < b) ? b : a) + GRIB2_AREA_EPS);
+
+	if (lo < 0.0) lo = 0.0;
+	if (hi > n - 1) hi = n - 1;
+	if (lo > hi) {
+		return -1;
+	}
+	*i0 = (int)lo;
+	*i1 = (int)hi;
+	return 0;
+} /* }}} */
+
+/* Determines the area of a grid covering a lat/lon box, i.e. the rows and
+ * columns of all gridpoints within the box. Supported are regular lat/lon
+ * grids with rows of consecutive points. The box may span the date line,
+ * it is cut at the first column of the grid.
+ *
+ * @param[in] grid The grid.
+ * @param[in] lat1 Latitude of one edge of the box.
+ * @param[in] lon1 Longitude of the western edge of the box.
+ * @param[in] lat2 Latitude of the other edge of the box.
+ * @param[in] lon2 Longitude of the eastern edge of the box.
+ * @param[out] area The area of the grid, see grib2_grid_crop().
+ * @retval 0 Success
+ * @retval -1 No gridpoints within the box, or the grid is not supported
+ */
+int grib2_grid_area(const GRIB2Grid * grid, double lat1, double lon1, double lat2, double lon2, GRIB2Area * area)
+{
+	const GRIBMetadata * md;
+	double west;
+	double width;
+	int i0;
+	int i1;
+	int j0;
+	int j1;
+
+	if (grid == NULL || area == NULL) {
+		return -1;
+	}
+	md = &grid->md;
+	if (md->gds_templ_num != 0 || (md->scan_mode & 0x30) != 0 || md->xinc.loinc <= 0.0 || md->yinc.lainc <= 0.0) {
+		fprintf(stderr, "Error: areas are only supported on regular lat/lon grids\n");
+		return -1;
+	}
+
+	/* distance of the box from the first column, in scanning direction */
+	width = (lon2 - lon1 >= 360.0) ? 360.0 : fmod(lon2 - lon1, 360.0);
+	if (width < 0.0) width += 360.0;
+	west = fmod((md->scan_mode & 0x80) ? md->slon - lon2 : lon1 - md->slon, 360.0);
+	if (west < 0.0) west += 360.0;
+	if (west + width >= 360.0) west -= 360.0;
+
+	if (grib2_axis_range(0.0, md->xinc.loinc, md->nx, west, west + width, &i0, &i1) != 0
+		|| grib2_axis_range(md->slat, (md->scan_mode & 0x40) ? md->yinc.lainc : -md->yinc.lainc, md->ny, lat1, lat2, &j0, &j1) != 0) {
+		return -1;
+	}
+	area->i0 = i0;
+	area->j0 = j0;
+	area->ni = i1 - i0 + 1;
+	area->nj = j1 - j0 + 1;
+	return 0;
+}
+
+static void grib2_area_copy(const double * values, int nx, const GRIB2Area * area, double * out) /* {{{ */
+{
+	int j;
+
+	for (j = 0; j < area->nj; j++) {
+		memcpy(out + (size_t)j * area->ni, values + (size_t)(area->j0 + j) * nx + area->i0, area->ni * sizeof(double));
+	}
+} /* }}} */
+
+/* Unpacks the gridpoints of an area of a grid only. Simple packed fields are
+ * unpacked row by row from the data section, complex packed fields as well if
+ * the group index of the grid is known, see grib2_grid_group_index(). JPEG2000
+ * compressed fields without bitmap decode only the area of the image if the
+ * backend supports it. All other fields, or grids already unpacked, are
+ * cropped from the gridpoints of the whole grid. A single gridpoint is an
+ * area of one row and one column.
+ *
+ * @param[inout] grib The message.
+ * @param[in] n Number of the grid within the message.
+ * @param[in] area The area, see grib2_grid_area().
+ * @param[out] out The gridpoints of the area, row by row, ni * nj values.
+ * @retval 0 Success
+ * @retval -1 Failure
+ */
+int grib2_grid_crop(GRIBMessage * grib, int n, const GRIB2Area * area, double * out)
+{
+	const GRIBMetadata * md;
+	const double * values;
+	jpeg2000_area_t a;
+	size_t first;
+	size_t packed = 0;
+	size_t idx;
+	size_t off;
+	double scale;
+	int len;
+	int j;
+	int rc;
+
+	if (grib == NULL || n < 0 || n >= grib->num_grids || area == NULL || out == NULL) {
+		return -1;
+	}
+	md = &grib->grids[n].md;
+	if (area->i0 < 0 || area->j0 < 0 || area->ni <= 0 || area->nj <= 0
+		|| area->i0 + area->ni > md->nx || area->j0 + area->nj > md->ny || (md->scan_mode & 0x20) != 0) {
+		fprintf(stderr, "Error: area not within the grid\n");
+		return -1;
+	}
+
+	if (grib->grids[n].gridpoints == NULL && grib->has_data) {
+		scale = pow(2.0, md->E) / pow(10.0, md->D);
+		switch (md->drs_templ_num) {
+			case 0: /* Grid Point Data - Simple Packaging */
+				first = (size_t)md->sec_offset[7] * 8 + 40;
+				for (idx = 0, j = 0; j < area->nj; j++) {
+					off = (size_t)(area->j0 + j) * md->nx + area->i0;
+					if (md->bitmap != NULL) {
+						for (; idx < off; idx++) {
+							if (md->bitmap[idx] == 1) packed++;
+						}
+					} else {
+						packed = off;
+					}
+					off = first + packed * md->pack_width;
+					if (unpack_scaled(grib->buffer, &off, md->pack_width, md->R, scale,
+						(md->bitmap == NULL) ? NULL : md->bitmap + (size_t)(area->j0 + j) * md->nx + area->i0,
+						area->ni, out + (size_t)j * area->ni) != 0) {
+						return -1;
+					}
+				}
+				return 0;
+
+			case 2: /* Grid Point Data - Complex Packing */
+			case 3: /* Grid Point Data - Complex Packing and Spatial Differencing */
+				if (grib->grids[n].groups == NULL) {
+					break;
+				}
+				for (idx = 0, j = 0; j < area->nj; j++) {
+					off = (size_t)(area->j0 + j) * md->nx + area->i0;
+					if (md->bitmap != NULL) {
+						for (; idx < off; idx++) {
+							if (md->bitmap[idx] == 1) packed++;
+						}
+					} else {
+						packed = off;
+					}
+					if (unpack_complex_range(&grib->buffer[md->sec_offset[7]], md, grib->grids[n].groups, scale, packed,
+						(md->bitmap == NULL) ? NULL : md->bitmap + (size_t)(area->j0 + j) * md->nx + area->i0,
+						area->ni, out + (size_t)j * area->ni) != 0) {
+						return -1;
+					}
+				}
+				return 0;
+
+			case 4: /* Grid Point Data - IEEE Floating Point Data */
+				get_bits(grib->buffer, &len, md->sec_offset[7] * 8, 32);
+				len = len - 5;
+				for (idx = 0, j = 0; j < area->nj; j++) {
+					off = (size_t)(area->j0 + j) * md->nx + area->i0;
+					if (md->bitmap != NULL) {
+						for (; idx < off; idx++) {
+							if (md->bitmap[idx] == 1) packed++;
+						}
+					} else {
+						packed = off;
+					}
+					off = packed * (md->pack_width / 8);
+					if (len < 0 || off > (size_t)len
+						|| unpack_ieee(&grib->buffer[md->sec_offset[7] + 5 + off], (size_t)len - off, md->precision,
+						grib->grids[n].swapped, (md->bitmap == NULL) ? NULL : md->bitmap + (size_t)(area->j0 + j) * md->nx + area->i0,
+						area->ni, out + (size_t)j * area->ni) != 0) {
+						return -1;
+					}
+				}
+				return 0;
+
+			case 40: /* Grid Point Data - JPEG2000 Compression */
+			case 40000:
+				if (md->bitmap != NULL) {
+					break;
 				}
+				get_bits(grib->buffer, &len, md->sec_offset[7] * 8, 32);
+				len = len - 5;
+				a.x0 = area->i0;
+				a.y0 = area->j0;
+				a.width = area->ni;
+				a.height = area->nj;
+				rc = jpeg2000_decode_area(NULL, &grib->jpc_state, &grib->buffer[md->sec_offset[7] + 5],
+					(len > 0) ? (size_t)len : 0, md->R, scale, &a, out);
+				if (rc != -2) {
+					return rc;
+				}
+				break;
+		}
+	}
+
+	values = grib2_grid_values(grib, n);
+	if (values == NULL) {
+		return -1;
+	}
+	grib2_area_copy(values, md->nx, area, out);
+	return 0;
+}
+
+/* Returns the values of a grid of 32 bit IEEE floating point data (template
+ * 5.4) right from the message, without unpacking: the data section is swapped
+ * in place to the byte order of the host on the first access (nothing to do
+ * on big endian hosts), no memory is allocated. Only the values of points
+ * present in the bitmap are contained, md.num_packed values.
+ *
+ * Only messages read from streams are swapped, their buffer is owned by the
+ * message. The memory of messages unpacked from memory, mapped files or an
+ * index is not changed, it may be shared with other messages and threads;
+ * their values are available from grib2_grid_values().
+ *
+ * @param[inout] grib The message, unpacked including the data.
+ * @param[in] n Number of the grid within the message.
+ * @return The values, NULL if the grid does not consist of 32 bit IEEE data
+ *     or the buffer is not owned by the message.
+ */
+const grib2_float32_t * grib2_grid_float32(GRIBMessage * grib, int n)
+{
+	GRIB2Grid * grid;
+	unsigned char * p;
+	int len;
+
+	if (grib == NULL || n < 0 || n >= grib->num_grids || !grib->has_data) {
+		return NULL;
+	}
+	grid = &grib->grids[n];
+	if (grid->md.drs_templ_num != 4 || grid->md.precision != 1) {
+		return NULL;
+	}
+	if (grib->buffer != (unsigned char *)grib->storage.data) {
+		return NULL;
+	}
+	p = &grib->buffer[grid->md.sec_offset[7] + 5];
+#if !defined(__GNUC__)
+	if ((size_t)p % sizeof(float) != 0) {
+		return NULL;
+	}
+#endif
+	if (!grid->swapped) {
+		get_bits(grib->buffer, &len, grid->md.sec_offset[7] * 8, 32);
+		if (grid->md.num_packed < 0 || len - 5 < 0 || (size_t)grid->md.num_packed > (size_t)(len - 5) / 4) {
+			fprintf(stderr, "Error: data section too short for %d IEEE values\n", grid->md.num_packed);
+			return NULL;
+		}
+		ieee_swap32(p, (size_t)grid->md.num_packed);
+		grid->swapped = 1;
+	}
+	return (const grib2_float32_t *)p;
+}
+
+/* Builds the group index of a complex packed grid (templates 5.2 and 5.3).
+ * Building the index unpacks the grid once, the index is kept by the caller,
+ * e.g. in an index file, see grib2_index_open(). Setting the index of the grid
+ * to it lets grib2_grid_crop() read only the groups of an area.
+ *
+ * @param[in] grib The message, unpacked including the data.
+ * @param[in] n Number of the grid within the message.
+ * @return The index, to be released by free(). NULL if the grid is not complex
+ *     packed or in case of an error.
+ */
+GRIB2GroupIndex * grib2_grid_group_index(const GRIBMessage * grib, int n)
+{
+	const GRIBMetadata * md;
+	int len;
+
+	if (grib == NULL || n < 0 || n >= grib->num_grids || !grib->has_data) {
+		return NULL;
+	}
+	md = &grib->grids[n].md;
+	if (md->drs_templ_num != 2 && md->drs_templ_num != 3) {
+		return NULL;
+	}
+	get_bits(grib->buffer, &len, md->sec_offset[7] * 8, 32);
+	return complex_index_build(&grib->buffer[md->sec_offset[7]], (len > 0) ? (size_t)len : 0, md);
+}
+
+/* Unpacks the next message found in memory, starting at the cursor. The message
+ * is not copied, the buffer of the message points into the specified memory,
+ * which therefore must not be released before the message.
+ *
+ * Like grib2_unpack(), the buffer of the message must be NULL on the first call.
+ *
+ * @param[inout] grib The message.
+ * @param[in] buf Memory containing GRIB2 messages.
+ * @param[in] len Size of the memory in bytes.
+ * @param[inout] cursor Offset within the memory at which the search for the next message
+ *     starts. On return the offset behind the unpacked message.
+ * @retval 0 Success
+ * @retval -1 Failure, or no more messages
+ */
+int grib2_unpack_from_memory(GRIBMessage * grib, const unsigned char * buf, size_t len, size_t * cursor)
+{
+	if (buf == NULL || cursor == NULL || *cursor > len) {
+		return -1;
+	}
+
+	if (grib2_unpackIS_memory(grib, buf, len, cursor) != 0) {
+		return -1;
+	}
+	return grib2_unpack_sections(grib, 1);
+}
+
+/* Unpacks a single field of a message, using the section offsets recorded
+ * by a previous unpack (see GRIBMetadata::sec_offset, e.g. kept in an index).
+ * Only the sections in effect for the field are read, the message contains
+ * exactly one grid on return. Like for all messages, its gridpoints are
+ * unpacked on demand, see grib2_grid_values(), or only an area of them, see
+ * grib2_grid_crop(). The message is referenced in place, see
+ * grib2_unpack_from_memory().
+ *
+ * @param[inout] grib The message.
+ * @param[in] buf Memory containing GRIB2 messages.
+ * @param[in] len Size of the memory in bytes.
+ * @param[in] pos Offset of the message within the memory.
+ * @param[in] sec_offset Offsets of the sections 0 to 7 in effect for the field,
+ *     relative to the message.
+ * @retval 0 Success
+ * @retval -1 Failure
+ */
+int grib2_unpack_field(GRIBMessage * grib, const unsigned char * buf, size_t len, size_t pos, const int * sec_offset)
+{
+	size_t cursor = pos;
+	int sec_num;
+
+	if (buf == NULL || sec_offset == NULL || pos > len) {
+		return -1;
+	}
+	if (grib2_unpackIS_memory(grib, buf, len, &cursor) != 0 || cursor != pos + (size_t)grib->total_len) {
+		return -1;
+	}
+	if (grib2_unpackIDS(grib) != 0) {
+		return -1;
+	}
+	memset(grib->md.sec_offset, 0, sizeof(grib->md.sec_offset));
+	grib->md.sec_offset[1] = 16;
+	grib->md.bitmap = NULL;
+	for (sec_num = 3; sec_num <= 7; sec_num++) {
+		if (sec_offset[sec_num] < 16 || sec_offset[sec_num] + 5 > grib->total_len) {
+			if (sec_num == 6) continue;
+			fprintf(stderr, "Error: section %d of the field not found\n", sec_num);
+			return -1;
+		}
+		grib->offset = sec_offset[sec_num] * 8;
+		if (grib->buffer[sec_offset[sec_num] + 4] != sec_num) {
+			fprintf(stderr, "Error: section %d of the field not found\n", sec_num);
+			return -1;
+		}
+		grib->md.sec_offset[sec_num] = sec_offset[sec_num];
+		switch (sec_num) {
+			case 3:
+				if (grib2_unpackGDS(grib) != 0) return -1;
+				break;
+			case 4:
+				if (grib2_unpackPDS(grib) != 0) return -1;
 				break;
 			case 5:
-				if (grib2_unpackDRS(grib) != 0) {
-					return -1;
-				}
+				if (grib2_unpackDRS(grib) != 0) return -1;
 				break;
 			case 6:
-				if (grib2_unpackBMS(grib) != 0) {
-					return -1;
-				}
+				if (grib2_unpackBMS(grib) != 0) return -1;
 				break;
 			case 7:
-				grib->grids[n].md = grib->md;
-				if (grib2_unpackDS(grib, n) != 0) {
-					return -1;
-				}
-				n++;
+				grib->grids = (GRIB2Grid *)arena_alloc(&grib->arena, sizeof(GRIB2Grid));
+				if (grib->grids == NULL) return -1;
+				grib->num_grids = 1;
+				grib->grids[0].md = grib->md;
+				grib->grids[0].gridpoints = NULL;
+				grib->grids[0].groups = NULL;
+				grib->grids[0].swapped = 0;
+				grib->has_data = 1;
 				break;
 		}
-		grib->offset += len * 8;
 	}
 	return 0;
 }
 
+/* Unpacks the next message of a mapped file, see grib2_unpack_from_memory().
+ * The file must stay mapped as long as the message is used. */
+int grib2_unpack_mapped(GRIBMessage * grib, mapped_file_t * mf)
+{
+	int rc;
+
+	if (mf == NULL) {
+		return -1;
+	}
+
+	rc = grib2_unpack_from_memory(grib, mf->data, mf->len, &mf->cursor);
+	mapped_file_advise(mf);
+	return rc;
+}
+
+/* Unpacks the metadata of the next message, all sections except the data
+ * sections. The grids of the message get their metadata, but no gridpoints.
+ * The data is skipped instead of read, if a skip function is specified,
+ * e.g. seeking within a file. This is meant for inventories.
+ *
+ * @param[inout] grib The message, the buffer must be NULL on the first call.
+ * @param[in] read_func Function to read data.
+ * @param[in] skip_func Function to skip the specified number of bytes, NULL
+ *     if the data has to be read.
+ * @param[in] ptr Pointer passed to the read and skip functions.
+ * @retval 0 Success
+ * @retval -1 Failure
+ */
+int grib2_unpack_metadata(GRIBMessage * grib, int (*read_func)(void * buf, unsigned int len, void * ptr), int (*skip_func)(unsigned int len, void * ptr), void * ptr)
+{
+	if (read_func == NULL) {
+		return -1;
+	}
+
+	if (grib2_unpackIS_metadata(grib, read_func, skip_func, ptr) != 0) {
+		return -1;
+	}
+	return grib2_unpack_sections(grib, 0);
+}
+
+/* Unpacks the metadata of the next message found in memory, see
+ * grib2_unpack_metadata() and grib2_unpack_from_memory(). The data sections
+ * are not accessed, but the gridpoints remain available on demand. */
+int grib2_unpack_metadata_from_memory(GRIBMessage * grib, const unsigned char * buf, size_t len, size_t * cursor)
+{
+	if (buf == NULL || cursor == NULL || *cursor > len) {
+		return -1;
+	}
+
+	if (grib2_unpackIS_memory(grib, buf, len, cursor) != 0) {
+		return -1;
+	}
+	return grib2_unpack_sections(grib, 1);
+}
+
+/* Unpacks the metadata of the next message of a mapped file, see
+ * grib2_unpack_metadata_from_memory(). The kernel is not asked to read ahead,
+ * only the pages containing metadata are read from the file. */
+int grib2_unpack_metadata_mapped(GRIBMessage * grib, mapped_file_t * mf)
+{
+	if (mf == NULL) {
+		return -1;
+	}
+
+	return grib2_unpack_metadata_from_memory(grib, mf->data, mf->len, &mf->cursor);
+}
+
+/* Releases all memory of the message, including the memory kept for the
+ * next message. Afterwards the message is in the state before the first
+ * call, the message may be reused. */
+void grib2_free(GRIBMessage * grib)
+{
+	if (grib == NULL || grib->buffer == NULL) {
+		return;
+	}
+	arena_free(&grib->arena);
+	pool_free(&grib->storage);
+	jpeg2000_free(&grib->jpc_state);
+	grib->buffer = NULL;
+	grib->grids = NULL;
+	grib->num_grids = 0;
+}
+
+/* Passes the gridpoints of a grid unpacked as a whole in chunks to the callback. */
+static int grib2_stream_values(const GRIB2Grid * grid, int grid_num, const double * values, size_t num_points, int (*values_func)(const GRIB2Grid *, int, size_t, const double *, size_t, void *), void * values_ptr) /* {{{ */
+{
+	size_t point;
+	size_t num;
+
+	for (point = 0; point < num_points; point += num) {
+		num = num_points - point;
+		if (num > GRIB2_STREAM_CHUNK) num = GRIB2_STREAM_CHUNK;
+		if (values_func(grid, grid_num, point, values + point, num, values_ptr) != 0) {
+			return -1;
+		}
+	}
+	return 0;
+} /* }}} */
+
+/* Reads the data section of a grid through the window and passes the unpacked
+ * gridpoints in chunks to the callback. Only simple packing is unpacked this
+ * way, other packings need the entire data section, which is read and unpacked
+ * as a whole.
+ *
+ * @param[in] grib The message.
+ * @param[in] grid The grid to which the data section belongs.
+ * @param[in] grid_num Number of the grid within the message.
+ * @param[in] len Length of the data section.
+ * @param[in] win The window, GRIB2_STREAM_WINDOW bytes.
+ * @param[in] out Memory for GRIB2_STREAM_CHUNK gridpoints.
+ */
+static int grib2_stream_DS(GRIBMessage * grib, GRIB2Grid * grid, int grid_num, size_t len, unsigned char * win, double * out, int (*read_func)(void * buf, unsigned int len, void * ptr), void * ptr, int (*values_func)(const GRIB2Grid *, int, size_t, const double *, size_t, void *), void * values_ptr) /* {{{ */
+{
+	const GRIBMetadata * md = &grid->md;
+	const unsigned char * bitmap = md->bitmap;
+	size_t bits = md->pack_width;
+	size_t num_points = (size_t)md->nx * md->ny;
+	size_t remaining = len - 5; /* bytes of the section not read yet */
+	size_t have = 0; /* bytes within the window */
+	size_t off = 0; /* offset in bits of the next packed value within the window */
+	size_t point = 0;
+	size_t avail;
+	size_t num;
+	size_t cnt;
+	size_t k;
+	double scale;
+	GRIB2Grid whole;
+	unsigned char * sec;
+
+	if (md->drs_templ_num != 0) {
+		sec = (unsigned char *)arena_alloc(&grib->arena, len);
+		if (sec == NULL || read_func(&sec[5], remaining, ptr) != (int)remaining) {
+			return -1;
+		}
+		set_bits(sec, (int)len, 0, 32);
+		whole = *grid;
+		whole.md.sec_offset[7] = 0;
+		if (grib2_unpackDS(sec, grib, &whole) != 0) {
+			return -1;
+		}
+		return grib2_stream_values(grid, grid_num, whole.gridpoints, num_points, values_func, values_ptr);
+	}
+
+	/* the reference value is already scaled by 10^-D, see grib2_unpackDRS */
+	scale = pow(2.0, md->E) / pow(10.0, md->D);
+
+	while (point < num_points) {
+		k = GRIB2_STREAM_WINDOW - have;
+		if (k > remaining) k = remaining;
+		if (k > 0) {
+			if (read_func(&win[have], k, ptr) != (int)k) {
+				return -1;
+			}
+			have += k;
+			remaining -= k;
+		}
+
+		/* number of packed values completely within the window, a
+		   constant field has no packed values at all */
+		avail = (bits == 0) ? num_points : (have * 8 - off) / bits;
+		if (bitmap == NULL) {
+			num = num_points - point;
+			if (num > avail) num = avail;
+			if (num > GRIB2_STREAM_CHUNK) num = GRIB2_STREAM_CHUNK;
+		} else {
+			for (num = 0, cnt = 0; num < GRIB2_STREAM_CHUNK && point + num < num_points; num++) {
+				if (bitmap[point + num] == 1) {
+					if (cnt == avail) break;
+					cnt++;
+				}
+			}
+		}
+		if (num == 0) {
+			fprintf(stderr, "Error: data section too short\n");
+			return -1;
+		}
+		if (unpack_scaled(win, &off, bits, md->R, scale, (bitmap == NULL) ? NULL : bitmap + point, num, out) != 0) {
+			return -1;
+		}
+		if (values_func(grid, grid_num, point, out, num, values_ptr) != 0) {
+			return -1;
+		}
+		point += num;
+
+		/* keep only the bytes not consumed completely */
+		k = off / 8;
+		memmove(win, &win[k], have - k);
+		have -= k;
+		off -= k * 8;
+	}
+
+	/* skip the remainder of the section, e.g. padding */
+	while (remaining > 0) {
+		k = (remaining > GRIB2_STREAM_WINDOW) ? GRIB2_STREAM_WINDOW : remaining;
+		if (read_func(win, k, ptr) != (int)k) {
+			return -1;
+		}
+		remaining -= k;
+	}
+	return 0;
+} /* }}} */
+
+/* Unpacks the next message in streaming mode. The message is never held in
+ * memory as a whole: the sections are read one at a time, the data sections
+ * through a window of fixed size. The gridpoints are passed in chunks to the
+ * callback as soon as they are unpacked, the memory needed does not depend on
+ * the size of the data sections (it does on the size of the other sections,
+ * e.g. the bitmap).
+ *
+ * The grids are not kept, on return the message contains the metadata of the
+ * last grid and no grids. Data sections not using simple packing are read and
+ * unpacked as a whole and are passed in chunks as well.
+ *
+ * @param[inout] grib The message, the buffer must be NULL on the first call.
+ * @param[in] read_func Function to read data.
+ * @param[in] ptr Pointer passed to the read function.
+ * @param[in] values_func Callback, receives the grid, its number within the
+ *     message, the number of the first gridpoint, the gridpoints and their
+ *     number. Returns 0 to continue, everything else aborts unpacking.
+ * @param[in] values_ptr Pointer passed to the callback.
+ * @retval 0 Success
+ * @retval -1 Failure, or no more messages
+ */
+int grib2_unpack_stream(GRIBMessage * grib, int (*read_func)(void * buf, unsigned int len, void * ptr), void * ptr, int (*values_func)(const GRIB2Grid * grid, int grid_num, size_t first, const double * values, size_t count, void * values_ptr), void * values_ptr)
+{
+	unsigned char temp[16];
+	unsigned char * win = NULL;
+	double * out = NULL;
+	GRIB2Grid grid;
+	int grid_num = 0;
+	int pos;
+	int len;
+	int sec_num;
+
+	if (read_func == NULL || values_func == NULL) {
+		return -1;
+	}
+
+	grib2_release(grib);
+	if (search_next_message(temp, read_func, ptr) != 0) {
+		return -1;
+	}
+	grib2_unpackIS_header(grib, temp);
+	if (grib->total_len < 20) {
+		return -1;
+	}
+	grib->has_data = 0;
+	memset(grib->md.sec_offset, 0, sizeof(grib->md.sec_offset));
+
+	/* every section is read to the beginning of the buffer and unpacked from there */
+	for (pos = 16; pos + 4 <= grib->total_len; pos += len) {
+		if (read_func(temp, 4, ptr) != 4) {
+			return -1;
+		}
+		if (strncmp((char *)temp, "7777", 4) == 0) {
+			break;
+		}
+		get_bits(temp, &len, 0, 32);
+		if (len < 5 || len > grib->total_len - pos || read_func(&temp[4], 1, ptr) != 1) {
+			return -1;
+		}
+		sec_num = temp[4];
+		if (sec_num == 7) {
+			grib->md.sec_offset[7] = pos;
+			grid.md = grib->md;
+			grid.gridpoints = NULL;
+			grid.groups = NULL;
+			grid.swapped = 0;
+			if (win == NULL) {
+				win = (unsigned char *)arena_alloc(&grib->arena, GRIB2_STREAM_WINDOW);
+				out = (double *)arena_alloc(&grib->arena, GRIB2_STREAM_CHUNK * sizeof(double));
+				if (win == NULL || out == NULL) {
+					return -1;
+				}
+			}
+			if (grib2_stream_DS(grib, &grid, grid_num, (size_t)len, win, out, read_func, ptr, values_func, values_ptr) != 0) {
+				return -1;
+			}
+			grid_num++;
+			continue;
+		}
+
+		if (pool_reserve(&grib->storage, len) == NULL) {
+			return -1;
+		}
+		grib->buffer = (unsigned char *)grib->storage.data;
+		memcpy(grib->buffer, temp, 5);
+		if (read_func(&grib->buffer[5], len - 5, ptr) != len - 5) {
+			return -1;
+		}
+		grib->offset = 0;
+		if (sec_num == 1) {
+			grib->md.sec_offset[1] = pos;
+			if (grib2_unpackIDS(grib) != 0) {
+				return -1;
+			}
+		} else {
+			if (sec_num >= 2 && sec_num <= 6 && !(sec_num == 6 && grib->buffer[5] == 254)) {
+				grib->md.sec_offset[sec_num] = pos;
+			}
+			if (grib2_unpack_section(grib, sec_num) != 0) {
+				return -1;
+			}
+		}
+	}
+	if (pos + 4 != grib->total_len) {
+		fprintf(stderr, "Warning: no end section found\n");
+		return -1;
+	}
+	return 0;
+}
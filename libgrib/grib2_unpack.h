@@ -2,12 +2,26 @@
 #define __GRIB2_UNPACK__H__
 
 #include <grib2.h>
+#include <mapped_file.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 int grib2_unpack(GRIBMessage * grib, int (*read_func)(void *, unsigned int, void *), void * ptr);
+int grib2_unpack_from_memory(GRIBMessage * grib, const unsigned char * buf, size_t len, size_t * cursor);
+int grib2_unpack_mapped(GRIBMessage * grib, mapped_file_t * mf);
+int grib2_unpack_metadata(GRIBMessage * grib, int (*read_func)(void *, unsigned int, void *), int (*skip_func)(unsigned int, void *), void * ptr);
+int grib2_unpack_metadata_from_memory(GRIBMessage * grib, const unsigned char * buf, size_t len, size_t * cursor);
+int grib2_unpack_metadata_mapped(GRIBMessage * grib, mapped_file_t * mf);
+int grib2_unpack_stream(GRIBMessage * grib, int (*read_func)(void *, unsigned int, void *), void * ptr, int (*values_func)(const GRIB2Grid *, int, size_t, const double *, size_t, void *), void * values_ptr);
+void grib2_free(GRIBMessage * grib);
+double * grib2_grid_values(GRIBMessage * grib, int n);
+int grib2_grid_area(const GRIB2Grid * grid, double lat1, double lon1, double lat2, double lon2, GRIB2Area * area);
+int grib2_grid_crop(GRIBMessage * grib, int n, const GRIB2Area * area, double * out);
+const grib2_float32_t * grib2_grid_float32(GRIBMessage * grib, int n);
+GRIB2GroupIndex * grib2_grid_group_index(const GRIBMessage * grib, int n);
+int grib2_unpack_field(GRIBMessage * grib, const unsigned char * buf, size_t len, size_t pos, const int * sec_offset);
 
 #ifdef __cplusplus
 }
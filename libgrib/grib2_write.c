@@ -0,0 +1,319 @@
+#include <grib2_write.h>
+#include <bits.h>
+#include <ieee_float.h>
+#include <ccsds.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* Options of the CCSDS compression of written messages, like ecCodes. */
+#define GRIB2_CCSDS_FLAGS 14 /* AEC_DATA_3BYTE | AEC_DATA_MSB | AEC_DATA_PREPROCESS */
+#define GRIB2_CCSDS_BLOCK_SIZE 32
+#define GRIB2_CCSDS_RSI 128
+
+/* Returns the length in bytes of a section of the grid, 0 if absent. */
+static size_t grib2_section_len(const GRIBMessage * grib, const GRIBMetadata * md, int sec_num) /* {{{ */
+{
+	int len;
+
+	if (md->sec_offset[sec_num] == 0) {
+		return 0;
+	}
+	get_bits(grib->buffer, &len, (size_t)md->sec_offset[sec_num] * 8, 32);
+	return (len > 0) ? (size_t)len : 0;
+} /* }}} */
+
+/* Determines the points to write: points absent in the bitmap of the grid or
+ * having GRIB_MISSING_VALUE are left out. The mask is NULL if all points are
+ * present, otherwise to be released by free(). */
+static int grib2_write_mask(const GRIBMetadata * md, const double * values, size_t num_points, unsigned char ** mask, size_t * num_packed) /* {{{ */
+{
+	size_t n;
+
+	*mask = (unsigned char *)malloc(num_points);
+	if (*mask == NULL) {
+		return -1;
+	}
+	for (*num_packed = 0, n = 0; n < num_points; n++) {
+		(*mask)[n] = (md->bitmap == NULL || md->bitmap[n] == 1) && values[n] != GRIB_MISSING_VALUE;
+		*num_packed += (*mask)[n];
+	}
+	if (*num_packed == num_points) {
+		free(*mask);
+		*mask = NULL;
+	}
+	return 0;
+} /* }}} */
+
+/* Writes a message of a single grid. The identification, local use, grid
+ * definition and product definition sections are copied from the grid, the
+ * data representation section and the data are specified, the bitmap section
+ * is made of the mask. */
+static int grib2_write_message(const GRIBMessage * grib, const GRIBMetadata * md, const unsigned char * drs, size_t drs_len, const unsigned char * mask, size_t num_points, const unsigned char * data, size_t data_len, int (*write_func)(const void *, unsigned int, void *), void * ptr) /* {{{ */
+{
+	unsigned char head[16];
+	buffer_t bms;
+	size_t bms_len = 6;
+	size_t total;
+	size_t len;
+	int sec_num;
+	int rc;
+
+	if (mask != NULL) {
+		bms_len += (num_points + 7) / 8;
+	}
+	total = 16 + drs_len + bms_len + 5 + data_len + 4;
+	for (sec_num = 1; sec_num <= 4; sec_num++) {
+		total += grib2_section_len(grib, md, sec_num);
+	}
+	if (total > 0x7fffffff) {
+		fprintf(stderr, "Error: too many points for a GRIB2 message\n");
+		return -1;
+	}
+
+	/* indicator section */
+	memset(head, 0, sizeof(head));
+	memcpy(head, "GRIB", 4);
+	head[6] = (unsigned char)grib->disc;
+	head[7] = 2;
+	set_bits(head, (int)total, 96, 32);
+	if (write_func(head, 16, ptr) != 16) {
+		return -1;
+	}
+
+	/* identification, local use, grid definition and product definition section */
+	for (sec_num = 1; sec_num <= 4; sec_num++) {
+		len = grib2_section_len(grib, md, sec_num);
+		if (len > 0 && write_func(grib->buffer + md->sec_offset[sec_num], (unsigned int)len, ptr) != (int)len) {
+			return -1;
+		}
+	}
+
+	/* data representation section */
+	if (write_func(drs, (unsigned int)drs_len, ptr) != (int)drs_len) {
+		return -1;
+	}
+
+	/* bitmap section */
+	bms.buffer = (unsigned char *)calloc(bms_len, 1);
+	if (bms.buffer == NULL) {
+		return -1;
+	}
+	bms.length = (unsigned int)bms_len;
+	bms.offset = 0;
+	append_bits(&bms, (int)bms_len, 32);
+	append_bits(&bms, 6, 8);
+	append_bits(&bms, (mask != NULL) ? 0 : 255, 8);
+	rc = (mask == NULL || append_bitmap(&bms, mask, num_points) == 0)
+		&& write_func(bms.buffer, (unsigned int)bms_len, ptr) == (int)bms_len;
+	free(bms.buffer);
+	if (!rc) {
+		return -1;
+	}
+
+	/* data section */
+	set_bits(head, (int)(5 + data_len), 0, 32);
+	set_bits(head, 7, 32, 8);
+	if (write_func(head, 5, ptr) != 5) {
+		return -1;
+	}
+	if (data_len > 0 && write_func(data, (unsigned int)data_len, ptr) != (int)data_len) {
+		return -1;
+	}
+
+	if (write_func("7777", 4, ptr) != 4) {
+		return -1;
+	}
+	return 0;
+} /* }}} */
+
+/* Packs the values of the points to write with the scaling of the grid and
+ * compresses them, see grib2_write_ccsds(). The data is NULL for a constant
+ * field, otherwise to be released by free(). */
+static int grib2_ccsds_data(const GRIBMetadata * md, const double * values, const unsigned char * mask, size_t num_points, size_t num_packed, int * bits, unsigned char ** data, size_t * data_len) /* {{{ */
+{
+	unsigned int * packed;
+	unsigned int max = 0;
+	double scale;
+	double x;
+	size_t k;
+	size_t m;
+
+	*bits = 0;
+	*data = NULL;
+	*data_len = 0;
+	packed = (unsigned int *)malloc((num_packed + 1) * sizeof(unsigned int));
+	if (packed == NULL) {
+		return -1;
+	}
+
+	/* the reference value is already scaled by 10^-D, see grib2_unpackDRS */
+	scale = pow(2.0, md->E) / pow(10.0, md->D);
+	for (k = 0, m = 0; k < num_points; k++) {
+		if (mask != NULL && mask[k] == 0) {
+			continue;
+		}
+		x = floor((values[k] - md->R) / scale + 0.5);
+		if (x < 0.0 || x > 4294967295.0) {
+			fprintf(stderr, "Error: value %g cannot be packed with the scaling of the grid\n", values[k]);
+			free(packed);
+			return -1;
+		}
+		packed[m] = (unsigned int)x;
+		if (packed[m] > max) max = packed[m];
+		m++;
+	}
+	for (; *bits < 32 && (max >> *bits) != 0; (*bits)++);
+
+	if (*bits > 0 && num_packed > 0) {
+		/* incompressible data grows by a few bits per block */
+		*data_len = num_packed * 4 + num_packed / 8 + 256;
+		*data = (unsigned char *)malloc(*data_len);
+		if (*data == NULL || pack_ccsds(packed, num_packed, *bits, GRIB2_CCSDS_FLAGS, GRIB2_CCSDS_BLOCK_SIZE,
+			GRIB2_CCSDS_RSI, *data, data_len) != 0) {
+			free(*data);
+			free(packed);
+			return -1;
+		}
+	}
+	free(packed);
+	return 0;
+} /* }}} */
+
+/* Writes a grid as GRIB2 message of IEEE floating point data (template 5.4),
+ * which is lossless for 64 bit (and for values of 32 bit precision) and fast
+ * to write and to read. The identification, local use, grid definition and
+ * product definition sections are taken from the grid. Points absent in the
+ * bitmap of the grid or having GRIB_MISSING_VALUE are absent in the bitmap
+ * of the message, which has no bitmap if all points are present.
+ *
+ * @param[in] grib The message containing the grid, the data is not needed.
+ * @param[in] n Number of the grid within the message.
+ * @param[in] values The values of all points of the grid, e.g. from
+ *     grib2_grid_values(), values of points absent in the bitmap of the grid
+ *     are ignored.
+ * @param[in] precision Precision of the written values, 1: 32 bit, 2: 64 bit.
+ * @param[in] write_func Function to write the message.
+ * @param[in] ptr Passed to the write function.
+ * @retval 0 Success
+ * @retval -1 Failure
+ */
+int grib2_write_ieee(const GRIBMessage * grib, int n, const double * values, int precision, int (*write_func)(const void *, unsigned int, void *), void * ptr)
+{
+	const GRIBMetadata * md;
+	unsigned char drs[12];
+	unsigned char * mask;
+	unsigned char * data;
+	size_t num_points;
+	size_t num_packed;
+	size_t data_len;
+	int rc;
+
+	if (grib == NULL || grib->buffer == NULL || n < 0 || n >= grib->num_grids || values == NULL || write_func == NULL) {
+		return -1;
+	}
+	if (precision != 1 && precision != 2) {
+		fprintf(stderr, "Error: IEEE precision %d is not supported\n", precision);
+		return -1;
+	}
+	md = &grib->grids[n].md;
+	num_points = (size_t)md->nx * md->ny;
+	if (grib2_write_mask(md, values, num_points, &mask, &num_packed) != 0) {
+		return -1;
+	}
+	data = (unsigned char *)malloc(num_packed * 8 + 1);
+	if (data == NULL) {
+		free(mask);
+		return -1;
+	}
+	data_len = pack_ieee(values, mask, num_points, precision, data);
+
+	memset(drs, 0, sizeof(drs));
+	set_bits(drs, 12, 0, 32);
+	set_bits(drs, 5, 32, 8);
+	set_bits(drs, (int)num_packed, 40, 32);
+	set_bits(drs, 4, 72, 16);
+	set_bits(drs, precision, 88, 8);
+
+	rc = grib2_write_message(grib, md, drs, sizeof(drs), mask, num_points, data, data_len, write_func, ptr);
+	free(data);
+	free(mask);
+	return rc;
+}
+
+/* Writes a grid as GRIB2 message of CCSDS compressed data (template 5.42),
+ * which decodes much faster than JPEG2000 at a similar size. The values are
+ * packed with the reference value and the scale factors of the grid, which
+ * makes repacking lossless. Like grib2_write_ieee(), the sections describing
+ * the grid are taken from it, missing points are absent in the bitmap.
+ *
+ * @param[in] grib The message containing the grid, the data is not needed.
+ * @param[in] n Number of the grid within the message, its values must be
+ *     packed (templates 5.0, 5.2, 5.3, 5.40, 5.41 and 5.42).
+ * @param[in] values The values of all points of the grid, e.g. from
+ *     grib2_grid_values(), values of points absent in the bitmap of the grid
+ *     are ignored.
+ * @param[in] write_func Function to write the message.
+ * @param[in] ptr Passed to the write function.
+ * @retval 0 Success
+ * @retval -1 Failure, e.g. values which cannot be packed with the scaling of
+ *     the grid, or no CCSDS support
+ */
+int grib2_write_ccsds(const GRIBMessage * grib, int n, const double * values, int (*write_func)(const void *, unsigned int, void *), void * ptr)
+{
+	const GRIBMetadata * md;
+	const unsigned char * src;
+	unsigned char drs[25];
+	unsigned char * mask;
+	unsigned char * data;
+	size_t num_points;
+	size_t num_packed;
+	size_t data_len;
+	int bits;
+	int rc;
+
+	if (grib == NULL || grib->buffer == NULL || n < 0 || n >= grib->num_grids || values == NULL || write_func == NULL) {
+		return -1;
+	}
+	md = &grib->grids[n].md;
+	switch (md->drs_templ_num) {
+		case 0:
+		case 2:
+		case 3:
+		case 40:
+		case 40000:
+		case 41:
+		case 42:
+			break;
+		default:
+			fprintf(stderr, "Error: data template %d has no scaling to pack with\n", md->drs_templ_num);
+			return -1;
+	}
+	num_points = (size_t)md->nx * md->ny;
+	if (grib2_write_mask(md, values, num_points, &mask, &num_packed) != 0) {
+		return -1;
+	}
+	if (grib2_ccsds_data(md, values, mask, num_points, num_packed, &bits, &data, &data_len) != 0) {
+		free(mask);
+		return -1;
+	}
+
+	/* reference value, scale factors and type of the values are those of the grid */
+	src = grib->buffer + md->sec_offset[5];
+	memset(drs, 0, sizeof(drs));
+	set_bits(drs, 25, 0, 32);
+	set_bits(drs, 5, 32, 8);
+	set_bits(drs, (int)num_packed, 40, 32);
+	set_bits(drs, 42, 72, 16);
+	memcpy(drs + 11, src + 11, 8);
+	set_bits(drs, bits, 152, 8);
+	drs[20] = src[20];
+	set_bits(drs, GRIB2_CCSDS_FLAGS, 168, 8);
+	set_bits(drs, GRIB2_CCSDS_BLOCK_SIZE, 176, 8);
+	set_bits(drs, GRIB2_CCSDS_RSI, 184, 16);
+
+	rc = grib2_write_message(grib, md, drs, sizeof(drs), mask, num_points, data, data_len, write_func, ptr);
+	free(data);
+	free(mask);
+	return rc;
+}
@@ -0,0 +1,17 @@
+#ifndef __GRIB2_WRITE__H__
+#define __GRIB2_WRITE__H__
+
+#include <grib2.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int grib2_write_ieee(const GRIBMessage * grib, int n, const double * values, int precision, int (*write_func)(const void *, unsigned int, void *), void *);
+int grib2_write_ccsds(const GRIBMessage * grib, int n, const double * values, int (*write_func)(const void *, unsigned int, void *), void *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
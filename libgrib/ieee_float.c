@@ -0,0 +1,405 @@
+#include <ieee_float.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define IEEE_FLOAT_X86
+#include <immintrin.h>
+#endif
+
+#if !defined(GRIB_MISSING_VALUE)
+#define GRIB_MISSING_VALUE (1.e30)
+#endif
+
+/* IEEE floating point data, template 5.4.
+ *
+ * The values are stored as big endian IEEE 754 numbers of 32 or 64 bits.
+ * Unpacking and packing therefore is byte swapping only (plus the conversion
+ * between float and double for 32 bits), which is done in vector registers
+ * by byte shuffles.
+ *
+ * The file does not depend on the rest of the library, it is shared with
+ * libgrib2.
+ */
+
+typedef void (*ieee_decode_t)(const unsigned char *, size_t, double *);
+typedef void (*ieee_encode_t)(const double *, size_t, unsigned char *);
+
+typedef struct {
+	ieee_decode_t decode32;
+	ieee_decode_t decode64;
+	ieee_encode_t encode32;
+	ieee_encode_t encode64;
+	void (*swap32)(unsigned char *, size_t);
+} ieee_kernels_t;
+
+static int ieee_size(int precision) /* {{{ */
+{
+	switch (precision) {
+		case 1: return 4;
+		case 2: return 8;
+	}
+	fprintf(stderr, "Error: IEEE precision %d is not supported\n", precision);
+	return 0;
+} /* }}} */
+
+static int little_endian(void) /* {{{ */
+{
+	const unsigned int one = 1;
+	return *(const unsigned char *)&one == 1;
+} /* }}} */
+
+static void decode32_scalar(const unsigned char * p, size_t count, double * out) /* {{{ */
+{
+	uint32_t u;
+	float f;
+	size_t n;
+
+	for (n = 0; n < count; n++, p += 4) {
+		u = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+		memcpy(&f, &u, 4);
+		out[n] = f;
+	}
+} /* }}} */
+
+static void decode64_scalar(const unsigned char * p, size_t count, double * out) /* {{{ */
+{
+	uint64_t u;
+	size_t n;
+	int k;
+
+	for (n = 0; n < count; n++, p += 8) {
+		for (u = 0, k = 0; k < 8; k++) {
+			u = (u << 8) | p[k];
+		}
+		memcpy(&out[n], &u, 8);
+	}
+} /* }}} */
+
+static void encode32_scalar(const double * vals, size_t count, unsigned char * p) /* {{{ */
+{
+	uint32_t u;
+	float f;
+	size_t n;
+
+	for (n = 0; n < count; n++, p += 4) {
+		f = (float)vals[n];
+		memcpy(&u, &f, 4);
+		p[0] = (unsigned char)(u >> 24);
+		p[1] = (unsigned char)(u >> 16);
+		p[2] = (unsigned char)(u >> 8);
+		p[3] = (unsigned char)u;
+	}
+} /* }}} */
+
+static void encode64_scalar(const double * vals, size_t count, unsigned char * p) /* {{{ */
+{
+	uint64_t u;
+	size_t n;
+	int k;
+
+	for (n = 0; n < count; n++, p += 8) {
+		memcpy(&u, &vals[n], 8);
+		for (k = 7; k >= 0; k--, u >>= 8) {
+			p[k] = (unsigned char)u;
+		}
+	}
+} /* }}} */
+
+static void swap32_scalar(unsigned char * p, size_t count) /* {{{ */
+{
+	unsigned char t;
+	size_t n;
+
+	for (n = 0; n < count; n++, p += 4) {
+		t = p[0]; p[0] = p[3]; p[3] = t;
+		t = p[1]; p[1] = p[2]; p[2] = t;
+	}
+} /* }}} */
+
+#if defined(IEEE_FLOAT_X86)
+
+#define SWAP32_128 _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3)
+#define SWAP64_128 _mm_set_epi8(8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7)
+#define SWAP32_256 _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3, \
+	12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3)
+#define SWAP64_256 _mm256_set_epi8(8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7, \
+	8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7)
+
+__attribute__((target("ssse3")))
+static void decode32_ssse3(const unsigned char * p, size_t count, double * out) /* {{{ */
+{
+	const __m128i swap = SWAP32_128;
+	__m128 f;
+	size_t n = 0;
+
+	for (; n + 4 <= count; n += 4) {
+		f = _mm_castsi128_ps(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 4 * n)), swap));
+		_mm_storeu_pd(out + n, _mm_cvtps_pd(f));
+		_mm_storeu_pd(out + n + 2, _mm_cvtps_pd(_mm_movehl_ps(f, f)));
+	}
+	decode32_scalar(p + 4 * n, count - n, out + n);
+} /* }}} */
+
+__attribute__((target("ssse3")))
+static void decode64_ssse3(const unsigned char * p, size_t count, double * out) /* {{{ */
+{
+	const __m128i swap = SWAP64_128;
+	size_t n = 0;
+
+	for (; n + 2 <= count; n += 2) {
+		_mm_storeu_si128((__m128i *)(out + n),
+			_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 8 * n)), swap));
+	}
+	decode64_scalar(p + 8 * n, count - n, out + n);
+} /* }}} */
+
+__attribute__((target("ssse3")))
+static void encode32_ssse3(const double * vals, size_t count, unsigned char * p) /* {{{ */
+{
+	const __m128i swap = SWAP32_128;
+	__m128 f;
+	size_t n = 0;
+
+	for (; n + 4 <= count; n += 4) {
+		f = _mm_movelh_ps(_mm_cvtpd_ps(_mm_loadu_pd(vals + n)), _mm_cvtpd_ps(_mm_loadu_pd(vals + n + 2)));
+		_mm_storeu_si128((__m128i *)(p + 4 * n), _mm_shuffle_epi8(_mm_castps_si128(f), swap));
+	}
+	encode32_scalar(vals + n, count - n, p + 4 * n);
+} /* }}} */
+
+__attribute__((target("ssse3")))
+static void encode64_ssse3(const double * vals, size_t count, unsigned char * p) /* {{{ */
+{
+	const __m128i swap = SWAP64_128;
+	size_t n = 0;
+
+	for (; n + 2 <= count; n += 2) {
+		_mm_storeu_si128((__m128i *)(p + 8 * n),
+			_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(vals + n)), swap));
+	}
+	encode64_scalar(vals + n, count - n, p + 8 * n);
+} /* }}} */
+
+__attribute__((target("ssse3")))
+static void swap32_ssse3(unsigned char * p, size_t count) /* {{{ */
+{
+	const __m128i swap = SWAP32_128;
+	size_t n = 0;
+
+	for (; n + 4 <= count; n += 4) {
+		_mm_storeu_si128((__m128i *)(p + 4 * n),
+			_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 4 * n)), swap));
+	}
+	swap32_scalar(p + 4 * n, count - n);
+} /* }}} */
+
+__attribute__((target("avx2")))
+static void decode32_avx2(const unsigned char * p, size_t count, double * out) /* {{{ */
+{
+	const __m256i swap = SWAP32_256;
+	__m256 f;
+	size_t n = 0;
+
+	for (; n + 8 <= count; n += 8) {
+		f = _mm256_castsi256_ps(_mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(p + 4 * n)), swap));
+		_mm256_storeu_pd(out + n, _mm256_cvtps_pd(_mm256_castps256_ps128(f)));
+		_mm256_storeu_pd(out + n + 4, _mm256_cvtps_pd(_mm256_extractf128_ps(f, 1)));
+	}
+	decode32_scalar(p + 4 * n, count - n, out + n);
+} /* }}} */
+
+__attribute__((target("avx2")))
+static void decode64_avx2(const unsigned char * p, size_t count, double * out) /* {{{ */
+{
+	const __m256i swap = SWAP64_256;
+	size_t n = 0;
+
+	for (; n + 4 <= count; n += 4) {
+		_mm256_storeu_si256((__m256i *)(out + n),
+			_mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(p + 8 * n)), swap));
+	}
+	decode64_scalar(p + 8 * n, count - n, out + n);
+} /* }}} */
+
+__attribute__((target("avx2")))
+static void encode32_avx2(const double * vals, size_t count, unsigned char * p) /* {{{ */
+{
+	const __m256i swap = SWAP32_256;
+	__m256 f;
+	size_t n = 0;
+
+	for (; n + 8 <= count; n += 8) {
+		f = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(_mm256_loadu_pd(vals + n))),
+			_mm256_cvtpd_ps(_mm256_loadu_pd(vals + n + 4)), 1);
+		_mm256_storeu_si256((__m256i *)(p + 4 * n), _mm256_shuffle_epi8(_mm256_castps_si256(f), swap));
+	}
+	encode32_scalar(vals + n, count - n, p + 4 * n);
+} /* }}} */
+
+__attribute__((target("avx2")))
+static void encode64_avx2(const double * vals, size_t count, unsigned char * p) /* {{{ */
+{
+	const __m256i swap = SWAP64_256;
+	size_t n = 0;
+
+	for (; n + 4 <= count; n += 4) {
+		_mm256_storeu_si256((__m256i *)(p + 8 * n),
+			_mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(vals + n)), swap));
+	}
+	encode64_scalar(vals + n, count - n, p + 8 * n);
+} /* }}} */
+
+__attribute__((target("avx2")))
+static void swap32_avx2(unsigned char * p, size_t count) /* {{{ */
+{
+	const __m256i swap = SWAP32_256;
+	size_t n = 0;
+
+	for (; n + 8 <= count; n += 8) {
+		_mm256_storeu_si256((__m256i *)(p + 4 * n),
+			_mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(p + 4 * n)), swap));
+	}
+	swap32_scalar(p + 4 * n, count - n);
+} /* }}} */
+
+static const ieee_kernels_t kernels_ssse3 = {
+	decode32_ssse3, decode64_ssse3, encode32_ssse3, encode64_ssse3, swap32_ssse3
+};
+
+static const ieee_kernels_t kernels_avx2 = {
+	decode32_avx2, decode64_avx2, encode32_avx2, encode64_avx2, swap32_avx2
+};
+
+#endif
+
+static const ieee_kernels_t kernels_scalar = {
+	decode32_scalar, decode64_scalar, encode32_scalar, encode64_scalar, swap32_scalar
+};
+
+static const ieee_kernels_t * select_kernels(void) /* {{{ */
+{
+#if defined(IEEE_FLOAT_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return &kernels_avx2;
+	if (__builtin_cpu_supports("ssse3")) return &kernels_ssse3;
+#endif
+	return &kernels_scalar;
+} /* }}} */
+
+/* Converts 32 bit values already swapped to the byte order of the host, see ieee_swap32(). */
+static void decode32_native(const unsigned char * p, size_t count, double * out) /* {{{ */
+{
+	float f;
+	size_t n;
+
+	for (n = 0; n < count; n++, p += 4) {
+		memcpy(&f, p, 4);
+		out[n] = f;
+	}
+} /* }}} */
+
+/* Unpacks IEEE floating point data, template 5.4.
+ *
+ * @param[in] buf The values, following the header of the data section.
+ * @param[in] len Size of the values in bytes.
+ * @param[in] precision Precision of the values, 1: 32 bit, 2: 64 bit.
+ * @param[in] native The 32 bit values were swapped to the byte order of the
+ *     host already, see ieee_swap32().
+ * @param[in] bitmap The bitmap, NULL if all points are present.
+ * @param[in] num_points Number of points.
+ * @param[out] out The values of all points, GRIB_MISSING_VALUE where the
+ *     bitmap marks points as absent.
+ * @retval 0 Success
+ * @retval -1 Failure
+ */
+int unpack_ieee(const unsigned char * buf, size_t len, int precision, int native, const unsigned char * bitmap, size_t num_points, double * out)
+{
+	const ieee_kernels_t * kernels;
+	ieee_decode_t decode;
+	size_t size = ieee_size(precision);
+	size_t n;
+	size_t k;
+
+	if (size == 0) {
+		return -1;
+	}
+	kernels = select_kernels();
+	if (native && size == 4) {
+		decode = decode32_native;
+	} else {
+		decode = (size == 4) ? kernels->decode32 : kernels->decode64;
+	}
+
+	/* runs of present points are converted at once */
+	for (n = 0; n < num_points;) {
+		if (bitmap != NULL && bitmap[n] == 0) {
+			out[n++] = GRIB_MISSING_VALUE;
+			continue;
+		}
+		for (k = n + 1; k < num_points && (bitmap == NULL || bitmap[k] == 1); k++);
+		if ((k - n) * size > len) {
+			fprintf(stderr, "Error: data section too short for %u IEEE values\n", (unsigned int)(k - n));
+			return -1;
+		}
+		decode(buf, k - n, out + n);
+		buf += (k - n) * size;
+		len -= (k - n) * size;
+		n = k;
+	}
+	return 0;
+}
+
+/* Packs values as IEEE floating point data, template 5.4. Only the values of
+ * points present in the bitmap are packed.
+ *
+ * @param[in] vals The values of all points.
+ * @param[in] bitmap The bitmap, NULL if all points are present.
+ * @param[in] num_points Number of points.
+ * @param[in] precision Precision of the packed values, 1: 32 bit, 2: 64 bit.
+ * @param[out] out The packed values, big endian. Must hold 4 (32 bit) or
+ *     8 (64 bit) bytes for every present point.
+ * @return Number of bytes written, 0 in case of an unsupported precision.
+ */
+size_t pack_ieee(const double * vals, const unsigned char * bitmap, size_t num_points, int precision, unsigned char * out)
+{
+	const ieee_kernels_t * kernels;
+	ieee_encode_t encode;
+	size_t size = ieee_size(precision);
+	unsigned char * p = out;
+	size_t n;
+	size_t k;
+
+	if (size == 0) {
+		return 0;
+	}
+	kernels = select_kernels();
+	encode = (size == 4) ? kernels->encode32 : kernels->encode64;
+
+	for (n = 0; n < num_points;) {
+		if (bitmap != NULL && bitmap[n] == 0) {
+			n++;
+			continue;
+		}
+		for (k = n + 1; k < num_points && (bitmap == NULL || bitmap[k] == 1); k++);
+		encode(vals + n, k - n, p);
+		p += (k - n) * size;
+		n = k;
+	}
+	return (size_t)(p - out);
+}
+
+/* Swaps big endian 32 bit IEEE values in place to the byte order of the host,
+ * nothing to do on big endian hosts. Afterwards the values can be read as
+ * floats right from the buffer.
+ *
+ * @param[inout] buf The values.
+ * @param[in] count Number of values.
+ */
+void ieee_swap32(unsigned char * buf, size_t count)
+{
+	if (!little_endian()) {
+		return;
+	}
+	select_kernels()->swap32(buf, count);
+}
@@ -0,0 +1,18 @@
+#ifndef __IEEE_FLOAT__H__
+#define __IEEE_FLOAT__H__
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int unpack_ieee(const unsigned char * buf, size_t len, int precision, int native, const unsigned char * bitmap, size_t num_points, double * out);
+size_t pack_ieee(const double * vals, const unsigned char * bitmap, size_t num_points, int precision, unsigned char * out);
+void ieee_swap32(unsigned char * buf, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,543 @@
+#include <jpeg2000.h>
+#include <grib2.h>
+#include <workpool.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_JASPER
+#include <jasper/jasper.h>
+#endif
+#ifdef HAVE_OPENJPEG
+#include <openjpeg.h>
+#endif
+
+/* Decoding of JPEG2000 code streams, template 5.40.
+ *
+ * The backends are selected at build time by defining HAVE_JASPER and/or
+ * HAVE_OPENJPEG, JPEG2000_DEFAULT may name the backend used by default,
+ * otherwise the first one available is used. At run time the backend is
+ * chosen by the environment variable GRIB_JPEG2000 or by jpeg2000_select().
+ *
+ * Every backend decodes a code stream directly onto the grid: the values are
+ * scaled and scattered according to the bitmap. Points beyond the image, or
+ * all points if there is no image or it cannot be decoded, unpack to the
+ * reference value. A backend may also decode an area of the image only, for
+ * grids without bitmap the image is the grid.
+ */
+
+typedef struct {
+	const jpeg2000_backend_t * backend; /* backend the data belongs to */
+	void * data;
+} jpeg2000_state_t;
+
+static pthread_once_t jpeg2000_once = PTHREAD_ONCE_INIT;
+static const jpeg2000_backend_t * jpeg2000_selected = NULL;
+static unsigned int jpeg2000_num_threads = 0;
+
+/* Fills the points of the grid from n on, there are no more values. */
+static void jpeg2000_fill(size_t n, double ref, const unsigned char * bitmap, size_t num_points, double * out) /* {{{ */
+{
+	for (; n < num_points; n++) {
+		out[n] = (bitmap == NULL || bitmap[n] == 1) ? ref : GRIB_MISSING_VALUE;
+	}
+} /* }}} */
+
+#ifdef HAVE_JASPER
+
+typedef struct {
+	jas_matrix_t * row; /* row of the image, reused for all fields */
+	int width; /* capacity of the row */
+} jasper_state_t;
+
+/* Returns a row large enough for an image of the specified width. */
+static jas_matrix_t * jasper_row(jasper_state_t * s, int width) /* {{{ */
+{
+	if (s->row == NULL || s->width < width) {
+		if (s->row != NULL) {
+			jas_matrix_destroy(s->row);
+		}
+		s->row = jas_matrix_create(1, width);
+		s->width = (s->row == NULL) ? 0 : width;
+	}
+	return s->row;
+} /* }}} */
+
+/* Decodes the image of a code stream, the image is NULL if the code stream
+ * is empty. */
+static int jasper_image(const unsigned char * buf, size_t len, jas_stream_t ** jpcstream, jas_image_t ** image) /* {{{ */
+{
+	*jpcstream = NULL;
+	*image = NULL;
+	if (len == 0) {
+		return 0;
+	}
+	*jpcstream = jas_stream_memopen((char *)buf, (int)len);
+	*image = (*jpcstream == NULL) ? NULL : jpc_decode(*jpcstream, NULL);
+	if (*image == NULL) {
+		fprintf(stderr, "Error: cannot decode JPEG2000 code stream\n");
+		return -3;
+	}
+	if ((*image)->numcmpts_ != 1) {
+		/* expecting a grayscale image, no color components */
+		fprintf(stderr, "Error: JPEG2000 color image found, grayscale expected\n");
+		return -5;
+	}
+	return 0;
+} /* }}} */
+
+/* Decodes with Jasper. The image is read row by row, every row is scaled and
+ * scattered while it is in cache. */
+static int jasper_decode(void ** state, const unsigned char * buf, size_t len, double ref, double scale, const unsigned char * bitmap, size_t num_points, double * out) /* {{{ */
+{
+	jasper_state_t * s = (jasper_state_t *)*state;
+	jas_stream_t * jpcstream = NULL;
+	jas_image_t * image = NULL;
+	jas_image_cmpt_t * pcmpt;
+	jas_matrix_t * row;
+	const jas_seqent_t * v;
+	size_t n = 0;
+	int x;
+	int y;
+	int rc;
+
+	if (s == NULL) {
+		s = (jasper_state_t *)calloc(1, sizeof(jasper_state_t));
+		*state = s;
+	}
+
+	rc = (s == NULL) ? -1 : jasper_image(buf, len, &jpcstream, &image);
+	if (image != NULL && rc == 0) {
+		pcmpt = image->cmpts_[0];
+		row = jasper_row(s, pcmpt->width_);
+		for (y = 0; row != NULL && y < pcmpt->height_ && n < num_points; y++) {
+			jas_image_readcmpt(image, 0, 0, y, pcmpt->width_, 1, row);
+			v = row->rows_[0];
+			if (bitmap == NULL) {
+				for (x = 0; x < pcmpt->width_ && n < num_points; x++) {
+					out[n++] = ref + v[x] * scale;
+				}
+			} else {
+				for (x = 0; x < pcmpt->width_ && n < num_points; n++) {
+					out[n] = (bitmap[n] == 1) ? ref + v[x++] * scale : GRIB_MISSING_VALUE;
+				}
+			}
+		}
+	}
+	jpeg2000_fill(n, ref, bitmap, num_points, out);
+
+	if (image != NULL) jas_image_destroy(image);
+	if (jpcstream != NULL) jas_stream_close(jpcstream);
+	return rc;
+} /* }}} */
+
+/* Decodes an area with Jasper. Jasper always decodes the whole code stream,
+ * only the rows and columns of the area are read from the image. */
+static int jasper_decode_area(void ** state, const unsigned char * buf, size_t len, double ref, double scale, const jpeg2000_area_t * area, double * out) /* {{{ */
+{
+	jasper_state_t * s = (jasper_state_t *)*state;
+	jas_stream_t * jpcstream = NULL;
+	jas_image_t * image = NULL;
+	jas_image_cmpt_t * pcmpt;
+	jas_matrix_t * row;
+	const jas_seqent_t * v;
+	size_t x;
+	size_t y;
+	int rc;
+
+	if (s == NULL) {
+		s = (jasper_state_t *)calloc(1, sizeof(jasper_state_t));
+		*state = s;
+	}
+
+	rc = (s == NULL) ? -1 : jasper_image(buf, len, &jpcstream, &image);
+	if (rc == 0) {
+		pcmpt = (image == NULL) ? NULL : image->cmpts_[0];
+		if (pcmpt == NULL || area->x0 + area->width > (size_t)pcmpt->width_ || area->y0 + area->height > (size_t)pcmpt->height_) {
+			rc = -2;
+		}
+	}
+	if (rc == 0) {
+		row = jasper_row(s, (int)area->width);
+		for (y = 0; row != NULL && y < area->height; y++) {
+			jas_image_readcmpt(image, 0, (int)area->x0, (int)(area->y0 + y), (int)area->width, 1, row);
+			v = row->rows_[0];
+			for (x = 0; x < area->width; x++) {
+				out[y * area->width + x] = ref + v[x] * scale;
+			}
+		}
+		if (row == NULL) rc = -1;
+	}
+
+	if (image != NULL) jas_image_destroy(image);
+	if (jpcstream != NULL) jas_stream_close(jpcstream);
+	return rc;
+} /* }}} */
+
+static void jasper_free(void * state) /* {{{ */
+{
+	jasper_state_t * s = (jasper_state_t *)state;
+
+	if (s->row != NULL) {
+		jas_matrix_destroy(s->row);
+	}
+	free(s);
+} /* }}} */
+
+#endif
+
+#ifdef HAVE_OPENJPEG
+
+/* The code stream OpenJPEG reads from. */
+typedef struct {
+	const unsigned char * buf;
+	size_t len;
+	size_t pos;
+} openjpeg_buffer_t;
+
+static OPJ_SIZE_T openjpeg_read(void * dst, OPJ_SIZE_T n, void * ptr) /* {{{ */
+{
+	openjpeg_buffer_t * b = (openjpeg_buffer_t *)ptr;
+
+	if (b->pos >= b->len) return (OPJ_SIZE_T)-1;
+	if (n > b->len - b->pos) n = b->len - b->pos;
+	memcpy(dst, b->buf + b->pos, n);
+	b->pos += n;
+	return n;
+} /* }}} */
+
+static OPJ_OFF_T openjpeg_skip(OPJ_OFF_T n, void * ptr) /* {{{ */
+{
+	openjpeg_buffer_t * b = (openjpeg_buffer_t *)ptr;
+
+	if (n < 0) return -1;
+	if ((OPJ_UINT64)n > b->len - b->pos) n = (OPJ_OFF_T)(b->len - b->pos);
+	b->pos += (size_t)n;
+	return n;
+} /* }}} */
+
+static OPJ_BOOL openjpeg_seek(OPJ_OFF_T n, void * ptr) /* {{{ */
+{
+	openjpeg_buffer_t * b = (openjpeg_buffer_t *)ptr;
+
+	if (n < 0 || (OPJ_UINT64)n > b->len) return OPJ_FALSE;
+	b->pos = (size_t)n;
+	return OPJ_TRUE;
+} /* }}} */
+
+/* Decodes the image of a code stream, or only the area of it if specified.
+ * The code blocks are decoded by a number of threads, see jpeg2000_threads().
+ * The image is NULL if the code stream is empty. */
+static int openjpeg_image(const unsigned char * buf, size_t len, const jpeg2000_area_t * area, opj_image_t ** image) /* {{{ */
+{
+	openjpeg_buffer_t b;
+	opj_dparameters_t params;
+	opj_stream_t * stream;
+	opj_codec_t * codec;
+	int rc = 0;
+
+	*image = NULL;
+	if (len == 0) {
+		return 0;
+	}
+
+	b.buf = buf;
+	b.len = len;
+	b.pos = 0;
+	stream = opj_stream_create(OPJ_J2K_STREAM_CHUNK_SIZE, OPJ_TRUE);
+	codec = opj_create_decompress(OPJ_CODEC_J2K);
+	opj_set_default_decoder_parameters(&params);
+	if (stream == NULL || codec == NULL || !opj_setup_decoder(codec, &params)) {
+		rc = -1;
+	} else {
+		opj_stream_set_user_data(stream, &b, NULL);
+		opj_stream_set_user_data_length(stream, len);
+		opj_stream_set_read_function(stream, openjpeg_read);
+		opj_stream_set_skip_function(stream, openjpeg_skip);
+		opj_stream_set_seek_function(stream, openjpeg_seek);
+#if OPJ_VERSION_MAJOR > 2 || (OPJ_VERSION_MAJOR == 2 && OPJ_VERSION_MINOR >= 2)
+		opj_codec_set_threads(codec, (int)workpool_threads(jpeg2000_num_threads));
+#endif
+		if (!opj_read_header(stream, codec, image)) {
+			rc = -3;
+		} else if (area != NULL && (area->x0 + area->width > (*image)->x1 - (*image)->x0
+			|| area->y0 + area->height > (*image)->y1 - (*image)->y0)) {
+			rc = -2;
+		} else if (area != NULL && !opj_set_decode_area(codec, *image,
+			(OPJ_INT32)((*image)->x0 + area->x0), (OPJ_INT32)((*image)->y0 + area->y0),
+			(OPJ_INT32)((*image)->x0 + area->x0 + area->width), (OPJ_INT32)((*image)->y0 + area->y0 + area->height))) {
+			rc = -2;
+		} else if (!opj_decode(codec, stream, *image) || !opj_end_decompress(codec, stream)) {
+			rc = -3;
+		}
+	}
+	if (rc == -1 || rc == -3) {
+		fprintf(stderr, "Error: cannot decode JPEG2000 code stream\n");
+	} else if (rc == 0 && (*image)->numcomps != 1) {
+		/* expecting a grayscale image, no color components */
+		fprintf(stderr, "Error: JPEG2000 color image found, grayscale expected\n");
+		rc = -5;
+	} else if (rc == 0 && (*image)->comps[0].data == NULL) {
+		rc = -3;
+	}
+
+	if (codec != NULL) opj_destroy_codec(codec);
+	if (stream != NULL) opj_stream_destroy(stream);
+	return rc;
+} /* }}} */
+
+/* Decodes with OpenJPEG, which decodes into an image of its own. There is no
+ * state kept between fields. */
+static int openjpeg_decode(void ** state, const unsigned char * buf, size_t len, double ref, double scale, const unsigned char * bitmap, size_t num_points, double * out) /* {{{ */
+{
+	opj_image_t * image;
+	const OPJ_INT32 * v;
+	size_t count;
+	size_t n = 0;
+	size_t x;
+	int rc;
+
+	(void)state;
+
+	rc = openjpeg_image(buf, len, NULL, &image);
+	if (image != NULL && rc == 0) {
+		v = image->comps[0].data;
+		count = (size_t)image->comps[0].w * image->comps[0].h;
+		if (bitmap == NULL) {
+			for (x = 0; x < count && n < num_points; x++) {
+				out[n++] = ref + v[x] * scale;
+			}
+		} else {
+			for (x = 0; x < count && n < num_points; n++) {
+				out[n] = (bitmap[n] == 1) ? ref + v[x++] * scale : GRIB_MISSING_VALUE;
+			}
+		}
+	}
+	jpeg2000_fill(n, ref, bitmap, num_points, out);
+
+	if (image != NULL) opj_image_destroy(image);
+	return rc;
+} /* }}} */
+
+/* Decodes an area with OpenJPEG, only the code blocks covering the area are
+ * decoded. */
+static int openjpeg_decode_area(void ** state, const unsigned char * buf, size_t len, double ref, double scale, const jpeg2000_area_t * area, double * out) /* {{{ */
+{
+	opj_image_t * image;
+	const OPJ_INT32 * v;
+	size_t count;
+	size_t x;
+	int rc;
+
+	(void)state;
+
+	rc = openjpeg_image(buf, len, area, &image);
+	if (rc == 0 && (image == NULL || image->comps[0].w != area->width || image->comps[0].h != area->height)) {
+		rc = -2;
+	}
+	if (rc == 0) {
+		v = image->comps[0].data;
+		count = area->width * area->height;
+		for (x = 0; x < count; x++) {
+			out[x] = ref + v[x] * scale;
+		}
+	}
+
+	if (image != NULL) opj_image_destroy(image);
+	return rc;
+} /* }}} */
+
+#endif
+
+static const jpeg2000_backend_t jpeg2000_backends[] = {
+#ifdef HAVE_JASPER
+	{ "jasper", jasper_decode, jasper_decode_area, jasper_free },
+#endif
+#ifdef HAVE_OPENJPEG
+	{ "openjpeg", openjpeg_decode, openjpeg_decode_area, NULL },
+#endif
+	{ NULL, NULL, NULL, NULL }
+};
+
+static void jpeg2000_init(void) /* {{{ */
+{
+	const char * name = getenv(JPEG2000_ENV);
+
+#ifdef HAVE_JASPER
+	jas_init();
+#endif
+#ifdef JPEG2000_DEFAULT
+	jpeg2000_selected = jpeg2000_backend(JPEG2000_DEFAULT);
+#endif
+	if (jpeg2000_selected == NULL) {
+		jpeg2000_selected = jpeg2000_backend_at(0);
+	}
+	if (name != NULL && *name != '\0') {
+		if (jpeg2000_backend(name) == NULL) {
+			fprintf(stderr, "Error: JPEG2000 decoder '%s' not available\n", name);
+		} else {
+			jpeg2000_selected = jpeg2000_backend(name);
+		}
+	}
+} /* }}} */
+
+/* Returns the backend of the specified name, NULL if it is not available. */
+const jpeg2000_backend_t * jpeg2000_backend(const char * name)
+{
+	const jpeg2000_backend_t * b;
+
+	if (name == NULL) return NULL;
+	for (b = jpeg2000_backends; b->name != NULL; ++b) {
+		if (strcmp(b->name, name) == 0) return b;
+	}
+	return NULL;
+}
+
+/* Returns the n-th available backend, NULL if there are not that many. */
+const jpeg2000_backend_t * jpeg2000_backend_at(size_t n)
+{
+	const jpeg2000_backend_t * b;
+
+	for (b = jpeg2000_backends; b->name != NULL; ++b) {
+		if (n-- == 0) return b;
+	}
+	return NULL;
+}
+
+/* Selects the backend used by default, this overrides the environment. Meant
+ * to be called before any decoding starts.
+ *
+ * @param[in] name Name of the backend, e.g. "jasper" or "openjpeg".
+ * @retval 0 Success
+ * @retval -1 The backend is not available
+ */
+int jpeg2000_select(const char * name)
+{
+	const jpeg2000_backend_t * b;
+
+	pthread_once(&jpeg2000_once, jpeg2000_init);
+	b = jpeg2000_backend(name);
+	if (b == NULL) {
+		return -1;
+	}
+	jpeg2000_selected = b;
+	return 0;
+}
+
+/* Sets the number of threads a backend may use to decode a single code
+ * stream, 0 means one per processor (the default). Messages decoded in
+ * parallel use 1, grib2_unpack_parallel() sets it for the duration of the
+ * pool. Not to be called while code streams are decoded.
+ *
+ * @param[in] num_threads Number of threads.
+ * @return The previous number of threads.
+ */
+unsigned int jpeg2000_threads(unsigned int num_threads)
+{
+	unsigned int prev = jpeg2000_num_threads;
+
+	jpeg2000_num_threads = num_threads;
+	return prev;
+}
+
+/* Returns the state of the backend, the state of another backend is
+ * released. NULL if there is no backend or no memory. */
+static jpeg2000_state_t * jpeg2000_state(const jpeg2000_backend_t * backend, void ** state) /* {{{ */
+{
+	jpeg2000_state_t * s;
+
+	if (backend == NULL) {
+		fprintf(stderr, "Error: no JPEG2000 decoder available\n");
+		return NULL;
+	}
+
+	s = (jpeg2000_state_t *)*state;
+	if (s != NULL && s->backend != backend) {
+		jpeg2000_free(state);
+		s = NULL;
+	}
+	if (s == NULL) {
+		s = (jpeg2000_state_t *)malloc(sizeof(jpeg2000_state_t));
+		if (s == NULL) {
+			return NULL;
+		}
+		s->backend = backend;
+		s->data = NULL;
+		*state = s;
+	}
+	return s;
+} /* }}} */
+
+/* Decodes a JPEG2000 code stream and writes the scaled values onto the grid.
+ * The state is kept for the next field, it is released by jpeg2000_free().
+ * Fields of different messages may be decoded in parallel.
+ *
+ * @param[in] backend The backend, NULL for the selected one.
+ * @param[inout] state State of the decoder, points to NULL initially.
+ * @param[in] buf The code stream.
+ * @param[in] len Length of the code stream in bytes.
+ * @param[in] ref Reference value.
+ * @param[in] scale Scale of the values.
+ * @param[in] bitmap Bitmap of the grid, NULL if all points are present.
+ * @param[in] num_points Number of gridpoints.
+ * @param[out] out Gridpoints.
+ * @retval 0 Success
+ * @retval <0 Failure, the gridpoints are set to the reference value
+ */
+int jpeg2000_decode(const jpeg2000_backend_t * backend, void ** state, const unsigned char * buf, size_t len, double ref, double scale, const unsigned char * bitmap, size_t num_points, double * out)
+{
+	jpeg2000_state_t * s;
+
+	pthread_once(&jpeg2000_once, jpeg2000_init);
+	s = jpeg2000_state((backend == NULL) ? jpeg2000_selected : backend, state);
+	if (s == NULL) {
+		jpeg2000_fill(0, ref, bitmap, num_points, out);
+		return -1;
+	}
+	return s->backend->decode(&s->data, buf, len, ref, scale, bitmap, num_points, out);
+}
+
+/* Decodes an area of the image of a JPEG2000 code stream, for grids without
+ * bitmap. Only the values of the area are written, row by row. Depending on
+ * the backend, only the parts of the code stream covering the area are
+ * decoded.
+ *
+ * @param[in] backend The backend, NULL for the selected one.
+ * @param[inout] state State of the decoder, see jpeg2000_decode().
+ * @param[in] buf The code stream.
+ * @param[in] len Length of the code stream in bytes.
+ * @param[in] ref Reference value.
+ * @param[in] scale Scale of the values.
+ * @param[in] area The area, in pixels of the image.
+ * @param[out] out Values of the area.
+ * @retval 0 Success
+ * @retval -2 The area cannot be decoded on its own, e.g. it is not within
+ *     the image, the whole code stream has to be decoded instead
+ * @retval <0 Failure
+ */
+int jpeg2000_decode_area(const jpeg2000_backend_t * backend, void ** state, const unsigned char * buf, size_t len, double ref, double scale, const jpeg2000_area_t * area, double * out)
+{
+	jpeg2000_state_t * s;
+
+	pthread_once(&jpeg2000_once, jpeg2000_init);
+	s = jpeg2000_state((backend == NULL) ? jpeg2000_selected : backend, state);
+	if (s == NULL) {
+		return -1;
+	}
+	if (s->backend->decode_area == NULL || area->width == 0 || area->height == 0) {
+		return -2;
+	}
+	return s->backend->decode_area(&s->data, buf, len, ref, scale, area, out);
+}
+
+/* Releases the state of a decoder. */
+void jpeg2000_free(void ** state)
+{
+	jpeg2000_state_t * s = (jpeg2000_state_t *)*state;
+
+	if (s == NULL) return;
+	if (s->data != NULL && s->backend->free_state != NULL) {
+		s->backend->free_state(s->data);
+	}
+	free(s);
+	*state = NULL;
+}
@@ -0,0 +1,45 @@
+#ifndef __JPEG2000__H__
+#define __JPEG2000__H__
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Environment variable selecting the backend at run time, e.g. "openjpeg". */
+#define JPEG2000_ENV "GRIB_JPEG2000"
+
+/* An area of an image, in pixels. */
+typedef struct {
+	size_t x0;
+	size_t y0;
+	size_t width;
+	size_t height;
+} jpeg2000_area_t;
+
+/* A decoder of JPEG2000 code streams (template 5.40). The decoder scales the
+ * values and scatters them according to the bitmap onto the grid, see
+ * jpeg2000_decode(), or decodes an area only, see jpeg2000_decode_area(),
+ * NULL if not supported. A decoder may keep state for the next field, e.g.
+ * buffers, which is released by free_state. */
+typedef struct {
+	const char * name;
+	int (*decode)(void ** state, const unsigned char * buf, size_t len, double ref, double scale, const unsigned char * bitmap, size_t num_points, double * out);
+	int (*decode_area)(void ** state, const unsigned char * buf, size_t len, double ref, double scale, const jpeg2000_area_t * area, double * out);
+	void (*free_state)(void * state);
+} jpeg2000_backend_t;
+
+const jpeg2000_backend_t * jpeg2000_backend(const char * name);
+const jpeg2000_backend_t * jpeg2000_backend_at(size_t n);
+int jpeg2000_select(const char * name);
+unsigned int jpeg2000_threads(unsigned int num_threads);
+int jpeg2000_decode(const jpeg2000_backend_t * backend, void ** state, const unsigned char * buf, size_t len, double ref, double scale, const unsigned char * bitmap, size_t num_points, double * out);
+int jpeg2000_decode_area(const jpeg2000_backend_t * backend, void ** state, const unsigned char * buf, size_t len, double ref, double scale, const jpeg2000_area_t * area, double * out);
+void jpeg2000_free(void ** state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,157 @@
+#define _DEFAULT_SOURCE
+#include <jpeg2000.h>
+#include <grib2_unpack.h>
+#include <mapped_file.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Compares the throughput of the JPEG2000 backends. The code streams of all
+ * fields of template 5.40 of a file are decoded by every backend available,
+ * a number of times. The values of every backend are compared against those
+ * of the first one.
+ *
+ * Usage: jpeg2000bench file [repeat [threads]]
+ */
+
+typedef struct {
+	const unsigned char * buf; /* code stream, within the mapped file */
+	size_t len;
+	double ref;
+	double scale;
+	unsigned char * bitmap;
+	size_t num_points;
+	double * values; /* values of the first backend */
+} field_t;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Collects the code streams of all JPEG2000 fields of the file. */
+static size_t collect(mapped_file_t * mf, field_t ** fields)
+{
+	GRIBMessage grib;
+	const GRIBMetadata * md;
+	const unsigned char * sec;
+	field_t * f;
+	size_t num = 0;
+	size_t cap = 0;
+	int i;
+
+	memset(&grib, 0, sizeof(grib));
+	*fields = NULL;
+	while (grib2_unpack_metadata_mapped(&grib, mf) == 0) {
+		for (i = 0; i < grib.num_grids; ++i) {
+			md = &grib.grids[i].md;
+			if (md->drs_templ_num != 40 && md->drs_templ_num != 40000) continue;
+			if (num == cap) {
+				cap = (cap == 0) ? 16 : cap * 2;
+				*fields = (field_t *)realloc(*fields, cap * sizeof(field_t));
+			}
+			f = &(*fields)[num++];
+			sec = grib.buffer + md->sec_offset[7];
+			f->len = ((size_t)sec[0] << 24 | (size_t)sec[1] << 16 | (size_t)sec[2] << 8 | sec[3]) - 5;
+			f->buf = sec + 5;
+			f->ref = md->R;
+			f->scale = pow(2.0, md->E) / pow(10.0, md->D);
+			f->num_points = (size_t)md->nx * md->ny;
+			f->bitmap = NULL;
+			if (md->bitmap != NULL) {
+				f->bitmap = (unsigned char *)malloc(f->num_points);
+				memcpy(f->bitmap, md->bitmap, f->num_points);
+			}
+			f->values = (double *)malloc(f->num_points * sizeof(double));
+		}
+	}
+	grib2_free(&grib);
+	return num;
+}
+
+int main(int argc, char ** argv)
+{
+	mapped_file_t mf;
+	const jpeg2000_backend_t * b;
+	field_t * fields;
+	double * out = NULL;
+	void * state;
+	size_t num_fields;
+	size_t num_points = 0;
+	size_t num_bytes = 0;
+	size_t max_points = 0;
+	size_t i;
+	size_t k;
+	size_t n;
+	int repeat = 10;
+	int r;
+	double t;
+	double diff;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s file [repeat [threads]]\n", argv[0]);
+		return 1;
+	}
+	if (argc > 2) repeat = atoi(argv[2]);
+	if (argc > 3) jpeg2000_threads((unsigned int)atoi(argv[3]));
+	if (mapped_file_open(&mf, argv[1]) != 0) {
+		fprintf(stderr, "Error: cannot open %s\n", argv[1]);
+		return 1;
+	}
+
+	num_fields = collect(&mf, &fields);
+	if (num_fields == 0) {
+		fprintf(stderr, "Error: no JPEG2000 fields found in %s\n", argv[1]);
+		mapped_file_close(&mf);
+		return 1;
+	}
+	for (i = 0; i < num_fields; ++i) {
+		num_points += fields[i].num_points;
+		num_bytes += fields[i].len;
+		if (fields[i].num_points > max_points) max_points = fields[i].num_points;
+	}
+	out = (double *)malloc(max_points * sizeof(double));
+	printf("%lu fields, %lu points, %lu bytes of code streams, %d times\n",
+		(unsigned long)num_fields, (unsigned long)num_points, (unsigned long)num_bytes, repeat);
+
+	for (k = 0; (b = jpeg2000_backend_at(k)) != NULL; ++k) {
+		state = NULL;
+		t = now();
+		for (r = 0; r < repeat; ++r) {
+			for (i = 0; i < num_fields; ++i) {
+				jpeg2000_decode(b, &state, fields[i].buf, fields[i].len, fields[i].ref, fields[i].scale,
+					fields[i].bitmap, fields[i].num_points, out);
+			}
+		}
+		t = now() - t;
+
+		/* the same code streams once more, to compare the values */
+		diff = 0.0;
+		for (i = 0; i < num_fields; ++i) {
+			jpeg2000_decode(b, &state, fields[i].buf, fields[i].len, fields[i].ref, fields[i].scale,
+				fields[i].bitmap, fields[i].num_points, (k == 0) ? fields[i].values : out);
+			for (n = 0; k > 0 && n < fields[i].num_points; ++n) {
+				if (fabs(out[n] - fields[i].values[n]) > diff) diff = fabs(out[n] - fields[i].values[n]);
+			}
+		}
+		jpeg2000_free(&state);
+
+		printf("%-10s %8.3f s %10.1f Mpoints/s %8.1f MB/s   max diff %g\n", b->name, t,
+			(t > 0.0) ? num_points * (double)repeat / t * 1e-6 : 0.0,
+			(t > 0.0) ? num_bytes * (double)repeat / t * 1e-6 : 0.0, diff);
+	}
+
+	for (i = 0; i < num_fields; ++i) {
+		free(fields[i].bitmap);
+		free(fields[i].values);
+	}
+	free(fields);
+	free(out);
+	mapped_file_close(&mf);
+	return 0;
+}
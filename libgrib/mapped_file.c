@@ -0,0 +1,117 @@
+#define _DEFAULT_SOURCE
+#define _BSD_SOURCE
+#include <mapped_file.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Maps the entire file read only into memory. The file is expected to be
+ * scanned from the beginning to the end, the kernel is told so.
+ *
+ * @param[out] mf The mapped file.
+ * @param[in] filename Name of the file to map.
+ * @retval 0 Success
+ * @retval -1 Failure
+ */
+int mapped_file_open(mapped_file_t * mf, const char * filename)
+{
+	struct stat st;
+	void * p;
+	int fd;
+
+	if (mf == NULL || filename == NULL) return -1;
+	mf->data = NULL;
+	mf->len = 0;
+	mf->mtime = 0;
+	mf->cursor = 0;
+	mf->advised = 0;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Error: cannot open file '%s'\n", filename);
+		return -1;
+	}
+	if (fstat(fd, &st) != 0) {
+		fprintf(stderr, "Error: cannot read file info of '%s'\n", filename);
+		close(fd);
+		return -1;
+	}
+	mf->mtime = (long)st.st_mtime;
+
+	/* nothing to map */
+	if (st.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+
+	p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); /* the mapping keeps its own reference to the file */
+	if (p == MAP_FAILED) {
+		fprintf(stderr, "Error: cannot map file '%s'\n", filename);
+		return -1;
+	}
+	mf->data = (unsigned char *)p;
+	mf->len = (size_t)st.st_size;
+
+#if defined(MADV_SEQUENTIAL)
+	madvise(mf->data, mf->len, MADV_SEQUENTIAL);
+#endif
+	mapped_file_advise(mf);
+	return 0;
+}
+
+/* Unmaps the file. All messages referencing the mapped data become invalid. */
+void mapped_file_close(mapped_file_t * mf)
+{
+	if (mf == NULL) return;
+	if (mf->data != NULL) {
+		munmap(mf->data, mf->len);
+	}
+	mf->data = NULL;
+	mf->len = 0;
+	mf->mtime = 0;
+	mf->cursor = 0;
+	mf->advised = 0;
+}
+
+/* Asks the kernel to read ahead the range following the read position. The
+ * next range is announced as soon as the read position passed half of the
+ * range announced before, this keeps the number of system calls low. */
+void mapped_file_advise(mapped_file_t * mf)
+{
+#if defined(MADV_WILLNEED)
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t begin;
+	size_t end;
+
+	if (mf == NULL || mf->data == NULL) return;
+	if (mf->advised >= mf->len) return;
+	if (mf->advised > 0 && mf->cursor + MAPPED_FILE_READAHEAD / 2 < mf->advised) return;
+
+	begin = (mf->cursor > mf->advised) ? mf->cursor : mf->advised;
+	begin -= begin % page; /* madvise requires page aligned addresses */
+	end = mf->cursor + MAPPED_FILE_READAHEAD;
+	if (end > mf->len) end = mf->len;
+	if (end > begin) {
+		madvise(mf->data + begin, end - begin, MADV_WILLNEED);
+	}
+	mf->advised = end;
+#else
+	(void)mf;
+#endif
+}
+
+/* Tells the kernel the file is accessed at random positions (e.g. through an
+ * index), which disables the read ahead requested by mapped_file_open(). */
+void mapped_file_random(mapped_file_t * mf)
+{
+#if defined(MADV_RANDOM)
+	if (mf == NULL || mf->data == NULL) return;
+	madvise(mf->data, mf->len, MADV_RANDOM);
+	mf->advised = mf->len;
+#else
+	(void)mf;
+#endif
+}
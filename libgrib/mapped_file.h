@@ -0,0 +1,30 @@
+#ifndef __MAPPED_FILE__H__
+#define __MAPPED_FILE__H__
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Size of the range ahead of the read position the kernel is asked to read ahead. */
+#define MAPPED_FILE_READAHEAD (8 * 1024 * 1024)
+
+typedef struct {
+	unsigned char * data; /* contents of the file, read only */
+	size_t len; /* size of the file in bytes */
+	long mtime; /* time of the last modification of the file, seconds since the epoch */
+	size_t cursor; /* read position, advanced by the unpack functions */
+	size_t advised; /* end of the range already announced to the kernel */
+} mapped_file_t;
+
+int mapped_file_open(mapped_file_t * mf, const char * filename);
+void mapped_file_close(mapped_file_t * mf);
+void mapped_file_advise(mapped_file_t * mf);
+void mapped_file_random(mapped_file_t * mf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
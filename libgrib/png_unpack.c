@@ -0,0 +1,183 @@
+#include <png_unpack.h>
+#ifdef HAVE_PNG
+#include <png.h>
+#endif
+
+/* Decoding of PNG compressed gridpoints, template 5.41.
+ *
+ * The image is read progressively: every row is unpacked and scattered onto
+ * the grid as soon as it is inflated, while it is still in cache. Only the
+ * current row is kept, there is no buffer for the entire image. The packed
+ * values are the pixels of the image, one value per pixel of 1 to 32 bits,
+ * grayscale or true color.
+ *
+ * The file does not depend on the rest of the library, it is shared with
+ * libgrib2.
+ *
+ * PNG support is compiled in by defining HAVE_PNG.
+ */
+
+#if !defined(GRIB_MISSING_VALUE)
+#define GRIB_MISSING_VALUE (1.e30)
+#endif
+
+#ifdef HAVE_PNG
+
+typedef struct {
+	double ref;
+	double scale;
+	const unsigned char * bitmap;
+	size_t num_points;
+	double * out;
+	size_t n; /* next point of the grid */
+	size_t width; /* pixels per row */
+	size_t height; /* rows of the image, 0 until the header is read */
+	size_t rows; /* rows delivered */
+	size_t bpp; /* bits per pixel */
+} png_unpack_t;
+
+/* Returns the value of a pixel of a row, multi byte pixels are big endian. */
+static unsigned long unpack_png_pixel(png_const_bytep row, size_t x, size_t bpp) /* {{{ */
+{
+	const unsigned char * b;
+
+	switch (bpp) {
+		case 8:
+			return row[x];
+		case 16:
+			b = row + x * 2;
+			return (unsigned long)b[0] << 8 | b[1];
+		case 24:
+			b = row + x * 3;
+			return (unsigned long)b[0] << 16 | (unsigned long)b[1] << 8 | b[2];
+		case 32:
+			b = row + x * 4;
+			return (unsigned long)b[0] << 24 | (unsigned long)b[1] << 16 | (unsigned long)b[2] << 8 | b[3];
+		default: /* 1, 2 or 4 bits, most significant first */
+			return (row[x * bpp / 8] >> (8 - bpp - x * bpp % 8)) & ((1u << bpp) - 1);
+	}
+} /* }}} */
+
+static void unpack_png_info(png_structp png, png_infop info) /* {{{ */
+{
+	png_unpack_t * p = (png_unpack_t *)png_get_progressive_ptr(png);
+
+	if (png_get_interlace_type(png, info) != PNG_INTERLACE_NONE || png_get_color_type(png, info) == PNG_COLOR_TYPE_PALETTE) {
+		png_error(png, "interlaced or palette images are not supported");
+	}
+	p->width = png_get_image_width(png, info);
+	p->height = png_get_image_height(png, info);
+	p->bpp = (size_t)png_get_bit_depth(png, info) * png_get_channels(png, info);
+	if (p->bpp > 32) {
+		png_error(png, "too many bits per pixel");
+	}
+	png_start_read_image(png);
+} /* }}} */
+
+static void unpack_png_row(png_structp png, png_bytep row, png_uint_32 row_num, int pass) /* {{{ */
+{
+	png_unpack_t * p = (png_unpack_t *)png_get_progressive_ptr(png);
+	const unsigned char * bitmap = p->bitmap;
+	double * out = p->out;
+	size_t n = p->n;
+	size_t x;
+
+	(void)row_num;
+	(void)pass;
+
+	if (row == NULL) {
+		return;
+	}
+	p->rows++;
+	if (bitmap == NULL) {
+		for (x = 0; x < p->width && n < p->num_points; x++) {
+			out[n++] = p->ref + unpack_png_pixel(row, x, p->bpp) * p->scale;
+		}
+	} else {
+		for (x = 0; x < p->width && n < p->num_points; n++) {
+			out[n] = (bitmap[n] == 1) ? p->ref + unpack_png_pixel(row, x++, p->bpp) * p->scale : GRIB_MISSING_VALUE;
+		}
+	}
+	p->n = n;
+} /* }}} */
+
+/* Decodes the image, the rows are unpacked as they are inflated. A truncated
+ * image (not all rows delivered) is a failure. */
+static int unpack_png_image(png_unpack_t * p, const unsigned char * buf, size_t len) /* {{{ */
+{
+	png_structp png;
+	png_infop info = NULL;
+
+	png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	if (png != NULL) {
+		info = png_create_info_struct(png);
+	}
+	if (png == NULL || info == NULL) {
+		png_destroy_read_struct(&png, NULL, NULL);
+		return -1;
+	}
+	if (setjmp(png_jmpbuf(png))) {
+		fprintf(stderr, "Error: cannot decode PNG image\n");
+		png_destroy_read_struct(&png, &info, NULL);
+		return -1;
+	}
+	png_set_progressive_read_fn(png, p, unpack_png_info, unpack_png_row, NULL);
+	png_process_data(png, info, (png_bytep)buf, len);
+	png_destroy_read_struct(&png, &info, NULL);
+	if (p->height == 0 || p->rows < p->height) {
+		fprintf(stderr, "Error: PNG image truncated after %lu rows\n", (unsigned long)p->rows);
+		return -1;
+	}
+	return 0;
+} /* }}} */
+
+#endif
+
+/* Decodes PNG compressed gridpoints and writes the scaled values directly
+ * onto the grid. Points beyond the image unpack to the reference value.
+ *
+ * @param[in] buf The PNG image.
+ * @param[in] len Length of the image in bytes, 0 if there is no image.
+ * @param[in] bits Number of bits of the packed values, 0 for a constant field.
+ * @param[in] ref Reference value, already scaled by 10^-D.
+ * @param[in] scale Combined scale factor 2^E * 10^-D.
+ * @param[in] bitmap One byte per point, 1 if the point is present. NULL if all
+ *     points are present.
+ * @param[in] num_points Number of gridpoints.
+ * @param[out] out The gridpoints, must hold 'num_points' values.
+ * @retval 0 Success
+ * @retval -1 Failure
+ */
+int unpack_png(const unsigned char * buf, size_t len, size_t bits, double ref, double scale, const unsigned char * bitmap, size_t num_points, double * out)
+{
+	size_t n = 0;
+	int rc = 0;
+#ifdef HAVE_PNG
+	png_unpack_t p;
+
+	if (bits > 0 && len > 0) {
+		p.ref = ref;
+		p.scale = scale;
+		p.bitmap = bitmap;
+		p.num_points = num_points;
+		p.out = out;
+		p.n = 0;
+		p.height = 0;
+		p.rows = 0;
+		rc = unpack_png_image(&p, buf, len);
+		n = p.n;
+	}
+#else
+	if (bits > 0 && len > 0) {
+		fprintf(stderr, "Error: PNG support not available\n");
+		return -1;
+	}
+	(void)buf;
+	(void)scale;
+#endif
+
+	for (; n < num_points; n++) {
+		out[n] = (bitmap == NULL || bitmap[n] == 1) ? ref : GRIB_MISSING_VALUE;
+	}
+	return rc;
+}
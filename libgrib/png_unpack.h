@@ -0,0 +1,16 @@
+#ifndef __PNG_UNPACK__H__
+#define __PNG_UNPACK__H__
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int unpack_png(const unsigned char * buf, size_t len, size_t bits, double ref, double scale, const unsigned char * bitmap, size_t num_points, double * out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,254 @@
+#include <readahead.h>
+#include <scan.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Read-ahead of messages on a background thread.
+ *
+ * The thread reads the messages of a stream through the read function of the
+ * caller and frames them: junk between messages is dropped, every message is
+ * read as a whole into one of the buffers of a ring. While a message is being
+ * unpacked, the thread reads the following ones into the other buffers.
+ *
+ * The messages are available in two ways: readahead_next() hands out the
+ * buffers themselves, to be unpacked in place, and readahead_read() is a read
+ * function passing the messages on byte by byte, usable everywhere a read
+ * function is expected (e.g. grib2_unpack(), with the read-ahead as pointer).
+ */
+
+typedef struct {
+	pool_t storage;
+	size_t len; /* length of the message within the storage */
+} readahead_slot_t;
+
+struct readahead_t {
+	int (*read_func)(void *, unsigned int, void *);
+	void * ptr;
+	int edition;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t filled; /* signaled by the thread if a message was read or the end is reached */
+	pthread_cond_t drained; /* signaled if a buffer was released */
+	readahead_slot_t * slots;
+	size_t num_slots;
+	size_t head; /* the buffer read from */
+	size_t count; /* number of buffers containing a message, the one read from included */
+	int done; /* no more messages, set by the thread */
+	int stop; /* the thread has to terminate */
+	int current; /* the buffer 'head' is being read */
+	size_t pos; /* read position within the buffer 'head' */
+};
+
+/* Reads the next message of the stream into a buffer. */
+static int readahead_frame(readahead_t * ra, readahead_slot_t * slot) /* {{{ */
+{
+	unsigned char temp[16];
+	size_t hdr = (ra->edition == 1) ? 8 : 16; /* length of the part of the indicator section containing the length */
+	size_t have = 0;
+	size_t total;
+	size_t k;
+
+	for (;;) {
+		if (have < hdr) {
+			if (ra->read_func(&temp[have], hdr - have, ra->ptr) != (int)(hdr - have)) return -1;
+			have = hdr;
+		}
+		k = grib_find_message(temp, hdr, ra->edition);
+		if (k == 0) break;
+		if (k == hdr) {
+			/* no candidate with a complete header, keep the bytes which may start one */
+			k = hdr - (GRIB_SCAN_HEADER - 1);
+		}
+		memmove(temp, &temp[k], hdr - k);
+		have = hdr - k;
+	}
+
+	if (ra->edition == 1) {
+		total = ((size_t)temp[4] << 16) | ((size_t)temp[5] << 8) | (size_t)temp[6];
+	} else {
+		total = ((size_t)temp[12] << 24) | ((size_t)temp[13] << 16) | ((size_t)temp[14] << 8) | (size_t)temp[15];
+	}
+	if (total < hdr + 4 || pool_reserve(&slot->storage, total) == NULL) {
+		return -1;
+	}
+	memcpy(slot->storage.data, temp, hdr);
+	if (ra->read_func((unsigned char *)slot->storage.data + hdr, total - hdr, ra->ptr) != (int)(total - hdr)) {
+		return -1;
+	}
+	slot->len = total;
+	return 0;
+} /* }}} */
+
+static void * readahead_main(void * arg) /* {{{ */
+{
+	readahead_t * ra = (readahead_t *)arg;
+	size_t tail = 0;
+	int rc;
+
+	for (;;) {
+		pthread_mutex_lock(&ra->lock);
+		while (ra->count == ra->num_slots && !ra->stop) {
+			pthread_cond_wait(&ra->drained, &ra->lock);
+		}
+		if (ra->stop) {
+			pthread_mutex_unlock(&ra->lock);
+			break;
+		}
+		pthread_mutex_unlock(&ra->lock);
+
+		/* the buffer 'tail' is not used by the consumer, it is read without the lock */
+		rc = readahead_frame(ra, &ra->slots[tail]);
+
+		pthread_mutex_lock(&ra->lock);
+		if (rc == 0) {
+			ra->count++;
+			tail = (tail + 1) % ra->num_slots;
+		} else {
+			ra->done = 1;
+		}
+		pthread_cond_signal(&ra->filled);
+		pthread_mutex_unlock(&ra->lock);
+		if (rc != 0) break;
+	}
+	return NULL;
+} /* }}} */
+
+/* Starts the read-ahead of the messages of a stream.
+ *
+ * @param[in] read_func Function to read the stream, called by the background
+ *     thread only, until readahead_close() returns.
+ * @param[in] ptr Pointer passed to the read function.
+ * @param[in] edition Edition of the messages, 1 or 2.
+ * @param[in] num_buffers Number of message buffers, the one being unpacked
+ *     included, 0 for READAHEAD_BUFFERS.
+ * @return The read-ahead, NULL on failure.
+ */
+readahead_t * readahead_open(int (*read_func)(void *, unsigned int, void *), void * ptr, int edition, size_t num_buffers)
+{
+	readahead_t * ra;
+
+	if (read_func == NULL || (edition != 1 && edition != 2)) {
+		return NULL;
+	}
+	if (num_buffers == 0) num_buffers = READAHEAD_BUFFERS;
+
+	ra = (readahead_t *)calloc(1, sizeof(readahead_t));
+	if (ra == NULL) {
+		return NULL;
+	}
+	ra->slots = (readahead_slot_t *)calloc(num_buffers, sizeof(readahead_slot_t));
+	if (ra->slots == NULL) {
+		free(ra);
+		return NULL;
+	}
+	ra->read_func = read_func;
+	ra->ptr = ptr;
+	ra->edition = edition;
+	ra->num_slots = num_buffers;
+	pthread_mutex_init(&ra->lock, NULL);
+	pthread_cond_init(&ra->filled, NULL);
+	pthread_cond_init(&ra->drained, NULL);
+	if (pthread_create(&ra->thread, NULL, readahead_main, ra) != 0) {
+		fprintf(stderr, "Error: cannot start the read-ahead thread\n");
+		pthread_cond_destroy(&ra->drained);
+		pthread_cond_destroy(&ra->filled);
+		pthread_mutex_destroy(&ra->lock);
+		free(ra->slots);
+		free(ra);
+		return NULL;
+	}
+	return ra;
+}
+
+/* Returns the next message. The buffer of the previous message is handed back
+ * to the read-ahead, the message returned is valid until the next call.
+ *
+ * @param[in] ra The read-ahead.
+ * @param[out] buf The message.
+ * @param[out] len Length of the message in bytes.
+ * @retval 0 Success
+ * @retval -1 No more messages
+ */
+int readahead_next(readahead_t * ra, const unsigned char ** buf, size_t * len)
+{
+	pthread_mutex_lock(&ra->lock);
+	if (ra->current) {
+		ra->head = (ra->head + 1) % ra->num_slots;
+		ra->count--;
+		ra->current = 0;
+		pthread_cond_signal(&ra->drained);
+	}
+	while (ra->count == 0 && !ra->done) {
+		pthread_cond_wait(&ra->filled, &ra->lock);
+	}
+	if (ra->count == 0) {
+		pthread_mutex_unlock(&ra->lock);
+		return -1;
+	}
+	ra->current = 1;
+	ra->pos = 0;
+	pthread_mutex_unlock(&ra->lock);
+
+	*buf = (const unsigned char *)ra->slots[ra->head].storage.data;
+	*len = ra->slots[ra->head].len;
+	return 0;
+}
+
+/* Read function passing on the messages read ahead, the pointer is the
+ * read-ahead. Must not be mixed with readahead_next().
+ *
+ * @param[out] buf Buffer to read into.
+ * @param[in] len Number of bytes to read.
+ * @param[in] ptr The read-ahead.
+ * @return Number of bytes read, less than requested at the end of the stream.
+ */
+int readahead_read(void * buf, unsigned int len, void * ptr)
+{
+	readahead_t * ra = (readahead_t *)ptr;
+	const readahead_slot_t * slot;
+	const unsigned char * msg;
+	size_t msg_len;
+	size_t n = 0;
+	size_t k;
+
+	if (ra == NULL || buf == NULL) return 0;
+
+	while (n < len) {
+		slot = &ra->slots[ra->head];
+		if (!ra->current || ra->pos == slot->len) {
+			if (readahead_next(ra, &msg, &msg_len) != 0) break;
+			slot = &ra->slots[ra->head];
+		}
+		k = slot->len - ra->pos;
+		if (k > len - n) k = len - n;
+		memcpy((unsigned char *)buf + n, (const unsigned char *)slot->storage.data + ra->pos, k);
+		ra->pos += k;
+		n += k;
+	}
+	return (int)n;
+}
+
+/* Stops the read-ahead and releases all buffers. Waits for the read function
+ * if the thread is within it. */
+void readahead_close(readahead_t * ra)
+{
+	size_t i;
+
+	if (ra == NULL) return;
+
+	pthread_mutex_lock(&ra->lock);
+	ra->stop = 1;
+	pthread_cond_signal(&ra->drained);
+	pthread_mutex_unlock(&ra->lock);
+	pthread_join(ra->thread, NULL);
+
+	pthread_cond_destroy(&ra->drained);
+	pthread_cond_destroy(&ra->filled);
+	pthread_mutex_destroy(&ra->lock);
+	for (i = 0; i < ra->num_slots; i++) {
+		pool_free(&ra->slots[i].storage);
+	}
+	free(ra->slots);
+	free(ra);
+}
@@ -0,0 +1,25 @@
+#ifndef __READAHEAD__H__
+#define __READAHEAD__H__
+
+#include <arena.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Default number of message buffers, the one being unpacked included. */
+#define READAHEAD_BUFFERS 2
+
+typedef struct readahead_t readahead_t;
+
+readahead_t * readahead_open(int (*read_func)(void *, unsigned int, void *), void * ptr, int edition, size_t num_buffers);
+int readahead_next(readahead_t * ra, const unsigned char ** buf, size_t * len);
+int readahead_read(void * buf, unsigned int len, void * ptr);
+void readahead_close(readahead_t * ra);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,293 @@
+#include <scale.h>
+#include <bits.h>
+#include <workpool.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCALE_X86
+#include <immintrin.h>
+#endif
+
+/* Number of points unpacked and scaled at once. */
+#define SCALE_CHUNK 1024
+
+/* Number of parts per thread a field is split into, see unpack_scaled_split(). */
+#define SPLIT_PARTS 4
+
+/* Fused unpacking and scaling of packed gridpoints.
+ *
+ * Packed values are converted into physical values according to
+ *
+ *    Y = (R + X * 2^E) * 10^-D = ref + X * scale
+ *
+ * with ref = R * 10^-D and scale = 2^E * 10^-D being computed once per field by
+ * the caller. Points not present in the bitmap are set to GRIB_MISSING_VALUE.
+ */
+
+typedef void (*scale_kernel_t)(const int *, double, double, const unsigned char *, size_t, double *);
+
+/* Returns true if the next four points are present in the bitmap. */
+static int bitmap_run4(const unsigned char * bitmap)
+{
+	uint32_t v;
+	memcpy(&v, bitmap, sizeof(v));
+	return v == 0x01010101;
+}
+
+static void scale_values_scalar(const int * vals, double ref, double scale, const unsigned char * bitmap, size_t num_points, double * out)
+{
+	size_t n;
+
+	if (bitmap == NULL) {
+		for (n = 0; n < num_points; n++) {
+			out[n] = ref + vals[n] * scale;
+		}
+	} else {
+		for (n = 0; n < num_points; n++) {
+			out[n] = (bitmap[n] == 1) ? ref + *vals++ * scale : GRIB_MISSING_VALUE;
+		}
+	}
+}
+
+#if defined(SCALE_X86)
+
+/* Converts and scales 4 values per instruction, runs of present points within
+ * a bitmap are processed the same way. */
+__attribute__((target("avx2")))
+static void scale_values_avx2(const int * vals, double ref, double scale, const unsigned char * bitmap, size_t num_points, double * out)
+{
+	__m256d r = _mm256_set1_pd(ref);
+	__m256d s = _mm256_set1_pd(scale);
+	__m256d v;
+	size_t n = 0;
+
+	if (bitmap == NULL) {
+		for (; n + 4 <= num_points; n += 4) {
+			v = _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i *)(vals + n)));
+			_mm256_storeu_pd(out + n, _mm256_add_pd(r, _mm256_mul_pd(v, s)));
+		}
+		for (; n < num_points; n++) {
+			out[n] = ref + vals[n] * scale;
+		}
+	} else {
+		while (n < num_points) {
+			if (n + 4 <= num_points && bitmap_run4(bitmap + n)) {
+				v = _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i *)vals));
+				_mm256_storeu_pd(out + n, _mm256_add_pd(r, _mm256_mul_pd(v, s)));
+				vals += 4;
+				n += 4;
+			} else {
+				out[n] = (bitmap[n] == 1) ? ref + *vals++ * scale : GRIB_MISSING_VALUE;
+				n++;
+			}
+		}
+	}
+}
+
+#endif
+
+static scale_kernel_t scale_kernel = NULL;
+static pthread_once_t scale_once = PTHREAD_ONCE_INIT;
+
+static scale_kernel_t select_scale_kernel(void)
+{
+#if defined(SCALE_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return scale_values_avx2;
+#endif
+	return scale_values_scalar;
+}
+
+/* Selects the kernel on first use, see pthread_once(). */
+static void scale_init(void)
+{
+	scale_kernel = select_scale_kernel();
+}
+
+/* Scales unpacked values and scatters them onto the grid.
+ *
+ * @param[in] vals Unpacked values, one for every point present in the bitmap.
+ * @param[in] ref Reference value, already scaled by 10^-D.
+ * @param[in] scale Combined scale factor 2^E * 10^-D.
+ * @param[in] bitmap One byte per point, 1 if the point is present. NULL if all
+ *     points are present.
+ * @param[in] num_points Number of gridpoints.
+ * @param[out] out The gridpoints, must hold 'num_points' values.
+ */
+void scale_values(const int * vals, double ref, double scale, const unsigned char * bitmap, size_t num_points, double * out)
+{
+	pthread_once(&scale_once, scale_init);
+	scale_kernel(vals, ref, scale, bitmap, num_points, out);
+}
+
+/* Unpacks simple packed values and writes the scaled values directly onto
+ * the grid. The values are unpacked in chunks, there is no intermediate
+ * buffer for the entire field.
+ *
+ * @param[in] buf GRIB buffer as a stream of bytes.
+ * @param[inout] off Offset in BITS to the first packed value, on return the
+ *     offset behind the last value consumed.
+ * @param[in] bits Width of the packed values in BITS.
+ * @param[in] ref Reference value, already scaled by 10^-D.
+ * @param[in] scale Combined scale factor 2^E * 10^-D.
+ * @param[in] bitmap One byte per point, 1 if the point is present. NULL if all
+ *     points are present.
+ * @param[in] num_points Number of gridpoints.
+ * @param[out] out The gridpoints, must hold 'num_points' values.
+ * @retval 0 Success
+ * @retval -1 Failure
+ */
+int unpack_scaled(const unsigned char * buf, size_t * off, size_t bits, double ref, double scale, const unsigned char * bitmap, size_t num_points, double * out)
+{
+	int vals[SCALE_CHUNK];
+	size_t base;
+	size_t num;
+	size_t cnt;
+	size_t n;
+
+	for (base = 0; base < num_points; base += num) {
+		num = num_points - base;
+		if (num > SCALE_CHUNK) num = SCALE_CHUNK;
+		if (bitmap == NULL) {
+			cnt = num;
+		} else {
+			for (cnt = 0, n = 0; n < num; n++) {
+				if (bitmap[base + n] == 1) cnt++;
+			}
+		}
+		if (get_bits_array(buf, *off, bits, cnt, vals) != 0) return -1;
+		*off += cnt * bits;
+		scale_values(vals, ref, scale, (bitmap == NULL) ? NULL : bitmap + base, num, out + base);
+	}
+	return 0;
+}
+
+static size_t split_min_points = UNPACK_SPLIT_MIN_POINTS;
+static unsigned int split_threads = 0;
+
+/* Configures splitting fields across threads, see unpack_scaled_split(). Not
+ * to be called while fields are unpacked.
+ *
+ * @param[in] min_points Minimum number of gridpoints of a field to be split.
+ * @param[in] num_threads Number of threads, 0 for one per processor, 1 disables
+ *     splitting.
+ */
+void unpack_split_config(size_t min_points, unsigned int num_threads)
+{
+	split_min_points = min_points;
+	split_threads = num_threads;
+}
+
+/* Sets the number of threads fields are split across, see
+ * unpack_split_config(). Messages unpacked in parallel use 1,
+ * grib2_unpack_parallel() sets it for the duration of the pool.
+ *
+ * @param[in] num_threads Number of threads, 0 for one per processor, 1
+ *     disables splitting.
+ * @return The previous number of threads.
+ */
+unsigned int unpack_split_threads(unsigned int num_threads)
+{
+	unsigned int prev = split_threads;
+
+	split_threads = num_threads;
+	return prev;
+}
+
+typedef struct {
+	const unsigned char * buf;
+	size_t off; /* offset in bits of the first packed value */
+	size_t bits;
+	double ref;
+	double scale;
+	const unsigned char * bitmap;
+	size_t num_points;
+	double * out;
+	size_t part; /* number of gridpoints per part */
+	const size_t * first; /* number of packed values in front of every part */
+	size_t done; /* number of parts unpacked */
+} split_t;
+
+static int split_run(void * ptr, size_t task, size_t slot) /* {{{ */
+{
+	const split_t * s = (const split_t *)ptr;
+	size_t begin = task * s->part;
+	size_t num = (s->num_points - begin < s->part) ? s->num_points - begin : s->part;
+	size_t off = s->off + s->first[task] * s->bits;
+
+	(void)slot;
+	return unpack_scaled(s->buf, &off, s->bits, s->ref, s->scale,
+		(s->bitmap == NULL) ? NULL : s->bitmap + begin, num, s->out + begin);
+} /* }}} */
+
+static int split_emit(void * ptr, size_t task, size_t slot) /* {{{ */
+{
+	(void)task;
+	(void)slot;
+	((split_t *)ptr)->done++;
+	return 0;
+} /* }}} */
+
+/* Same as unpack_scaled(), but a field with many gridpoints is split into
+ * parts unpacked by several threads (see unpack_split_config()). The offset of
+ * the packed values of every part is known in advance, without bitmap from
+ * the number of the first point, with bitmap from the number of points present
+ * in front of the part.
+ */
+int unpack_scaled_split(const unsigned char * buf, size_t * off, size_t bits, double ref, double scale, const unsigned char * bitmap, size_t num_points, double * out)
+{
+	split_t s;
+	size_t * first;
+	size_t num_parts;
+	size_t packed;
+	size_t end;
+	size_t n;
+	size_t k;
+	int rc;
+
+	num_parts = workpool_threads(split_threads) * SPLIT_PARTS;
+	if (num_points < split_min_points || num_parts <= SPLIT_PARTS) {
+		return unpack_scaled(buf, off, bits, ref, scale, bitmap, num_points, out);
+	}
+
+	first = (size_t *)malloc(num_parts * sizeof(size_t));
+	if (first == NULL) {
+		return unpack_scaled(buf, off, bits, ref, scale, bitmap, num_points, out);
+	}
+	s.part = (num_points + num_parts - 1) / num_parts;
+	num_parts = (num_points + s.part - 1) / s.part;
+	for (packed = 0, k = 0; k < num_parts; k++) {
+		first[k] = packed;
+		end = (k + 1) * s.part;
+		if (end > num_points) end = num_points;
+		if (bitmap == NULL) {
+			packed = end;
+		} else {
+			for (n = k * s.part; n < end; n++) {
+				packed += (bitmap[n] == 1);
+			}
+		}
+	}
+
+	s.buf = buf;
+	s.off = *off;
+	s.bits = bits;
+	s.ref = ref;
+	s.scale = scale;
+	s.bitmap = bitmap;
+	s.num_points = num_points;
+	s.out = out;
+	s.first = first;
+	s.done = 0;
+
+	rc = workpool_run(num_parts, split_threads, 0, split_run, split_emit, &s);
+	free(first);
+	if (rc != 0 || s.done != num_parts) {
+		return -1;
+	}
+	*off += packed * bits;
+	return 0;
+}
@@ -0,0 +1,27 @@
+#ifndef __SCALE__H__
+#define __SCALE__H__
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Default minimum number of gridpoints of a field to be unpacked by several threads. */
+#define UNPACK_SPLIT_MIN_POINTS (1024 * 1024)
+
+#if !defined(GRIB_MISSING_VALUE)
+#define GRIB_MISSING_VALUE (1.e30)
+#endif
+
+void scale_values(const int * vals, double ref, double scale, const unsigned char * bitmap, size_t num_points, double * out);
+int unpack_scaled(const unsigned char * buf, size_t * off, size_t bits, double ref, double scale, const unsigned char * bitmap, size_t num_points, double * out);
+int unpack_scaled_split(const unsigned char * buf, size_t * off, size_t bits, double ref, double scale, const unsigned char * bitmap, size_t num_points, double * out);
+void unpack_split_config(size_t min_points, unsigned int num_threads);
+unsigned int unpack_split_threads(unsigned int num_threads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
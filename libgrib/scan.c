@@ -0,0 +1,55 @@
+#include <scan.h>
+#include <string.h>
+
+/* Searches the next message within a block of memory. Candidates are located
+ * with memchr() (vectorized by the C library) on the first letter of the
+ * indicator, then verified. Only candidates with GRIB_SCAN_HEADER bytes
+ * available are reported, a caller scanning a stream in blocks has to keep
+ * the last GRIB_SCAN_HEADER - 1 bytes of a block for the next one.
+ *
+ * @param[in] buf The memory to search.
+ * @param[in] len Size of the memory in bytes.
+ * @param[in] edition Required GRIB edition (octet 8 of the indicator section),
+ *     0 accepts every edition.
+ * @return Offset of the message, 'len' if there is none.
+ */
+size_t grib_find_message(const unsigned char * buf, size_t len, int edition)
+{
+	const unsigned char * p = buf;
+	const unsigned char * end = buf + len;
+
+	while (end - p >= GRIB_SCAN_HEADER) {
+		p = (const unsigned char *)memchr(p, 'G', (size_t)(end - p) - (GRIB_SCAN_HEADER - 1));
+		if (p == NULL) break;
+		if (p[1] == 'R' && p[2] == 'I' && p[3] == 'B' && (edition == 0 || p[7] == edition)) {
+			return (size_t)(p - buf);
+		}
+		p++;
+	}
+	return len;
+}
+
+/* Advances a window of 4 bytes read from a stream towards the indicator "GRIB".
+ * The bytes which may start the indicator are moved to the front of the window,
+ * the caller has to read the returned number of bytes into the end of the window.
+ *
+ * @param[inout] window The last 4 bytes read.
+ * @return Number of bytes to read into the end of the window, 0 if the window
+ *     contains the indicator.
+ */
+size_t grib_magic_shift(unsigned char * window)
+{
+	size_t k;
+
+	if (memcmp(window, "GRIB", 4) == 0) return 0;
+
+	/* the letters of the indicator are distinct, therefore the indicator
+	   can only start at the next 'G' */
+	for (k = 1; k < 4; k++) {
+		if (window[k] == 'G') {
+			memmove(window, window + k, 4 - k);
+			return k;
+		}
+	}
+	return 4;
+}
@@ -0,0 +1,20 @@
+#ifndef __SCAN__H__
+#define __SCAN__H__
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Number of bytes of a message needed to verify the indicator and the edition. */
+#define GRIB_SCAN_HEADER 8
+
+size_t grib_find_message(const unsigned char * buf, size_t len, int edition);
+size_t grib_magic_shift(unsigned char * window);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
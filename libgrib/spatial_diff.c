@@ -0,0 +1,129 @@
+#include <spatial_diff.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define SPATIAL_DIFF_X86
+#include <immintrin.h>
+#endif
+
+/* Undoing spatial differencing of complex packed values, template 5.3.
+ *
+ * First order differencing stores d[n] = x[n] - x[n-1], second order
+ * d[n] = x[n] - 2 x[n-1] + x[n-2], both reduced by the minimum minsd. The
+ * original values are therefore one (first order) or two (second order)
+ * prefix sums of the differences. The prefix sums are computed in vector
+ * registers, each block of values is summed by shifted adds and the sum of
+ * all previous blocks is carried over.
+ *
+ * The values are summed as unsigned integers: the intermediate sums may
+ * wrap, the original values are restored exactly nevertheless.
+ *
+ * The file does not depend on the rest of the library, it is shared with
+ * libgrib2.
+ */
+
+typedef void (*prefix_sum_t)(unsigned int *, size_t);
+
+static void prefix_sum_scalar(unsigned int * v, size_t num) /* {{{ */
+{
+	size_t n;
+
+	for (n = 1; n < num; n++) {
+		v[n] += v[n - 1];
+	}
+} /* }}} */
+
+#if defined(SPATIAL_DIFF_X86)
+
+static void prefix_sum_sse2(unsigned int * v, size_t num) /* {{{ */
+{
+	__m128i carry = _mm_setzero_si128();
+	__m128i x;
+	size_t n = 0;
+
+	for (; n + 4 <= num; n += 4) {
+		x = _mm_loadu_si128((const __m128i *)(v + n));
+		x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+		x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+		x = _mm_add_epi32(x, carry);
+		_mm_storeu_si128((__m128i *)(v + n), x);
+		carry = _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
+	}
+	if (n < num) {
+		if (n > 0) v[n] += v[n - 1];
+		prefix_sum_scalar(v + n, num - n);
+	}
+} /* }}} */
+
+__attribute__((target("avx2")))
+static void prefix_sum_avx2(unsigned int * v, size_t num) /* {{{ */
+{
+	__m256i carry = _mm256_setzero_si256();
+	__m256i last = _mm256_set1_epi32(7);
+	__m256i x;
+	__m256i t;
+	size_t n = 0;
+
+	for (; n + 8 <= num; n += 8) {
+		x = _mm256_loadu_si256((const __m256i *)(v + n));
+		/* prefix sums within both halves */
+		x = _mm256_add_epi32(x, _mm256_slli_si256(x, 4));
+		x = _mm256_add_epi32(x, _mm256_slli_si256(x, 8));
+		/* the sum of the lower half is added to the upper half */
+		t = _mm256_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
+		x = _mm256_add_epi32(x, _mm256_permute2x128_si256(t, t, 0x08));
+		x = _mm256_add_epi32(x, carry);
+		_mm256_storeu_si256((__m256i *)(v + n), x);
+		carry = _mm256_permutevar8x32_epi32(x, last);
+	}
+	if (n < num) {
+		if (n > 0) v[n] += v[n - 1];
+		prefix_sum_scalar(v + n, num - n);
+	}
+} /* }}} */
+
+#endif
+
+static prefix_sum_t select_prefix_sum(void) /* {{{ */
+{
+#if defined(SPATIAL_DIFF_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return prefix_sum_avx2;
+	return prefix_sum_sse2;
+#else
+	return prefix_sum_scalar;
+#endif
+} /* }}} */
+
+/* Restores the original values from spatial differences, in place.
+ *
+ * @param[inout] vals The differences, one for every value which is not
+ *     missing, the original values on return.
+ * @param[in] num Number of values.
+ * @param[in] order Order of the spatial differencing, 1 or 2.
+ * @param[in] ival1 First original value.
+ * @param[in] ival2 Second original value, second order only.
+ * @param[in] minsd Overall minimum of the differences.
+ */
+void spatial_diff_undo(int * vals, size_t num, int order, int ival1, int ival2, int minsd)
+{
+	unsigned int * v = (unsigned int *)vals;
+	prefix_sum_t prefix_sum;
+	size_t first = (order == 2) ? 2 : 1;
+	size_t n;
+
+	if (num == 0 || (order != 1 && order != 2)) {
+		return;
+	}
+	prefix_sum = select_prefix_sum();
+
+	for (n = first; n < num; n++) {
+		v[n] += (unsigned int)minsd;
+	}
+	v[0] = (unsigned int)ival1;
+	if (order == 2 && num > 1) {
+		/* x[n] - x[n-1] is the prefix sum of the second differences */
+		v[1] = (unsigned int)ival2 - (unsigned int)ival1;
+		prefix_sum(v + 1, num - 1);
+	}
+	prefix_sum(v, num);
+}
@@ -0,0 +1,16 @@
+#ifndef __SPATIAL_DIFF__H__
+#define __SPATIAL_DIFF__H__
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void spatial_diff_undo(int * vals, size_t num, int order, int ival1, int ival2, int minsd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,284 @@
+#define _DEFAULT_SOURCE
+#include <workpool.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* Runs a number of independent tasks (e.g. unpacking the messages of a file)
+ * on a pool of threads.
+ *
+ * Every thread owns a deque of tasks, initially a contiguous range of the
+ * tasks. A thread takes its tasks from the front of its deque, a thread
+ * without tasks steals the back half of the largest deque. This keeps all
+ * threads busy even if the costs of the tasks differ a lot.
+ *
+ * Every task is executed into a slot, the storage of the slots is provided by
+ * the caller. Without order, every thread uses its own slot and the result is
+ * emitted as soon as the task is done. With order, the results are emitted in
+ * the order of the tasks: task n uses slot n % num_slots, a task is only
+ * started if its slot is available, i.e. the tasks run at most num_slots
+ * tasks ahead of the output. The results are emitted by the thread which
+ * completes the next task in order.
+ *
+ * Tasks and emits are called without any lock held, there is never more than
+ * one emit at a time. A task which fails aborts the pool like an emit which
+ * fails: no more tasks are started and the results not emitted yet are
+ * dropped.
+ */
+
+enum {
+	SLOT_FREE,
+	SLOT_DONE,
+	SLOT_FAILED
+};
+
+typedef struct {
+	size_t begin;
+	size_t end;
+} workpool_deque_t;
+
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond; /* signaled if tasks may have become available */
+	workpool_deque_t * deques;
+	unsigned int num_threads;
+	size_t num_tasks;
+	size_t num_slots;
+	int * slot_state;
+	int ordered;
+	size_t next_out; /* next task to emit, ordered only */
+	int emitting;
+	int abort;
+	int (*run)(void * ptr, size_t task, size_t slot);
+	int (*emit)(void * ptr, size_t task, size_t slot);
+	void * ptr;
+} workpool_t;
+
+typedef struct {
+	workpool_t * pool;
+	unsigned int id;
+} workpool_worker_t;
+
+#define DEQUE_SIZE(d) ((d)->end - (d)->begin)
+
+/* Takes the next task of a thread, the lock is held.
+ *
+ * @retval 1 A task was taken.
+ * @retval 0 There are tasks, but none may be started now.
+ * @retval -1 No more tasks.
+ */
+static int workpool_take(workpool_t * pool, unsigned int id, size_t * task) /* {{{ */
+{
+	workpool_deque_t * own = &pool->deques[id];
+	workpool_deque_t * d;
+	unsigned int best;
+	unsigned int i;
+	size_t n;
+
+	if (pool->abort) return -1;
+
+	if (DEQUE_SIZE(own) == 0) {
+		best = id;
+		for (i = 0; i < pool->num_threads; ++i) {
+			if (DEQUE_SIZE(&pool->deques[i]) > DEQUE_SIZE(&pool->deques[best])) best = i;
+		}
+		d = &pool->deques[best];
+		if (DEQUE_SIZE(d) == 0) return -1;
+		n = (DEQUE_SIZE(d) + 1) / 2;
+		own->begin = d->end - n;
+		own->end = d->end;
+		d->end -= n;
+	}
+
+	if (!pool->ordered || own->begin < pool->next_out + pool->num_slots) {
+		*task = own->begin++;
+		return 1;
+	}
+
+	/* the own tasks are too far ahead of the output, take the lowest task of all */
+	best = pool->num_threads;
+	for (i = 0; i < pool->num_threads; ++i) {
+		d = &pool->deques[i];
+		if (DEQUE_SIZE(d) > 0 && (best == pool->num_threads || d->begin < pool->deques[best].begin)) best = i;
+	}
+	d = &pool->deques[best];
+	if (d->begin < pool->next_out + pool->num_slots) {
+		*task = d->begin++;
+		return 1;
+	}
+	return 0;
+} /* }}} */
+
+/* Emits the result of a task as soon as no other emit is running, the lock is held. */
+static void workpool_emit(workpool_t * pool, size_t task, size_t slot) /* {{{ */
+{
+	while (pool->emitting && !pool->abort) {
+		pthread_cond_wait(&pool->cond, &pool->lock);
+	}
+	if (pool->slot_state[slot] == SLOT_DONE && !pool->abort) {
+		pool->emitting = 1;
+		pthread_mutex_unlock(&pool->lock);
+		if (pool->emit(pool->ptr, task, slot) != 0) pool->abort = 1;
+		pthread_mutex_lock(&pool->lock);
+		pool->emitting = 0;
+		pthread_cond_broadcast(&pool->cond);
+	}
+	pool->slot_state[slot] = SLOT_FREE;
+} /* }}} */
+
+/* Emits all results which are next in order, unless another thread is doing
+ * so already. The lock is held. */
+static void workpool_emit_ordered(workpool_t * pool) /* {{{ */
+{
+	size_t slot;
+	int rc;
+
+	while (!pool->emitting && !pool->abort && pool->next_out < pool->num_tasks) {
+		slot = pool->next_out % pool->num_slots;
+		if (pool->slot_state[slot] == SLOT_FREE) break;
+		if (pool->slot_state[slot] == SLOT_DONE) {
+			pool->emitting = 1;
+			pthread_mutex_unlock(&pool->lock);
+			rc = pool->emit(pool->ptr, pool->next_out, slot);
+			pthread_mutex_lock(&pool->lock);
+			pool->emitting = 0;
+			if (rc != 0) pool->abort = 1;
+		}
+		pool->slot_state[slot] = SLOT_FREE;
+		pool->next_out++;
+		pthread_cond_broadcast(&pool->cond);
+	}
+} /* }}} */
+
+static void * workpool_main(void * arg) /* {{{ */
+{
+	workpool_worker_t * worker = (workpool_worker_t *)arg;
+	workpool_t * pool = worker->pool;
+	size_t task;
+	size_t slot;
+	int rc;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		rc = workpool_take(pool, worker->id, &task);
+		if (rc < 0) break;
+		if (rc == 0) {
+			pthread_cond_wait(&pool->cond, &pool->lock);
+			continue;
+		}
+		slot = pool->ordered ? task % pool->num_slots : worker->id;
+		pthread_mutex_unlock(&pool->lock);
+		rc = pool->run(pool->ptr, task, slot);
+		pthread_mutex_lock(&pool->lock);
+		pool->slot_state[slot] = (rc == 0) ? SLOT_DONE : SLOT_FAILED;
+		if (rc != 0) {
+			pool->abort = 1;
+			pthread_cond_broadcast(&pool->cond);
+		}
+		if (pool->ordered) {
+			workpool_emit_ordered(pool);
+		} else {
+			workpool_emit(pool, task, slot);
+		}
+	}
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+} /* }}} */
+
+/* Returns the number of threads used for the specified number, 0 means one
+ * thread per processor online. */
+unsigned int workpool_threads(unsigned int num_threads)
+{
+	long n;
+
+	if (num_threads > 0) return num_threads;
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+	return (n > 0) ? (unsigned int)n : 1;
+}
+
+/* Returns the number of slots the caller of workpool_run() has to provide
+ * storage for. */
+size_t workpool_slots(unsigned int num_threads, int ordered)
+{
+	size_t n = workpool_threads(num_threads);
+
+	return ordered ? n * WORKPOOL_WINDOW : n;
+}
+
+/* Runs all tasks and emits their results. The calling thread is one of the
+ * threads of the pool. The first task which fails aborts the pool.
+ *
+ * @param[in] num_tasks Number of tasks.
+ * @param[in] num_threads Number of threads, 0 for one per processor.
+ * @param[in] ordered Emit the results in the order of the tasks.
+ * @param[in] run Executes a task into a slot, returns 0 on success, everything
+ *     else aborts.
+ * @param[in] emit Emits the result of a task from its slot, returns 0 to
+ *     continue, everything else aborts.
+ * @param[in] ptr Pointer passed to the functions.
+ * @retval 0 Success
+ * @retval -1 Failure of a task, aborted by an emit, or no memory
+ */
+int workpool_run(size_t num_tasks, unsigned int num_threads, int ordered, int (*run)(void * ptr, size_t task, size_t slot), int (*emit)(void * ptr, size_t task, size_t slot), void * ptr)
+{
+	workpool_t pool;
+	workpool_worker_t * workers;
+	pthread_t * threads;
+	unsigned int started = 1;
+	unsigned int i;
+	int rc = 0;
+
+	if (run == NULL || emit == NULL) return -1;
+	if (num_tasks == 0) return 0;
+
+	pool.num_slots = workpool_slots(num_threads, ordered);
+	pool.num_threads = workpool_threads(num_threads);
+	if (pool.num_threads > num_tasks) pool.num_threads = (unsigned int)num_tasks;
+	pool.num_tasks = num_tasks;
+	pool.ordered = ordered;
+	pool.next_out = 0;
+	pool.emitting = 0;
+	pool.abort = 0;
+	pool.run = run;
+	pool.emit = emit;
+	pool.ptr = ptr;
+	pool.deques = (workpool_deque_t *)malloc(pool.num_threads * sizeof(workpool_deque_t));
+	pool.slot_state = (int *)calloc(pool.num_slots, sizeof(int));
+	workers = (workpool_worker_t *)malloc(pool.num_threads * sizeof(workpool_worker_t));
+	threads = (pthread_t *)malloc(pool.num_threads * sizeof(pthread_t));
+	if (pool.deques == NULL || pool.slot_state == NULL || workers == NULL || threads == NULL) {
+		free(threads);
+		free(workers);
+		free(pool.slot_state);
+		free(pool.deques);
+		return -1;
+	}
+	for (i = 0; i < pool.num_threads; ++i) {
+		pool.deques[i].begin = num_tasks * i / pool.num_threads;
+		pool.deques[i].end = num_tasks * (i + 1) / pool.num_threads;
+		workers[i].pool = &pool;
+		workers[i].id = i;
+	}
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.cond, NULL);
+
+	/* tasks of threads which cannot be started are stolen by the others */
+	for (i = 1; i < pool.num_threads; ++i) {
+		if (pthread_create(&threads[i], NULL, workpool_main, &workers[i]) != 0) break;
+		started++;
+	}
+	workpool_main(&workers[0]);
+	for (i = 1; i < started; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+	if (pool.abort) rc = -1;
+
+	pthread_cond_destroy(&pool.cond);
+	pthread_mutex_destroy(&pool.lock);
+	free(threads);
+	free(workers);
+	free(pool.slot_state);
+	free(pool.deques);
+	return rc;
+}
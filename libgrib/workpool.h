@@ -0,0 +1,22 @@
+#ifndef __WORKPOOL__H__
+#define __WORKPOOL__H__
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Number of slots per thread in ordered mode, i.e. how far the decoding may
+ * run ahead of the output. */
+#define WORKPOOL_WINDOW 4
+
+unsigned int workpool_threads(unsigned int num_threads);
+size_t workpool_slots(unsigned int num_threads, int ordered);
+int workpool_run(size_t num_tasks, unsigned int num_threads, int ordered, int (*run)(void * ptr, size_t task, size_t slot), int (*emit)(void * ptr, size_t task, size_t slot), void * ptr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -3,6 +3,8 @@
 
 #include <vector>
 #include <istream>
+#include <cstring>
+#include <stdint.h>
 
 /// @TODO: support for const_iterator (partially prepared)
 /// @TODO: support for ranges:
@@ -22,30 +24,79 @@ template <typename Block, class Container = std::vector<Block> > class bitset
 		typedef typename Container::size_type size_type;
 		typedef typename Container::const_iterator data_const_iterator;
 
+		typedef uint64_t cache_type;
+		enum { BITS_PER_CACHE = sizeof(cache_type) * BITS_PER_BYTE };
+
 		class exception : public std::exception {};
 
+		/// Iterator over the bits of the set.
+		///
+		/// Reading values through read() is done using a 64 bit cache register,
+		/// holding the bits following the current position. The cache is refilled
+		/// from the position with one unaligned big endian load (byte blocks) or
+		/// block by block (wider blocks). This requires the container to store
+		/// its blocks contiguously. All other operations which move the iterator
+		/// invalidate the cache.
+		///
 		/// @todo: TEST
-		/// @todo: documentation
 		class const_iterator
 		{
 				friend class bitset;
 			private:
 				const bitset * bs;
 				size_type pos;
+				cache_type cache; // bits following 'pos', most significant bit first
+				size_type cache_bits; // number of valid bits within the cache
 			private:
 				const_iterator(const bitset * const bs, size_type pos)
 					: bs(bs)
 					, pos(pos)
+					, cache(0)
+					, cache_bits(0)
 				{}
+
+				/// Loads the cache with the bits starting at the current position.
+				/// The cache may contain bits beyond the size of the set (up to
+				/// the capacity), reading them is prevented by read().
+				void refill()
+				{
+					const size_type n_blocks = bs->capacity() / BITS_PER_BLOCK;
+					size_type i = pos / BITS_PER_BLOCK;
+					const size_type phase = pos % BITS_PER_BLOCK;
+
+					cache = 0;
+					cache_bits = 0;
+					if (sizeof(block_type) == 1 && i + sizeof(cache_type) <= n_blocks) {
+						cache = load_be(&bs->data[i]);
+						cache_bits = BITS_PER_CACHE;
+					} else {
+						for (; cache_bits + BITS_PER_BLOCK <= BITS_PER_CACHE && i < n_blocks; ++i) {
+							if (static_cast<size_type>(BITS_PER_BLOCK) < BITS_PER_CACHE) cache <<= (BITS_PER_BLOCK % BITS_PER_CACHE);
+							cache |= static_cast<cache_type>(bs->data[i]);
+							cache_bits += BITS_PER_BLOCK;
+						}
+						if (cache_bits > 0 && cache_bits < BITS_PER_CACHE) cache <<= (BITS_PER_CACHE - cache_bits);
+					}
+					if (cache_bits <= phase) {
+						cache_bits = 0;
+					} else {
+						cache <<= phase;
+						cache_bits -= phase;
+					}
+				}
 			public:
 				const_iterator()
 					: bs(NULL)
 					, pos(0)
+					, cache(0)
+					, cache_bits(0)
 				{}
 
 				const_iterator(const const_iterator & other)
 					: bs(other.bs)
 					, pos(other.pos)
+					, cache(other.cache)
+					, cache_bits(other.cache_bits)
 				{}
 
 				size_type get_pos() const
@@ -57,6 +108,8 @@ template <typename Block, class Container = std::vector<Block> > class bitset
 				{
 					bs = other.bs;
 					pos = other.pos;
+					cache = other.cache;
+					cache_bits = other.cache_bits;
 					return *this;
 				}
 
@@ -119,6 +172,7 @@ template <typename Block, class Container = std::vector<Block> > class bitset
 
 				const_iterator & operator += (size_type ofs)
 				{
+					cache_bits = 0;
 					if (bs != NULL && pos < bs->size()) {
 						pos += ofs;
 						if (pos > bs->size()) pos = bs->size();
@@ -128,6 +182,7 @@ template <typename Block, class Container = std::vector<Block> > class bitset
 
 				const_iterator & operator -= (size_type ofs)
 				{
+					cache_bits = 0;
 					if (bs != NULL) {
 						pos = (ofs > pos) ? 0 : pos - ofs;
 					}
@@ -136,6 +191,7 @@ template <typename Block, class Container = std::vector<Block> > class bitset
 
 				const_iterator & operator ++ () // ++const_iterator
 				{
+					cache_bits = 0;
 					if (bs != NULL && pos < bs->size()) {
 						++pos;
 					}
@@ -144,6 +200,7 @@ template <typename Block, class Container = std::vector<Block> > class bitset
 
 				const_iterator & operator -- () // --const_iterator
 				{
+					cache_bits = 0;
 					if (bs != NULL && pos > 0) {
 						--pos;
 					}
@@ -153,6 +210,7 @@ template <typename Block, class Container = std::vector<Block> > class bitset
 				const_iterator operator ++ (int) // const_iterator++
 				{
 					const_iterator res(*this);
+					cache_bits = 0;
 					if (bs != NULL && pos < bs->size()) {
 						++pos;
 					}
@@ -162,6 +220,7 @@ template <typename Block, class Container = std::vector<Block> > class bitset
 				const_iterator operator -- (int) // const_iterator--
 				{
 					const_iterator res(*this);
+					cache_bits = 0;
 					if (bs != NULL && pos > 0) {
 						--pos;
 					}
@@ -175,17 +234,82 @@ template <typename Block, class Container = std::vector<Block> > class bitset
 					bs->get(v, pos, bits);
 				}
 
+				/// Reads the specified number of bits and advances the iterator.
+				/// Values which fit into the cache are read from it, all other
+				/// reads fall back to peek().
 				template <typename T> void read(T & v, size_type bits = sizeof(T) * BITS_PER_BYTE) throw (exception)
 				{
+					if (bs == NULL || bits <= 0) return;
+					if (bits < BITS_PER_CACHE && bits <= sizeof(T) * BITS_PER_BYTE) {
+						if (pos + bits > bs->size()) throw exception();
+						if (bits > cache_bits) refill();
+						if (bits <= cache_bits) {
+							v = static_cast<T>(cache >> (BITS_PER_CACHE - bits));
+							cache <<= bits;
+							cache_bits -= bits;
+							pos += bits;
+							return;
+						}
+					}
 					peek(v, bits);
 					*this += bits;
 				}
+
+				/// Reads a run of values of the same bit width and advances the iterator.
+				/// The range is checked once for the entire run, the values are
+				/// read from the cache in a tight loop.
+				///
+				/// @param[out] v Array to hold the values, must be able to hold 'count' values.
+				/// @param[in] count Number of values to read.
+				/// @param[in] bits Width of each value in bits.
+				template <typename T> void read(T * v, size_type count, size_type bits) throw (exception)
+				{
+					if (bs == NULL || bits <= 0 || count == 0) return;
+					if (bits > 32 || bits > sizeof(T) * BITS_PER_BYTE || BITS_PER_BLOCK > 32) {
+						for (size_type k = 0; k < count; ++k) read(v[k], bits);
+						return;
+					}
+					if (pos + count * bits > bs->size()) throw exception();
+					for (size_type k = 0; k < count; ++k) {
+						// blocks of up to 32 bits always refill at least 32 bits
+						if (bits > cache_bits) refill();
+						v[k] = static_cast<T>(cache >> (BITS_PER_CACHE - bits));
+						cache <<= bits;
+						cache_bits -= bits;
+						pos += bits;
+					}
+				}
 		};
 	private:
 		size_type pos; // number of bits contained within the set
 		Container data;
 	private:
 
+		/// Returns a block with the specified number of least significant bits set.
+		/// All bits are set if the number is equal or larger than the block size.
+		static block_type low_mask(size_type bits)
+		{
+			if (bits >= BITS_PER_BLOCK) return static_cast<block_type>(~block_type());
+			return static_cast<block_type>((static_cast<block_type>(1) << bits) - 1);
+		}
+
+		/// Reads 8 bytes as big endian word.
+		static cache_type load_be(const block_type * p)
+		{
+			cache_type v;
+			std::memcpy(&v, p, sizeof(v));
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+			return __builtin_bswap64(v);
+#elif defined(__GNUC__) && defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+			return v;
+#else
+			const unsigned char * b = reinterpret_cast<const unsigned char *>(p);
+			v = 0;
+			for (size_type i = 0; i < sizeof(v); ++i) v = (v << BITS_PER_BYTE) | b[i];
+			return v;
+#endif
+		}
+
 		/// Extends the container by the specified number of bits.
 		/// Extension is always one block.
 		void extend(size_type bits)
@@ -211,6 +335,7 @@ template <typename Block, class Container = std::vector<Block> > class bitset
 		{
 			if (bits <= 0) return;
 			extend(bits);
+			v &= low_mask(bits);
 			size_type i = pos / BITS_PER_BLOCK; // index of current block
 			size_type u_bits = BITS_PER_BLOCK - (pos % BITS_PER_BLOCK); // number of bits unused within the current block
 			if (u_bits >= bits) {
@@ -237,14 +362,15 @@ template <typename Block, class Container = std::vector<Block> > class bitset
 			if (ofs + bits > capacity()) extend(ofs + bits - capacity());
 			size_type i = ofs / BITS_PER_BLOCK; // index of current block
 			size_type u_bits = BITS_PER_BLOCK - (ofs % BITS_PER_BLOCK); // number of bits unused within the current block
+			v &= low_mask(bits);
 			if (u_bits >= bits) {
 				// enough room within current block
-				block_type mask = ~((1 << (u_bits - bits)) - 1);
+				block_type mask = ~(low_mask(bits) << (u_bits - bits));
 				data[i] = (data[i] & mask) | v << (u_bits - bits);
 			} else {
 				// not enough room, split value to current and next block
-				block_type mask0 = ~((1 << (bits - u_bits)) - 1);
-				block_type mask1 = (1 << (BITS_PER_BLOCK - (bits - u_bits))) - 1;
+				block_type mask0 = ~low_mask(u_bits);
+				block_type mask1 = low_mask(BITS_PER_BLOCK - (bits - u_bits));
 
 				data[i+0] = (data[i+0] & mask0) | v >> (bits - u_bits);
 				data[i+1] = (data[i+1] & mask1) | v << (BITS_PER_BLOCK - (bits - u_bits));
@@ -267,12 +393,12 @@ template <typename Block, class Container = std::vector<Block> > class bitset
 			size_type u_bits = BITS_PER_BLOCK - (ofs % BITS_PER_BLOCK); // number of bits unused within the current block
 			if (u_bits >= bits) {
 				// desired data fully within the current block
-				block_type mask = (1 << u_bits) - 1;
+				block_type mask = low_mask(u_bits);
 				v = (data[i] & mask) >> (u_bits - bits);
 			} else {
 				// desired value is part from current block and part from next
-				block_type mask0 = (1 << u_bits) - 1;
-				block_type mask1 = ((1 << (BITS_PER_BLOCK - (bits - u_bits))) - 1) << (bits - u_bits);
+				block_type mask0 = low_mask(u_bits);
+				block_type mask1 = ~low_mask(BITS_PER_BLOCK - (bits - u_bits));
 				v = (data[i+0] & mask0) << (bits - u_bits) | (data[i+1] & mask1) >> (BITS_PER_BLOCK - (bits - u_bits));
 			}
 		}
@@ -469,13 +595,13 @@ template <typename Block, class Container = std::vector<Block> > class bitset
 				} else {
 					bits -= u_bits;
 				}
-				v =+ block;
+				v = block;
 				ofs += u_bits;
 			}
 
 			for (; bits >= BITS_PER_BLOCK; bits -= BITS_PER_BLOCK) {
 				get_block(block, ofs);
-				v <<= BITS_PER_BLOCK;
+				v <<= (BITS_PER_BLOCK % (sizeof(T) * BITS_PER_BYTE)); // only reached if T is wider than a block
 				v += block;
 				ofs += BITS_PER_BLOCK;
 			}
@@ -1,29 +1,8 @@
 #include <bitset.hpp>
+#include <view.hpp>
 #include <stdint.h>
 #include <cstdio>
 
-class zero_copy_container
-{
-	public:
-		typedef uint8_t value_type;
-		typedef std::vector<value_type> Buffer;
-		typedef Buffer::const_iterator const_iterator;
-		typedef Buffer::size_type size_type;
-	private:
-		Buffer::const_iterator begin;
-		Buffer::const_iterator end;
-	public:
-		zero_copy_container(const_iterator begin, const_iterator end)
-			: begin(begin), end(end)
-		{}
-
-		value_type operator [] (size_type i) const
-		{
-			if (static_cast<size_type>(end - begin) < i) return value_type();
-			return *(begin + i);
-		}
-};
-
 static void dump(uint8_t v)
 {
 	for (int i = 0; i < 8; ++i) printf("%d", (v >> (7-i)) & 0x1);
@@ -35,13 +14,13 @@ int main(int, char **)
 	a.append(0x0f, 8);
 	a.append(0xf0, 8);
 
-	zero_copy_container::Buffer buf;
+	std::vector<uint8_t> buf;
 	buf.push_back(0x0f);
 	buf.push_back(0xf0);
 
 //	dump(buf[0]); printf(" "); dump(buf[1]); printf("\n");
 
-	bitset<uint8_t, zero_copy_container> b(buf.begin(), buf.end());
+	bitset<uint8_t, view<uint8_t> > b(&buf[0], &buf[0] + buf.size());
 
 //	dump(0x0f); printf(" "); dump(0xf0); printf("\n");
 
@@ -2,7 +2,6 @@
 #include <fstream>
 #include <iostream>
 #include <cstdlib>
-#include <cstring>
 
 static void unexpected()
 {
@@ -18,7 +17,6 @@ int main(int, char ** argv)
 
 	while (!ifs.eof() && ifs.good()) {
 		grib2::message_t grib;
-		memset(&grib, 0, sizeof(grib));
 		grib2::unpack(grib, ifs);
 	}
 
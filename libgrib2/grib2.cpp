@@ -1,117 +1,139 @@
 #include <grib2.hpp>
 #include <iostream>
 #include <cmath>
+#include <algorithm>
 #include <bitset.hpp>
+#include <view.hpp>
+#include <scale.hpp>
+#include <scan.h>
+#include <workpool.h>
+#include <png_unpack.h>
+#include <ieee_float.h>
+#include <ccsds.h>
+#include <spatial_diff.h>
 
 // http://www.nco.ncep.noaa.gov/pmb/docs/grib2/grib2_doc.shtml
 
 #define EPSILON (1.0e-9)
 
-namespace grib2 {
-
-typedef bitset<uint8_t> octets;
-
-static void unpack(std::istream &, indicator_section_t &) throw (std::exception);
-static void unpack(std::istream &, identification_section_t &) throw (std::exception);
-static void unpack(std::istream &, local_use_section_t &) throw (std::exception);
-static void unpack(std::istream &, grid_definition_section_t &) throw (std::exception);
-static void unpack(std::istream &, product_definition_section_t &) throw (std::exception);
-static void unpack(std::istream &, data_representation_section_t &) throw (std::exception);
-static void unpack(std::istream &, bitmap_section_t &) throw (std::exception);
-static void unpack(std::istream &, data_section_t &, const data_representation_section_t &) throw (std::exception);
+/// Number of parts per thread a data section is split into, see unpack_DS_5_0().
+#define SPLIT_PARTS 4
 
-template <typename T> static void read(std::istream & is, T & value) throw (std::exception)
-{
-	octets buf;
-	buf.reserve(sizeof(T));
-	if (buf.append(is, sizeof(T)) != sizeof(T)) throw std::exception();
-	octets::const_iterator i = buf.begin();
-	i.read(value);
-}
+namespace grib2 {
 
-static int search_next_message(std::istream & is) // {{{
+typedef bitset<uint8_t, view<uint8_t> > octets;
+
+static void unpack(octets::const_iterator &, indicator_section_t &) throw (std::exception);
+static void unpack(octets::const_iterator &, identification_section_t &) throw (std::exception);
+static void unpack(octets::const_iterator &, local_use_section_t &, const uint8_t *) throw (std::exception);
+static void unpack(octets::const_iterator &, grid_definition_section_t &) throw (std::exception);
+static void unpack(octets::const_iterator &, product_definition_section_t &) throw (std::exception);
+static void unpack(octets::const_iterator &, data_representation_section_t &) throw (std::exception);
+static void unpack(octets::const_iterator &, bitmap_section_t &, const uint8_t *) throw (std::exception);
+static void unpack(octets::const_iterator &, data_section_t &, const data_representation_section_t &) throw (std::exception);
+
+/// Reads from the stream until the window contains the complete indicator
+/// section of a GRIB2 message. The stream buffer is read directly in blocks
+/// of up to 16 octets, never beyond the indicator section of the message found.
+static int search_next_message(std::istream & is, uint8_t * head) // {{{
 {
-	int state = 0;
-	int8_t c;
-
-	while (is.good() && !is.eof()) {
-		is >> c;
-		switch (state) {
-			case 0:
-				state = (c == 'G') ? 1 : 0;
-				break;
-			case 1:
-				state = (c == 'R') ? 2 : 0;
-				break;
-			case 2:
-				state = (c == 'I') ? 3 : 0;
-				break;
-			case 3:
-				if (c == 'B') return 0;
-				state = 0;
-				break;
+	std::streambuf * sb = is.rdbuf();
+	std::size_t have = 0; // number of valid octets within the window
+	std::size_t k;
+
+	if (!is.good() || sb == NULL) return -1;
+	for (;;) {
+		if (have < 16) {
+			std::streamsize n = static_cast<std::streamsize>(16 - have);
+			if (sb->sgetn(reinterpret_cast<char *>(head + have), n) != n) {
+				is.setstate(std::ios::eofbit | std::ios::failbit);
+				return -1;
+			}
+			have = 16;
 		}
+		k = grib_find_message(head, 16, 2);
+		if (k == 0) return 0;
+		if (k == 16) k = 16 - (GRIB_SCAN_HEADER - 1); // keep the octets which may start a header
+		std::copy(head + k, head + 16, head);
+		have = 16 - k;
 	}
-	return -1;
 } // }}}
 
-int unpack(message_t & grib, std::istream & is)
+/// Unpacks all sections of the message, the data is parsed in place. The
+/// data section is only recorded, its values are unpacked on demand. Without
+/// data (the data section was not read), the values remain empty. If the data
+/// was skipped, only the first 5 octets of the data section are part of the
+/// data (see unpack_metadata()), the data is shorter than the message.
+static int unpack_in_place(message_t & grib, const uint8_t * data, std::size_t size, bool with_data, bool skipped = false)
 {
 	uint32_t section_length;
 	uint8_t section_number;
-	uint64_t total_length = 0;
+	uint64_t ofs; // offset of the current section in octets
+	uint64_t end; // end of the message within the data
+	uint64_t length; // octets of the current section within the data
 
-	if (search_next_message(is) < 0) return -1; // consumes "GRIB" indicator
+	if (size < 16 || data[0] != 'G' || data[1] != 'R' || data[2] != 'I' || data[3] != 'B') return -1;
 	try {
-		unpack(is, grib.is);
-		total_length += 16;
-		total_length += 4; // "7777" at the end, FIXME: read from "GRIB" to "7777" into vector and read data from there
-		while (total_length < grib.is.total_length) {
-			read(is, section_length);
+		octets buf(data, data + size);
+		octets::const_iterator i = buf.begin();
+		unpack(i, grib.is);
+		if (!skipped && grib.is.total_length > size) return -2;
+		end = skipped ? size : grib.is.total_length;
+		ofs = 16;
+		while (ofs + 4 <= end) {
+			i = buf.begin();
+			i += ofs * octets::BITS_PER_BYTE;
+			i.read(section_length);
 			if (section_length == 0x37373737) break; // "7777" = end of grib message
-			read(is, section_number);
+			i.read(section_number);
+			length = (skipped && section_number == 7) ? 5 : section_length;
+			if (section_length < 5 || ofs + length > end) throw std::exception();
 
 			switch (section_number) {
 				case 1:
 					grib.ids.length = section_length;
 					grib.ids.number = section_number;
-					unpack(is, grib.ids);
+					unpack(i, grib.ids);
 					break;
 
 				case 2:
 					grib.lus.length = section_length;
 					grib.lus.number = section_number;
-					unpack(is, grib.lus);
+					unpack(i, grib.lus, data);
 					break;
 
 				case 3:
 					grib.gds.length = section_length;
 					grib.gds.number = section_number;
-					unpack(is, grib.gds);
+					unpack(i, grib.gds);
 					break;
 
 				case 4:
 					grib.pds.length = section_length;
 					grib.pds.number = section_number;
-					unpack(is, grib.pds);
+					unpack(i, grib.pds);
 					break;
 
 				case 5:
 					grib.drs.length = section_length;
 					grib.drs.number = section_number;
-					unpack(is, grib.drs);
+					unpack(i, grib.drs);
 					break;
 
 				case 6:
 					grib.bm.length = section_length;
 					grib.bm.number = section_number;
-					unpack(is, grib.bm);
+					unpack(i, grib.bm, data);
 					break;
 
 				case 7:
 					grib.ds.length = section_length;
 					grib.ds.number = section_number;
-					unpack(is, grib.ds, grib.drs);
+					grib.ds.section.data = with_data ? data + ofs : NULL;
+					grib.ds.section.size = with_data ? section_length : 0;
+					grib.ds.drs = grib.drs;
+					grib.ds.unpacked = false;
+					grib.ds.data.clear(); // unpacked on demand, see data_section_t::values
 					break;
 
 				default:
@@ -124,7 +146,7 @@ int unpack(message_t & grib, std::istream & is)
 						<< std::endl;
 					return -1;
 			}
-			total_length += section_length;
+			ofs += length;
 		}
 	} catch (octets::exception &) {
 		std::cerr << "OCTET READ EXCEPTION" << std::endl;
@@ -142,27 +164,160 @@ int unpack(message_t & grib, std::istream & is)
 	return 0;
 }
 
-static void unpack(std::istream & is, grib2::indicator_section_t & section) throw (std::exception)
+/// Reads the next message from the stream into the message buffer and
+/// unpacks it from there.
+int unpack(message_t & grib, std::istream & is)
+{
+	uint8_t head[16];
+	uint64_t total_length;
+
+	if (search_next_message(is, head) < 0) return -1; // consumes the indicator section
+
+	try {
+		octets buf(head, head + sizeof(head));
+		octets::const_iterator i = buf.begin();
+		i += 8 * octets::BITS_PER_BYTE;
+		i.read(total_length);
+	} catch (octets::exception &) {
+		return -2;
+	}
+	if (total_length < sizeof(head)) return -1;
+
+	grib.buffer.resize(total_length);
+	std::copy(head, head + sizeof(head), grib.buffer.begin());
+	if (total_length > sizeof(head)) {
+		is.read(reinterpret_cast<char *>(&grib.buffer[sizeof(head)]), total_length - sizeof(head));
+		if (static_cast<uint64_t>(is.gcount()) != total_length - sizeof(head)) return -1;
+	}
+
+	return unpack_in_place(grib, &grib.buffer[0], grib.buffer.size(), true);
+}
+
+/// Reads the metadata of the next message from the stream, the data section
+/// is skipped without being read (seeked over, if the stream supports it) and
+/// the data of the message remains empty. Meant for inventories. The buffer
+/// grows with the sections read, it keeps only the first 5 octets of the data
+/// section.
+int unpack_metadata(message_t & grib, std::istream & is)
+{
+	uint8_t head[16];
+	uint64_t total_length;
+	uint64_t ofs; // offset within the message
+	std::size_t used; // octets of the buffer in use
+	uint32_t section_length;
+
+	if (search_next_message(is, head) < 0) return -1; // consumes the indicator section
+
+	total_length = 0;
+	for (int n = 8; n < 16; ++n) total_length = (total_length << 8) | head[n];
+	if (total_length < sizeof(head) + 4) return -1;
+
+	grib.buffer.assign(head, head + sizeof(head));
+	used = sizeof(head);
+	for (ofs = sizeof(head); ofs + 4 <= total_length; ofs += section_length) {
+		grib.buffer.resize(used + 5);
+		uint8_t * p = &grib.buffer[used];
+		if (!is.read(reinterpret_cast<char *>(p), 4)) return -1;
+		section_length = (static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+		if (section_length == 0x37373737) { // "7777" = end of grib message
+			grib.buffer.resize(used + 4);
+			break;
+		}
+		if (section_length < 5 || ofs + section_length > total_length) return -1;
+		if (!is.read(reinterpret_cast<char *>(p + 4), 1)) return -1;
+		if (p[4] != 7) {
+			grib.buffer.resize(used + section_length);
+			if (!is.read(reinterpret_cast<char *>(&grib.buffer[used + 5]), section_length - 5)) return -1;
+			used += section_length;
+		} else {
+			// the header of the data section is kept, the data is not read
+			if (!is.seekg(section_length - 5, std::ios::cur)) {
+				is.clear();
+				is.ignore(section_length - 5);
+				if (static_cast<uint32_t>(is.gcount()) != section_length - 5) return -1;
+			}
+			used += 5;
+		}
+	}
+
+	return unpack_in_place(grib, &grib.buffer[0], grib.buffer.size(), false, true);
+}
+
+/// Unpacks the message which begins at the specified memory. The data is not
+/// copied, the message keeps pointers into it (e.g. the bitmap), therefore
+/// the memory has to outlive the message. The message buffer is released.
+///
+/// @param[out] grib The message.
+/// @param[in] data The message, beginning with the indicator "GRIB".
+/// @param[in] size Number of octets available, at least the total length of the message.
+/// @retval 0 Success
+/// @retval -1 Failure
+/// @retval -2 Message truncated
+int unpack(message_t & grib, const uint8_t * data, std::size_t size)
+{
+	std::vector<uint8_t>().swap(grib.buffer);
+	return unpack_in_place(grib, data, size, true);
+}
+
+/// Unpacks the metadata of the message which begins at the specified memory,
+/// see above. The data section is not read, the data of the message remains
+/// empty.
+int unpack_metadata(message_t & grib, const uint8_t * data, std::size_t size)
+{
+	std::vector<uint8_t>().swap(grib.buffer);
+	return unpack_in_place(grib, data, size, false);
+}
+
+/// Unpacks the next message within the memory, starting the search at the
+/// cursor. Data in front of the message is skipped, the cursor is advanced
+/// behind the message using its total length. The message keeps pointers into
+/// the memory, see above.
+///
+/// @param[out] grib The message.
+/// @param[in] data The memory, may contain any number of messages.
+/// @param[in] size Number of octets of the memory.
+/// @param[inout] cursor Position to start the search at, on return the
+///     position behind the message (or behind the indicator in case of an
+///     invalid message).
+/// @retval 0 Success
+/// @retval -1 Failure or no more messages
+/// @retval -2 Message truncated
+int unpack(message_t & grib, const uint8_t * data, std::size_t size, std::size_t & cursor)
 {
+	std::size_t pos;
+	uint64_t total_length = 0;
+	int rc;
+
+	if (cursor >= size) return -1;
+	pos = cursor + grib_find_message(data + cursor, size - cursor, 2);
+	if (pos + 16 > size) {
+		cursor = size;
+		return -1;
+	}
+	for (int n = 8; n < 16; ++n) total_length = (total_length << 8) | data[pos + n];
+	if (total_length < 16 || total_length > size - pos) {
+		cursor = pos + 4;
+		return (total_length < 16) ? -1 : -2;
+	}
+	rc = unpack(grib, data + pos, static_cast<std::size_t>(total_length));
+	cursor = pos + static_cast<std::size_t>(total_length);
+	return rc;
+}
+
+static void unpack(octets::const_iterator & i, grib2::indicator_section_t & section) throw (std::exception)
+{
+	uint32_t indicator;
 	uint16_t reserved;
-	grib2::octets buf;
 
-	buf.reserve(12); // ignoring "GRIB" indicator
-	if (buf.append(is, 12) != 12) throw std::exception();
-	grib2::octets::const_iterator i = buf.begin();
+	i.read(indicator); // "GRIB"
 	i.read(reserved);
 	i.read(section.discipline);
 	i.read(section.edition);
 	i.read(section.total_length);
 }
 
-static void unpack(std::istream & is, grib2::identification_section_t & section) throw (std::exception)
+static void unpack(grib2::octets::const_iterator & i, grib2::identification_section_t & section) throw (std::exception)
 {
-	grib2::octets buf;
-	grib2::octets::size_type length = section.length - sizeof(section.length) - sizeof(section.number);
-	buf.reserve(length);
-	if (buf.append(is, length) != length) throw std::exception();
-	grib2::octets::const_iterator i = buf.begin();
 
 	i.read(section.originating_center);
 	i.read(section.originating_subcenter);
@@ -181,19 +336,12 @@ static void unpack(std::istream & is, grib2::identification_section_t & section)
 	// all additional data is reserved
 }
 
-static void unpack(std::istream & is, grib2::local_use_section_t & section) throw (std::exception)
+static void unpack(grib2::octets::const_iterator & i, grib2::local_use_section_t & section, const uint8_t * p) throw (std::exception)
 {
-	grib2::octets buf;
-	grib2::octets::size_type length = section.length - sizeof(section.length) - sizeof(section.number);
-	buf.reserve(length);
-	if (buf.append(is, length) != length) throw std::exception();
-	section.data.clear();
-	grib2::octets::const_iterator i = buf.begin();
+	if (section.length < 5) throw std::exception();
 
-	// copy local data
-	for (; i != buf.end(); ++i) {
-		section.data.push_back(*i);
-	}
+	// local data is referenced in place
+	section.data = span_t(p + i.get_pos() / octets::BITS_PER_BYTE, section.length - 5);
 }
 
 static void unpack_GDS_3_0(grib2::octets::const_iterator & i, grib2::grid_definition_section_t & section) throw (std::exception)
@@ -232,13 +380,8 @@ static void unpack_GDS_3_0(grib2::octets::const_iterator & i, grib2::grid_defini
 	calc.lon2 = static_cast<double>(t.lon2) * 1.0e-6;
 }
 
-static void unpack(std::istream & is, grib2::grid_definition_section_t & section) throw (std::exception)
+static void unpack(grib2::octets::const_iterator & i, grib2::grid_definition_section_t & section) throw (std::exception)
 {
-	grib2::octets buf;
-	grib2::octets::size_type length = section.length - sizeof(section.length) - sizeof(section.number);
-	buf.reserve(length);
-	if (buf.append(is, length) != length) throw std::exception();
-	grib2::octets::const_iterator i = buf.begin();
 
 	i.read(section.source);
 	i.read(section.num_datapoints);
@@ -306,13 +449,8 @@ static void unpack_PDS_4_0(grib2::octets::const_iterator & i, grib2::product_def
 	i.read(t.scale_value_second_fix_surf);
 }
 
-static void unpack(std::istream & is, grib2::product_definition_section_t & section) throw (std::exception)
+static void unpack(grib2::octets::const_iterator & i, grib2::product_definition_section_t & section) throw (std::exception)
 {
-	grib2::octets buf;
-	grib2::octets::size_type length = section.length - sizeof(section.length) - sizeof(section.number);
-	buf.reserve(length);
-	if (buf.append(is, length) != length) throw std::exception();
-	grib2::octets::const_iterator i = buf.begin();
 
 	i.read(section.num_coord_values);
 	i.read(section.product_def_templ);
@@ -331,13 +469,8 @@ static void unpack(std::istream & is, grib2::product_definition_section_t & sect
 	// TODO: optional list of coordinate values
 }
 
-static void unpack(std::istream & is, grib2::data_representation_section_t & section) throw (std::exception)
+static void unpack(grib2::octets::const_iterator & i, grib2::data_representation_section_t & section) throw (std::exception)
 {
-	grib2::octets buf;
-	grib2::octets::size_type length = section.length - sizeof(section.length) - sizeof(section.number);
-	buf.reserve(length);
-	if (buf.append(is, length) != length) throw std::exception();
-	grib2::octets::const_iterator i = buf.begin();
 
 	i.read(section.num_datapoints);
 	i.read(section.rep_templ);
@@ -350,10 +483,41 @@ static void unpack(std::istream & is, grib2::data_representation_section_t & sec
 			i.read(section.rep_def.gp_simple.num_bits);
 			i.read(section.rep_def.gp_simple.type_org);
 			break;
-		case 1: // Matrix Value at Grid Point - Simple Packing (see Template 5.1)
 		case 2: // Grid Point Data - Complex Packing (see Template 5.2)
 		case 3: // Grid Point Data - Complex Packing and Spatial Differencing (see Template 5.3)
+			i.read(section.rep_def.gp_complex.R.u); // data already in IEEE-754 binary float 32
+			i.read(section.rep_def.gp_complex.E);
+			i.read(section.rep_def.gp_complex.D);
+			i.read(section.rep_def.gp_complex.num_bits);
+			i.read(section.rep_def.gp_complex.type_org);
+			i.read(section.rep_def.gp_complex.group_splitting);
+			i.read(section.rep_def.gp_complex.missing_management);
+			i.read(section.rep_def.gp_complex.primary_missing.u);
+			i.read(section.rep_def.gp_complex.secondary_missing.u);
+			i.read(section.rep_def.gp_complex.num_groups);
+			i.read(section.rep_def.gp_complex.ref_group_widths);
+			i.read(section.rep_def.gp_complex.bits_group_widths);
+			i.read(section.rep_def.gp_complex.ref_group_lengths);
+			i.read(section.rep_def.gp_complex.incr_group_lengths);
+			i.read(section.rep_def.gp_complex.last_group_length);
+			i.read(section.rep_def.gp_complex.bits_group_lengths);
+			section.rep_def.gp_complex.order = 0;
+			section.rep_def.gp_complex.num_octets = 0;
+			if (section.rep_templ == 3) {
+				i.read(section.rep_def.gp_complex.order);
+				i.read(section.rep_def.gp_complex.num_octets);
+				if (section.rep_def.gp_complex.order != 1 && section.rep_def.gp_complex.order != 2) {
+					throw not_implemented(__FILE__, __LINE__);
+				}
+			}
+			break;
 		case 4: // Grid Point Data - IEEE Floating Point Data (see Template 5.4)
+			i.read(section.rep_def.gp_ieee.precision);
+			if (section.rep_def.gp_ieee.precision != 1 && section.rep_def.gp_ieee.precision != 2) {
+				throw not_implemented(__FILE__, __LINE__); // 128 bit
+			}
+			break;
+		case 1: // Matrix Value at Grid Point - Simple Packing (see Template 5.1)
 			throw not_implemented(__FILE__, __LINE__);
 			break;
 		case 40: // Grid Point Data - JPEG2000 Compression (see Template 5.40)
@@ -370,6 +534,16 @@ static void unpack(std::istream & is, grib2::data_representation_section_t & sec
 			i.read(section.rep_def.gp_png.num_bits);
 			i.read(section.rep_def.gp_png.type_org);
 			break;
+		case 42: // Grid Point Data - CCSDS Recommended Lossless Compression (see Template 5.42)
+			i.read(section.rep_def.gp_ccsds.R.u); // data already in IEEE-754 binary float 32
+			i.read(section.rep_def.gp_ccsds.E);
+			i.read(section.rep_def.gp_ccsds.D);
+			i.read(section.rep_def.gp_ccsds.num_bits);
+			i.read(section.rep_def.gp_ccsds.type_org);
+			i.read(section.rep_def.gp_ccsds.flags);
+			i.read(section.rep_def.gp_ccsds.block_size);
+			i.read(section.rep_def.gp_ccsds.rsi);
+			break;
 		case 50: // Spectral Data - Simple Packing (see Template 5.50)
 			i.read(section.rep_def.sd_simple.R.u); // data already in IEEE-754 binary float 32
 			i.read(section.rep_def.sd_simple.E);
@@ -387,23 +561,85 @@ static void unpack(std::istream & is, grib2::data_representation_section_t & sec
 	}
 }
 
-static void unpack(std::istream & is, grib2::bitmap_section_t & section) throw (std::exception)
+static void unpack(grib2::octets::const_iterator & i, grib2::bitmap_section_t & section, const uint8_t * p) throw (std::exception)
 {
-	grib2::octets buf;
-	grib2::octets::size_type length = section.length - sizeof(section.length) - sizeof(section.number);
-	buf.reserve(length);
-	if (buf.append(is, length) != length) throw std::exception();
-
-	grib2::octets::const_iterator i = buf.begin();
+	if (section.length < 6) throw std::exception();
 
 	i.read(section.bitmap_indicator); // see table 6.0
 
-	// copy bitmap
-	for (; i != buf.end(); ++i) {
-		section.bitmap.push_back(*i);
-	}
+	// bitmap is referenced in place
+	section.bitmap = span_t(p + i.get_pos() / octets::BITS_PER_BYTE, section.length - 6);
 }
 
+namespace {
+
+/// A data section unpacked by several threads, see unpack_DS_5_0().
+struct split_t
+{
+	const octets::const_iterator * first; // the first packed value
+	unsigned int bits;
+	std::size_t count;
+	double ref;
+	double scale;
+	double * out;
+	std::size_t part; // number of values per part
+	std::size_t done; // number of parts unpacked
+};
+
+}
+
+static std::size_t split_min_points = 1024 * 1024;
+static unsigned int split_threads = 0;
+
+/// Configures splitting data sections across threads. Not to be called while
+/// messages are unpacked.
+///
+/// @param[in] min_points Minimum number of values of a data section to be split.
+/// @param[in] num_threads Number of threads, 0 for one per processor, 1
+///     disables splitting.
+void set_unpack_split(std::size_t min_points, unsigned int num_threads)
+{
+	split_min_points = min_points;
+	split_threads = num_threads;
+}
+
+/// Sets the number of threads data sections are split across, see
+/// set_unpack_split(). Messages unpacked in parallel use 1, unpack_parallel()
+/// sets it for the duration of the pool.
+///
+/// @param[in] num_threads Number of threads, 0 for one per processor, 1
+///     disables splitting.
+/// @return The previous number of threads.
+unsigned int set_unpack_split_threads(unsigned int num_threads)
+{
+	unsigned int prev = split_threads;
+
+	split_threads = num_threads;
+	return prev;
+}
+
+static int split_run(void * ptr, std::size_t task, std::size_t) // {{{
+{
+	const split_t & s = *static_cast<const split_t *>(ptr);
+	std::size_t begin = task * s.part;
+	std::size_t num = std::min(s.part, s.count - begin);
+
+	try {
+		octets::const_iterator i = *s.first;
+		i += begin * s.bits;
+		unpack_scaled(i, s.bits, num, s.ref, s.scale, s.out + begin);
+	} catch (...) {
+		return -1;
+	}
+	return 0;
+} // }}}
+
+static int split_emit(void * ptr, std::size_t, std::size_t) // {{{
+{
+	static_cast<split_t *>(ptr)->done++;
+	return 0;
+} // }}}
+
 static void unpack_DS_5_0(grib2::octets::const_iterator & i, grib2::data_section_t & section,
 	const data_representation_section_t & drs) throw (std::exception)
 {
@@ -414,49 +650,244 @@ static void unpack_DS_5_0(grib2::octets::const_iterator & i, grib2::data_section
 
 	const grib2::data_representation_section_t::rep_def_t::gp_simple_t & def = drs.rep_def.gp_simple;
 
-	uint32_t t;
-	double val;
+	if (def.num_bits > sizeof(uint32_t) * grib2::octets::BITS_PER_BYTE) throw std::exception();
 
-	if (def.num_bits > sizeof(t) * grib2::octets::BITS_PER_BYTE) throw std::exception();
+	// the packed data must be contained within the section, the message is read in place
+	if (static_cast<uint64_t>(def.num_bits) * drs.num_datapoints
+		> static_cast<uint64_t>(section.length - 5) * grib2::octets::BITS_PER_BYTE) throw std::exception();
+
+	// scale factors are the same for the entire field
+	double decimal_scale = pow(10.0, -def.D);
+	double binary_scale = pow(2.0, def.E);
 
 	section.data.clear();
-	section.data.reserve(drs.num_datapoints);
+	section.data.resize(drs.num_datapoints);
+	if (section.data.empty()) return;
+
+	// the offset of every value is known, big sections are split into parts unpacked by several threads
+	std::size_t num_parts = workpool_threads(split_threads) * SPLIT_PARTS;
+	if (drs.num_datapoints < split_min_points || num_parts <= SPLIT_PARTS) {
+		unpack_scaled(i, def.num_bits, drs.num_datapoints,
+			decimal_scale * def.R.f, decimal_scale * binary_scale, &section.data[0]);
+		return;
+	}
+
+	split_t s;
+	s.first = &i;
+	s.bits = def.num_bits;
+	s.count = drs.num_datapoints;
+	s.ref = decimal_scale * def.R.f;
+	s.scale = decimal_scale * binary_scale;
+	s.out = &section.data[0];
+	s.part = (s.count + num_parts - 1) / num_parts;
+	s.done = 0;
+	num_parts = (s.count + s.part - 1) / s.part;
+	if (workpool_run(num_parts, split_threads, 0, split_run, split_emit, &s) != 0 || s.done != num_parts) {
+		throw std::exception();
+	}
+	i += s.count * s.bits;
+}
+
+/// Advances the iterator to the next byte boundary.
+static void align_byte(grib2::octets::const_iterator & i) // {{{
+{
+	std::size_t rem = i.get_pos() % grib2::octets::BITS_PER_BYTE;
+	if (rem) i += grib2::octets::BITS_PER_BYTE - rem;
+} // }}}
+
+/// Reads an extra descriptor of the spatial differencing, sign and magnitude.
+static int read_descriptor(grib2::octets::const_iterator & i, unsigned int octets) throw (std::exception) // {{{
+{
+	uint32_t sign = 0;
+	uint32_t value = 0;
+
+	i.read(sign, 1);
+	i.read(value, octets * grib2::octets::BITS_PER_BYTE - 1);
+	return sign ? -static_cast<int>(value) : static_cast<int>(value);
+} // }}}
 
+/// Unpacks complex packed values, with (template 5.3) or without (template 5.2)
+/// spatial differencing. Group references, widths and lengths as well as the
+/// values of each group are read as runs of the same bit width. Missing values
+/// are replaced by the substitutes of the data representation section, they
+/// are not part of the spatial differencing.
+static void unpack_DS_5_2_3(grib2::octets::const_iterator & i, grib2::data_section_t & section,
+	const data_representation_section_t & drs) throw (std::exception)
+{
+	const grib2::data_representation_section_t::rep_def_t::gp_complex_t & def = drs.rep_def.gp_complex;
+	const std::size_t num = drs.num_datapoints;
+	const std::size_t ng = def.num_groups;
+
+	if (def.num_bits > sizeof(uint32_t) * grib2::octets::BITS_PER_BYTE) throw std::exception();
+
+	// same scaling as simple packing, see unpack_DS_5_0()
 	double decimal_scale = pow(10.0, -def.D);
 	double binary_scale = pow(2.0, def.E);
+	double ref = decimal_scale * def.R.f;
+	double scale = decimal_scale * binary_scale;
 
+	section.data.clear();
+	section.data.resize(num, ref);
+	if (num == 0 || def.num_bits == 0 || ng == 0) return;
+
+	// extra descriptors of the spatial differencing
+	int ival1 = 0;
+	int ival2 = 0;
+	int minsd = 0;
+	if (def.order > 0) {
+		if (def.num_octets < 1 || def.num_octets > 4) throw std::exception();
+		ival1 = read_descriptor(i, def.num_octets);
+		if (def.order == 2) ival2 = read_descriptor(i, def.num_octets);
+		minsd = read_descriptor(i, def.num_octets);
+	}
 
-	for (uint32_t dp = 0; dp < drs.num_datapoints; ++dp) {
-		i.read(t, def.num_bits);
-		if (def.num_bits == 0) {
-			val = def.R.f;
-		} else {
-			val = decimal_scale * (def.R.f + t * binary_scale);
+	// group references, widths and lengths, each starting at a byte boundary
+	std::vector<uint32_t> gref(ng);
+	std::vector<uint32_t> gwidth(ng);
+	std::vector<uint32_t> glen(ng);
+	i.read(&gref[0], ng, def.num_bits);
+	align_byte(i);
+	i.read(&gwidth[0], ng, def.bits_group_widths);
+	align_byte(i);
+	i.read(&glen[0], ng, def.bits_group_lengths);
+	align_byte(i);
+
+	std::size_t total = 0;
+	for (std::size_t g = 0; g < ng; ++g) {
+		gwidth[g] += def.ref_group_widths;
+		glen[g] = (g + 1 < ng) ? def.ref_group_lengths + glen[g] * def.incr_group_lengths : def.last_group_length;
+		if (gwidth[g] > 32) throw std::exception();
+		total += glen[g];
+	}
+	if (total != num) throw std::exception();
+
+	// values of all groups, missing values flagged by 1 (primary) or 2 (secondary)
+	const unsigned int mgmt = def.missing_management;
+	std::vector<int> vals(num);
+	std::vector<uint8_t> miss(num, 0);
+	std::size_t num_missing = 0;
+	for (std::size_t g = 0, n = 0; g < ng; n += glen[g], ++g) {
+		uint32_t code = (gwidth[g] ? gwidth[g] : def.num_bits) >= 32 ? 0xffffffffu
+			: (static_cast<uint32_t>(1) << (gwidth[g] ? gwidth[g] : def.num_bits)) - 1;
+		if (gwidth[g] == 0) {
+			std::fill(vals.begin() + n, vals.begin() + n + glen[g], static_cast<int>(gref[g]));
+			if (mgmt > 0 && (gref[g] == code || (mgmt == 2 && gref[g] == code - 1))) {
+				std::fill(miss.begin() + n, miss.begin() + n + glen[g], static_cast<uint8_t>(code - gref[g] + 1));
+				num_missing += glen[g];
+			}
+			continue;
+		}
+		i.read(&vals[0] + n, glen[g], gwidth[g]);
+		for (std::size_t k = n; k < n + glen[g]; ++k) {
+			uint32_t v = static_cast<uint32_t>(vals[k]);
+			if (mgmt > 0 && (v == code || (mgmt == 2 && v == code - 1))) {
+				miss[k] = static_cast<uint8_t>(code - v + 1);
+				++num_missing;
+			}
+			vals[k] += static_cast<int>(gref[g]);
+		}
+	}
+
+	// only values which are not missing are differenced
+	if (num_missing > 0) {
+		std::size_t k = 0;
+		for (std::size_t n = 0; n < num; ++n) {
+			if (!miss[n]) vals[k++] = vals[n];
+		}
+	}
+	if (def.order > 0) {
+		spatial_diff_undo(&vals[0], num - num_missing, def.order, ival1, ival2, minsd);
+	}
+
+	double * out = &section.data[0];
+	for (std::size_t n = 0, k = 0; n < num; ++n) {
+		switch (miss[n]) {
+			case 0: out[n] = ref + vals[k++] * scale; break;
+			case 1: out[n] = def.primary_missing.f; break;
+			default: out[n] = def.secondary_missing.f; break;
 		}
-std::cerr << __FILE__ << ":" << __LINE__ << ": " << val << "  D=" << def.D << " E=" << def.E << "  R=" << def.R.f << "  t=" << t << std::endl;
-		section.data.push_back(val);
 	}
-std::cerr << std::endl;
 }
 
-static void unpack(std::istream & is, data_section_t & section, const data_representation_section_t & drs) throw (std::exception)
+static void unpack_DS_5_4(grib2::data_section_t & section, const data_representation_section_t & drs) throw (std::exception)
+{
+	if (section.section.size < 5) throw std::exception();
+
+	section.data.clear();
+	section.data.resize(drs.num_datapoints);
+	if (section.data.empty()) return;
+
+	// the values are byte swapped only, no scaling
+	if (unpack_ieee(section.section.data + 5, section.section.size - 5, drs.rep_def.gp_ieee.precision,
+		0, NULL, drs.num_datapoints, &section.data[0]) != 0) {
+		throw std::exception();
+	}
+}
+
+static void unpack_DS_5_41(grib2::data_section_t & section, const data_representation_section_t & drs) throw (std::exception)
+{
+	const grib2::data_representation_section_t::rep_def_t::gp_png_t & def = drs.rep_def.gp_png;
+
+	if (section.section.size < 5) throw std::exception();
+
+	// same scaling as simple packing, see unpack_DS_5_0()
+	double decimal_scale = pow(10.0, -def.D);
+	double binary_scale = pow(2.0, def.E);
+
+	section.data.clear();
+	section.data.resize(drs.num_datapoints);
+	if (section.data.empty()) return;
+
+	// the image is inflated row by row directly into the values
+	if (unpack_png(section.section.data + 5, section.section.size - 5, def.num_bits,
+		decimal_scale * def.R.f, decimal_scale * binary_scale, NULL, drs.num_datapoints, &section.data[0]) != 0) {
+		throw std::exception();
+	}
+}
+
+static void unpack_DS_5_42(grib2::data_section_t & section, const data_representation_section_t & drs) throw (std::exception)
+{
+	const grib2::data_representation_section_t::rep_def_t::gp_ccsds_t & def = drs.rep_def.gp_ccsds;
+
+	if (section.section.size < 5) throw std::exception();
+
+	// same scaling as simple packing, see unpack_DS_5_0()
+	double decimal_scale = pow(10.0, -def.D);
+	double binary_scale = pow(2.0, def.E);
+
+	section.data.clear();
+	section.data.resize(drs.num_datapoints);
+	if (section.data.empty()) return;
+
+	// the samples are decoded into the memory of the values and scaled in place
+	if (unpack_ccsds(section.section.data + 5, section.section.size - 5, def.num_bits, def.flags, def.block_size,
+		def.rsi, decimal_scale * def.R.f, decimal_scale * binary_scale, NULL, drs.num_datapoints, &section.data[0]) != 0) {
+		throw std::exception();
+	}
+}
+
+static void unpack(grib2::octets::const_iterator & i, data_section_t & section, const data_representation_section_t & drs) throw (std::exception)
 {
-	grib2::octets buf;
-	grib2::octets::size_type length = section.length - sizeof(section.length) - sizeof(section.number);
-	buf.reserve(length);
-	if (buf.append(is, length) != length) throw std::exception();
-	grib2::octets::const_iterator i = buf.begin();
 
 	switch (drs.rep_templ) { // table 5.0
 		case 0: // Grid Point Data - Simple Packing (see Template 5.0)
 			unpack_DS_5_0(i, section, drs);
 			break;
-		case 1: // Matrix Value at Grid Point - Simple Packing (see Template 5.1)
 		case 2: // Grid Point Data - Complex Packing (see Template 5.2)
 		case 3: // Grid Point Data - Complex Packing and Spatial Differencing (see Template 5.3)
+			unpack_DS_5_2_3(i, section, drs);
+			break;
 		case 4: // Grid Point Data - IEEE Floating Point Data (see Template 5.4)
-		case 40: // Grid Point Data - JPEG2000 Compression (see Template 5.40)
+			unpack_DS_5_4(section, drs);
+			break;
 		case 41: // Grid Point Data - PNG Compression (see Template 5.41)
+			unpack_DS_5_41(section, drs);
+			break;
+		case 42: // Grid Point Data - CCSDS Recommended Lossless Compression (see Template 5.42)
+			unpack_DS_5_42(section, drs);
+			break;
+		case 1: // Matrix Value at Grid Point - Simple Packing (see Template 5.1)
+		case 40: // Grid Point Data - JPEG2000 Compression (see Template 5.40)
 		case 50: // Spectral Data - Simple Packing (see Template 5.50)
 		case 51: // Spectral Data - Complex Packing (see Template 5.51)
 		case 61: // Grid Point Data - Simple Packing With Logarithm Pre-processing
@@ -469,5 +900,20 @@ static void unpack(std::istream & is, data_section_t & section, const data_repre
 	}
 }
 
+/// Returns the values of the data section, they are unpacked on the first
+/// access. The values are empty if the data section was skipped. Throws
+/// std::exception (or not_implemented) if the data cannot be unpacked.
+const std::vector<double> & data_section_t::values()
+{
+	if (!unpacked && section.data != NULL) {
+		octets buf(section.data, section.data + section.size);
+		octets::const_iterator i = buf.begin();
+		i += 5 * octets::BITS_PER_BYTE; // skip length and number of the section
+		unpack(i, *this, drs);
+	}
+	unpacked = true;
+	return data;
+}
+
 }
 
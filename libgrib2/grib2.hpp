@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <istream>
+#include <cstddef>
 #include <stdint.h>
 
 #include <string>
@@ -91,6 +92,34 @@ struct Grid
 };
 */
 
+/// Read-only span of octets, pointing into the buffer of a GRIB message.
+/// The data is valid as long as the message buffer exists.
+struct span_t
+{
+	const uint8_t * data;
+	std::size_t size;
+
+	span_t()
+		: data(NULL)
+		, size(0)
+	{}
+
+	span_t(const uint8_t * data, std::size_t size)
+		: data(data)
+		, size(size)
+	{}
+
+	bool empty() const
+	{
+		return size == 0;
+	}
+
+	uint8_t operator [] (std::size_t i) const
+	{
+		return data[i];
+	}
+};
+
 struct indicator_section_t
 {
 	uint8_t discipline;
@@ -122,7 +151,7 @@ struct local_use_section_t
 	uint32_t length;
 	uint8_t number;
 
-	std::vector<char> data;
+	span_t data; // points into the message buffer
 };
 
 struct grid_definition_section_t
@@ -224,6 +253,40 @@ struct data_representation_section_t
 			uint8_t num_bits;
 			uint8_t type_org; // code table 5.1
 		} gp_simple;
+		struct gp_complex_t // templates 5.2 and 5.3
+		{
+			union {
+				uint32_t u;
+				float f;
+			} R; // IEEE-754 binary 32bit float: reference value
+			int16_t E; // binary scale factor
+			int16_t D; // decimal scale factor
+			uint8_t num_bits;
+			uint8_t type_org; // code table 5.1
+			uint8_t group_splitting; // code table 5.4
+			uint8_t missing_management; // code table 5.5
+			union {
+				uint32_t u;
+				float f;
+			} primary_missing; // substitute of primary missing values
+			union {
+				uint32_t u;
+				float f;
+			} secondary_missing; // substitute of secondary missing values
+			uint32_t num_groups;
+			uint8_t ref_group_widths;
+			uint8_t bits_group_widths;
+			uint32_t ref_group_lengths;
+			uint8_t incr_group_lengths;
+			uint32_t last_group_length; // true length of the last group
+			uint8_t bits_group_lengths;
+			uint8_t order; // template 5.3 only: order of spatial differencing, code table 5.6
+			uint8_t num_octets; // template 5.3 only: octets of the extra descriptors
+		} gp_complex;
+		struct gp_ieee_t // template 5.4
+		{
+			uint8_t precision; // code table 5.7
+		} gp_ieee;
 		struct gp_jpeg2000_t // templte 5.40
 		{
 			union {
@@ -248,6 +311,20 @@ struct data_representation_section_t
 			uint8_t num_bits;
 			uint8_t type_org; // code table 5.1
 		} gp_png;
+		struct gp_ccsds_t // template 5.42
+		{
+			union {
+				uint32_t u;
+				float f;
+			} R; // IEEE-754 binary 32bit float: reference value
+			int16_t E; // binary scale factor
+			int16_t D; // decimal scale factor
+			uint8_t num_bits;
+			uint8_t type_org; // code table 5.1
+			uint8_t flags; // CCSDS compression options mask
+			uint8_t block_size;
+			uint16_t rsi; // reference sample interval
+		} gp_ccsds;
 		struct sd_simple_t // template 5.50
 		{
 			union {
@@ -267,14 +344,30 @@ struct bitmap_section_t
 	uint32_t length;
 	uint8_t number;
 	uint8_t bitmap_indicator;
-	std::vector<char> bitmap;
+	span_t bitmap; // points into the message buffer
 };
 
 struct data_section_t
 {
 	uint32_t length;
 	uint8_t number;
-	std::vector<double> data;
+	span_t section; // the entire section within the message buffer, empty if the data was skipped
+	data_representation_section_t drs; // data representation in effect for this section
+	bool unpacked;
+	std::vector<double> data; // unpacked on demand, see values()
+
+	data_section_t()
+		: length(0)
+		, number(0)
+		, unpacked(false)
+	{
+		section.data = NULL;
+		section.size = 0;
+	}
+
+	/// Unpacks the values on the first access, throws std::exception if the
+	/// data cannot be unpacked.
+	const std::vector<double> & values();
 };
 
 struct message_t
@@ -287,6 +380,24 @@ struct message_t
 	data_representation_section_t drs;
 	bitmap_section_t bm;
 	data_section_t ds;
+
+	std::vector<uint8_t> buffer; // message data, if read from a stream
+
+	message_t()
+		: is()
+		, ids()
+		, lus()
+		, gds()
+		, pds()
+		, drs()
+		, bm()
+		, ds()
+	{}
+
+	private:
+		// not copyable: the spans point into the buffer of the original
+		message_t(const message_t &);
+		message_t & operator=(const message_t &);
 };
 
 class not_implemented : public std::exception
@@ -327,6 +438,12 @@ class not_implemented : public std::exception
 };
 
 int unpack(message_t &, std::istream &);
+int unpack(message_t &, const uint8_t *, std::size_t);
+int unpack(message_t &, const uint8_t *, std::size_t, std::size_t &);
+int unpack_metadata(message_t &, std::istream &);
+int unpack_metadata(message_t &, const uint8_t *, std::size_t);
+void set_unpack_split(std::size_t, unsigned int);
+unsigned int set_unpack_split_threads(unsigned int);
 
 }
 
@@ -0,0 +1,107 @@
+#include <grib2_parallel.hpp>
+#include <iostream>
+#include <scan.h>
+#include <workpool.h>
+
+namespace grib2 {
+
+namespace {
+
+/// State shared by the tasks of unpack_parallel().
+struct parallel_t
+{
+	const uint8_t * data;
+	std::size_t size;
+	std::vector<std::size_t> offsets; // offsets of the messages within the data
+	message_t * slots; // one message per slot of the pool
+	message_handler * handler;
+};
+
+}
+
+/// Determines the positions of all messages within the memory, messages
+/// which are truncated are skipped.
+static void frame(parallel_t & p) // {{{
+{
+	std::size_t cursor = 0;
+	std::size_t pos;
+	uint64_t total_length;
+
+	while (cursor < p.size) {
+		pos = cursor + grib_find_message(p.data + cursor, p.size - cursor, 2);
+		if (pos + 16 > p.size) break;
+		total_length = 0;
+		for (int n = 8; n < 16; ++n) total_length = (total_length << 8) | p.data[pos + n];
+		if (total_length < 16 || total_length > p.size - pos) {
+			cursor = pos + 4;
+			continue;
+		}
+		p.offsets.push_back(pos);
+		cursor = pos + static_cast<std::size_t>(total_length);
+	}
+} // }}}
+
+/// Unpacks a message and the values of its data section into a slot.
+static int run(void * ptr, std::size_t task, std::size_t slot) // {{{
+{
+	parallel_t & p = *static_cast<parallel_t *>(ptr);
+	message_t & grib = p.slots[slot];
+	std::size_t pos = p.offsets[task];
+
+	if (unpack(grib, p.data + pos, p.size - pos) != 0) return -1;
+	try {
+		grib.ds.values();
+	} catch (...) {
+		std::cerr << "EXCEPTION: cannot unpack data section" << std::endl;
+		return -1;
+	}
+	return 0;
+} // }}}
+
+static int emit(void * ptr, std::size_t task, std::size_t slot) // {{{
+{
+	parallel_t & p = *static_cast<parallel_t *>(ptr);
+
+	try {
+		return (*p.handler)(p.slots[slot], task) ? 0 : -1;
+	} catch (...) {
+		return -1;
+	}
+} // }}}
+
+/// Unpacks all messages within the memory on a pool of threads, the messages
+/// are passed to the handler. A message which cannot be unpacked aborts the
+/// run, the messages unpacked but not passed yet are dropped.
+/// The messages keep pointers into the memory, see unpack(). Data sections are
+/// unpacked by a single thread while the pool runs, see
+/// set_unpack_split_threads().
+///
+/// @param[in] data The memory, may contain any number of messages.
+/// @param[in] size Number of octets of the memory.
+/// @param[in] handler Receives the messages.
+/// @param[in] num_threads Number of threads, 0 for one per processor.
+/// @param[in] ordered Pass the messages in the order of the memory, otherwise
+///     in the order they are unpacked.
+/// @retval 0 Success
+/// @retval -1 Failure, a message cannot be unpacked, or aborted by the handler
+int unpack_parallel(const uint8_t * data, std::size_t size, message_handler & handler, unsigned int num_threads, bool ordered)
+{
+	parallel_t p;
+	unsigned int split_threads;
+	int rc;
+
+	if (data == NULL) return -1;
+	p.data = data;
+	p.size = size;
+	p.handler = &handler;
+	frame(p);
+	p.slots = new message_t[workpool_slots(num_threads, ordered ? 1 : 0)];
+
+	split_threads = set_unpack_split_threads(1); // the messages are unpacked in parallel, not the data sections
+	rc = workpool_run(p.offsets.size(), num_threads, ordered ? 1 : 0, run, emit, &p);
+	set_unpack_split_threads(split_threads);
+	delete [] p.slots;
+	return rc;
+}
+
+}
@@ -0,0 +1,29 @@
+#ifndef __GRIB2_PARALLEL__HPP__
+#define __GRIB2_PARALLEL__HPP__
+
+#include <grib2.hpp>
+
+namespace grib2 {
+
+/// Receives the messages unpacked by unpack_parallel().
+class message_handler
+{
+	public:
+		virtual ~message_handler()
+		{}
+
+		/// Called for every message with the values of its data section
+		/// already unpacked, never concurrently. The message is only valid
+		/// during the call.
+		///
+		/// @param[in] message The message.
+		/// @param[in] n Number of the message within the memory.
+		/// @return true to continue, false to abort.
+		virtual bool operator()(message_t & message, std::size_t n) = 0;
+};
+
+int unpack_parallel(const uint8_t *, std::size_t, message_handler &, unsigned int num_threads = 0, bool ordered = true);
+
+}
+
+#endif
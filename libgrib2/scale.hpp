@@ -0,0 +1,39 @@
+#ifndef __SCALE__HPP__
+#define __SCALE__HPP__
+
+#include <cstddef>
+#include <stdint.h>
+
+namespace grib2 {
+
+/// Unpacks simple packed values and writes the scaled values directly
+/// into the output. The values are read in chunks through the iterator
+/// (see bitset::const_iterator::read) and then converted in a separate
+/// tight loop:
+///
+///   y = (R + x * 2^E) * 10^-D = ref + x * scale
+///
+/// @param[inout] i Iterator pointing to the first packed value.
+/// @param[in] bits Width of the packed values in bits.
+/// @param[in] count Number of values to unpack.
+/// @param[in] ref Reference value, already scaled: R * 10^-D
+/// @param[in] scale Combined scale factor: 2^E * 10^-D
+/// @param[out] out The output, must be able to hold 'count' values.
+template <class Iterator> void unpack_scaled(Iterator & i, unsigned int bits, std::size_t count,
+	double ref, double scale, double * out)
+{
+	const std::size_t CHUNK = 1024;
+	uint32_t vals[CHUNK];
+
+	for (std::size_t base = 0; base < count; base += CHUNK) {
+		std::size_t num = (count - base < CHUNK) ? count - base : CHUNK;
+		i.read(vals, num, bits);
+		for (std::size_t k = 0; k < num; ++k) {
+			out[base + k] = ref + vals[k] * scale;
+		}
+	}
+}
+
+}
+
+#endif
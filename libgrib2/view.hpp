@@ -0,0 +1,59 @@
+#ifndef __VIEW__HPP__
+#define __VIEW__HPP__
+
+#include <cstddef>
+
+/// Non-owning, read-only container over a contiguous range of memory.
+///
+/// This is meant to be used as container of a bitset, to read data in place
+/// (e.g. from a memory mapped file or a buffer supplied by the caller) without
+/// copying it. The memory must outlive the view and every bitset using it.
+/// Only the read interface of a container is provided.
+template <typename T> class view
+{
+	public:
+		typedef T value_type;
+		typedef const T & const_reference;
+		typedef const T * const_iterator;
+		typedef std::size_t size_type;
+	private:
+		const_iterator first;
+		const_iterator last;
+	public:
+		view()
+			: first(NULL)
+			, last(NULL)
+		{}
+
+		view(const_iterator begin, const_iterator end)
+			: first(begin)
+			, last(end)
+		{}
+
+		const_iterator begin() const
+		{
+			return first;
+		}
+
+		const_iterator end() const
+		{
+			return last;
+		}
+
+		size_type size() const
+		{
+			return static_cast<size_type>(last - first);
+		}
+
+		bool empty() const
+		{
+			return first == last;
+		}
+
+		const_reference operator [] (size_type i) const
+		{
+			return first[i];
+		}
+};
+
+#endif